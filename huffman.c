@@ -1,11 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <string.h>
 #include <math.h>
 #include "huffman.h"
-
-#define HUFFMAN_OPTIONS "hpksve:d:"
+#include "huffman_codec.h"
+#include "huffman_stats.h"
+#include "huffman_aio.h"
+#include "huffman_io.h"
+#include "huffman_archive.h"
+#include "huffman_grep.h"
+
+#define HUFFMAN_OPTIONS "hpksvnfe:a:d:t:c:l:x:"
 #define HUFFMAN_OPT_FAIL 0x00
 #define HUFFMAN_OPT_ENCODE 0x01
 #define HUFFMAN_OPT_DECODE 0x02
@@ -14,6 +21,36 @@
 #define HUFFMAN_OPT_HELP 0x10
 #define HUFFMAN_OPT_PRINT_TREE 0x20
 #define HUFFMAN_OPT_KEEP_FILE 0x40
+#define HUFFMAN_OPT_STATS_JSON 0x80
+#define HUFFMAN_OPT_ESTIMATE 0x100
+#define HUFFMAN_OPT_TEST 0x200
+#define HUFFMAN_OPT_FAST 0x400
+#define HUFFMAN_OPT_ARCHIVE 0x800
+#define HUFFMAN_OPT_LIST 0x1000
+#define HUFFMAN_OPT_EXTRACT 0x2000
+#define HUFFMAN_OPT_GREP 0x4000
+#define HUFFMAN_OPT_APPEND 0x8000
+#define HUFFMAN_OPT_FILE (HUFFMAN_OPT_ENCODE | HUFFMAN_OPT_DECODE | \
+	HUFFMAN_OPT_TEST | HUFFMAN_OPT_ARCHIVE | HUFFMAN_OPT_LIST | \
+	HUFFMAN_OPT_EXTRACT | HUFFMAN_OPT_GREP | HUFFMAN_OPT_APPEND)
+/* the actions coding a file */
+#define HUFFMAN_OPT_CODE (HUFFMAN_OPT_ENCODE | HUFFMAN_OPT_ARCHIVE | \
+	HUFFMAN_OPT_APPEND)
+
+/* long options, returned by getopt_long() outside of the char range */
+#define HUFFMAN_LONG_OPT_STATS_FORMAT 0x100
+#define HUFFMAN_STATS_FORMAT_TEXT "text"
+#define HUFFMAN_STATS_FORMAT_JSON "json"
+#define HUFFMAN_LONG_OPT_IO 0x101
+#define HUFFMAN_LONG_OPT_IO_BUFFER_SIZE 0x102
+#define HUFFMAN_LONG_OPT_DIRECT 0x103
+#define HUFFMAN_LONG_OPT_DECODER 0x104
+#define HUFFMAN_LONG_OPT_CODEBOOK 0x105
+#define HUFFMAN_LONG_OPT_DEDUP 0x106
+#define HUFFMAN_LONG_OPT_INDEX 0x107
+#define HUFFMAN_LONG_OPT_GREP 0x108
+#define HUFFMAN_LONG_OPT_JOBS 0x109
+#define HUFFMAN_LONG_OPT_TOKENS 0x10A
 
 #define KILO 1000
 #define KILO_BYTE 1024
@@ -31,206 +68,141 @@
 #define MAX(X,Y) ((X < Y) ? Y : X)
 #define MIN(X,Y) ((X < Y) ? X : Y)
 
-char compressed_file_name[MAX_FILE_NAME_SIZE];
-char uncompressed_file_name[MAX_FILE_NAME_SIZE];
-u32 frequency[ANSI_CHAR_SET_CARDINALITY];
-u8 character_set_cardinality;
-u8 representation_length[ANSI_CHAR_SET_CARDINALITY];
-u32 uncompressed_file_length;
-int huffman_print_tree;
-huff_tree_node_t *tree_root;
-bit_t *dictionary[ANSI_CHAR_SET_CARDINALITY];
-
-int huffman_keep_file;
-u32 compressed_file_length;
-u32 header_length;
-u32 coded_length;
-
-int huffman_encode(void);
-int huffman_decode(void);
-
-/* Allocates a new node for the huffman tree. */
-huff_tree_node_t *huff_tree_node_alloc(u8 character, int freq)
-{
-	huff_tree_node_t *node = (huff_tree_node_t*)calloc(1,
-		sizeof(huff_tree_node_t));
-
-	if (!node)
-		return NULL;
-
-	HUFF_NODE_CHAR(node)=character;
-	HUFF_NODE_FREQ(node)=freq;
-
-	return node;
-}
-
-/* Frees a huffman tree node. */
-void huff_tree_node_free(huff_tree_node_t *node)
-{
-	free(node);
-}
-
-/* Insert node into the minimum priority queue rooted at tree_root. */
-void huff_tree_insert_node(huff_tree_node_t *node)
-{
-	huff_tree_node_t **tree_ptr = &tree_root;
-
-	while (*tree_ptr) {
-		if (HUFF_NODE_FREQ(node) < HUFF_NODE_FREQ(*tree_ptr))
-			break;
-		tree_ptr=&HUFF_NODE_NEXT(*tree_ptr);
-	}
-
-	HUFF_NODE_NEXT(node)=*tree_ptr;
-	*tree_ptr=node;
-}
-
-void huff_delete_tree(huff_tree_node_t *node) 
-{
-	if (HUFF_NODE_LSON(node))
-		huff_delete_tree(HUFF_NODE_LSON(node));
-
-	if (HUFF_NODE_RSON(node))
-		huff_delete_tree(HUFF_NODE_RSON(node));
-
-	if (HUFF_NODE_NEXT(node))
-		huff_delete_tree(HUFF_NODE_NEXT(node));
-
-	huff_tree_node_free(node);
-}
-
-static void huff_print_tree_rec(huff_tree_node_t *node, int offset,
-	char node_char)
-{
-#define NODE_OFFSET 3
-#define CHARACTER_BUF_LEN 10
-#define CHAR_ZERO 0
-#define CHAR_SLASH_A 7
-#define CHAR_SLASH_B 8
-#define CHAR_TAB 9
-#define CHAR_NEWLINE 10
-#define CHAR_RETURN 13
-#define CHAR_BACKSPACE 27
-#define CHAR_SPACE 32
-#define CHARACTER(X) ('A' <= X && X <= 'Z')
-
-	int i;
-
-	for (i = 0; i < offset; i++)
-		printf(" ");
-
-	printf("%c", node_char);
-	if (HUFF_NODE_ISLEAF(node))
-		printf("(%i)", representation_length[node->character]);
-	printf("->");
-
-	if (!node) {
-		printf("NULL\n");
-		goto Exit;
-	}
-
-	if (HUFF_NODE_ISLEAF(node)) {
-		static char ch[10];
-
-		switch(node->character) {
-		case CHAR_ZERO:
-			snprintf(ch, CHARACTER_BUF_LEN, "\\0");
-			break;
-		case CHAR_SLASH_A:
-			snprintf(ch, CHARACTER_BUF_LEN, "\\a");
-			break;
-		case CHAR_SLASH_B:
-			snprintf(ch, CHARACTER_BUF_LEN, "\\b");
-			break;
-		case CHAR_TAB:
-			snprintf(ch, CHARACTER_BUF_LEN, "\\tab");
-			break;
-		case CHAR_NEWLINE:
-			snprintf(ch, CHARACTER_BUF_LEN, "\\n");
-			break;
-		case CHAR_RETURN:
-			snprintf(ch, CHARACTER_BUF_LEN, "\\r");
-			break;
-		case CHAR_BACKSPACE:
-			snprintf(ch, CHARACTER_BUF_LEN, "\\backspace");
-			break;
-		case CHAR_SPACE:
-			snprintf(ch, CHARACTER_BUF_LEN, "\\space");
-			break;
-		default:
-			snprintf(ch, CHARACTER_BUF_LEN, "%c", node->character);
-			break;
-		}
-
-		/* printing character */
-		printf("'%s'", ch);
-		printf(" (%lu)", frequency[node->character]);
-		printf("\n");
-		goto Exit;
-	}
-
-	printf("\n");
-	huff_print_tree_rec(HUFF_NODE_RSON(node), offset + NODE_OFFSET,
-		HUFF_PRINT_RIGHT);
-	huff_print_tree_rec(HUFF_NODE_LSON(node), offset + NODE_OFFSET,
-		HUFF_PRINT_LEFT);
-
-Exit:
-	return;
-}
-
-void huff_print_tree(void)
-{
-	huff_print_tree_rec(tree_root, 0, HUFF_PRINT_ROOT);
-	printf("\n");
-}
-
-bit_t *bit_stack_alloc(int num)
-{
-	int i;
-	bit_t *stack = NULL;
-
-	if (!(stack = (bit_t*)calloc(num, sizeof(bit_t))))
-		return NULL;
-
-	for (i = 0; i<num; i++)
-		stack[i] = NO_BIT;
-
-	return stack;
-}
-
-bit_t *bit_stack_clone(bit_t *stack, int offset)
-{
-	int i;
-	bit_t *new_stack = NULL;
-
-	if (!(new_stack = calloc(offset + 1, sizeof(bit_t))))
-		return NULL;
-
-	for (i = 0; i < offset; i++)
-		new_stack[i] = stack[i];
-	new_stack[offset] = NO_BIT;
-	return new_stack;
-}
-
-void bit_stack_free(bit_t *ptr)
-{
-	free(ptr);
-}
+/* character representation length statistics for the -v option */
+typedef struct huff_verbose_t {
+	double header_ratio;
+	double huffman_ratio;
+	double exact_ratio; /* huffman_ratio with exact histograms (-f) */
+	double mean;
+	double std_dev;
+	double var;
+	int min_rep_length;
+	int max_rep_length;
+	int cardinality; /* of the whole file */
+	u64 breakdown[ANSI_CHAR_SET_CARDINALITY]; /* length frequency */
+} huff_verbose_t;
+
+/* the files following the options: the members of an archive */
+static char **huff_operands;
+static int huff_operand_count;
+
+/* the --grep pattern and the number of processes searching for it */
+static char *huff_grep_pattern;
+static int huff_grep_jobs;
+
+/* the -a file, appended to the file_name.huf following the options */
+static char *huff_append_file;
+
+static struct option huffman_long_options[] = {
+	{"stats-format", required_argument, NULL,
+		HUFFMAN_LONG_OPT_STATS_FORMAT},
+	{"io", required_argument, NULL, HUFFMAN_LONG_OPT_IO},
+	{"io-buffer-size", required_argument, NULL,
+		HUFFMAN_LONG_OPT_IO_BUFFER_SIZE},
+	{"direct", no_argument, NULL, HUFFMAN_LONG_OPT_DIRECT},
+	{"decoder", required_argument, NULL, HUFFMAN_LONG_OPT_DECODER},
+	{"codebook", required_argument, NULL, HUFFMAN_LONG_OPT_CODEBOOK},
+	{"dedup", no_argument, NULL, HUFFMAN_LONG_OPT_DEDUP},
+	{"index", no_argument, NULL, HUFFMAN_LONG_OPT_INDEX},
+	{"grep", required_argument, NULL, HUFFMAN_LONG_OPT_GREP},
+	{"jobs", required_argument, NULL, HUFFMAN_LONG_OPT_JOBS},
+	{"tokens", no_argument, NULL, HUFFMAN_LONG_OPT_TOKENS},
+	{NULL, 0, NULL, 0},
+};
 
 static void huff_usage(char* argv[])
 {
 #define ASCII_COPYRIGHT 169
 
-	printf("Usage: %s [-p] [-k] [-s | -v] <-e file_name | " 
-			"-d file_name.huf>\n", argv[0]);
+	printf("Usage: %s [-p] [-k] [-s | -v [--stats-format=text|json]] " 
+			"<-e file_name | -d file_name.huf>\n", argv[0]);
+	printf("       %s [-p] [-k] [-s | -v [--stats-format=text|json]] -f " \
+		"-e file_name\n", argv[0]);
+	printf("       %s [-p] [-v] [--stats-format=text|json] -n " \
+		"-e file_name\n", argv[0]);
+	printf("       %s [-p] [-s | -v [--stats-format=text|json]] " \
+		"-t file_name.huf\n", argv[0]);
+	printf("       %s [-p] [-k] [-s | -v [--stats-format=text|json]] " \
+		"-c archive.huf file...\n", argv[0]);
+	printf("       %s [-p] [-k] [-s | -v [--stats-format=text|json]] " \
+		"-a file_name file_name.huf\n", argv[0]);
+	printf("       %s -l archive.huf | -x archive.huf [member...]\n",
+		argv[0]);
+	printf("       %s [--jobs=n] --grep=pattern file_name.huf\n",
+		argv[0]);
 	printf("       %s [-h]\n\n", argv[0]);
 	printf("  Where -p   print the corresponding huffman tree\n");
 	printf("        -k   keep the original file\n");
 	printf("        -s   display general statistics\n");
 	printf("        -v   display verbose output (implies -s)\n");
+	printf("        --stats-format\n");
+	printf("             print the -s/-v statistics and the per stage " \
+		"timing as text\n");
+	printf("             (default) or as a single JSON object\n");
+	printf("        --io the io backend: auto (default, io_uring where " \
+		"available and a\n");
+	printf("             worker thread otherwise), uring, thread or " \
+		"stdio\n");
+	printf("        --io-buffer-size\n");
+	printf("             size of the io buffers in bytes, K or M, a " \
+		"multiple of 4K\n");
+	printf("             (default 1M)\n");
+	printf("        --direct\n");
+	printf("             bypass the page cache (O_DIRECT) where the file " \
+		"system allows\n");
+	printf("        --decoder\n");
+	printf("             the decoding engine: fsm (default, a u8 at a " \
+		"time) or tree (a bit\n");
+	printf("             at a time)\n");
+	printf("        -n   estimate the compressed length of 'file_name' " \
+		"and its entropy\n");
+	printf("             bound without creating a compressed file " \
+		"(implies -s)\n");
+	printf("        -f   fast mode: encode in a single pass with a code " \
+		"built from a\n");
+	printf("             sample of 'file_name', -v reports the " \
+		"compression lost\n");
+	printf("        --codebook\n");
+	printf("             with -e or -a, code every block with the " \
+		"codebook of the first\n");
+	printf("             block of the given .huf file, see huffman_gen\n");
+	printf("        --dedup\n");
+	printf("             with -e, -a or -c, split the files into content " \
+		"defined chunks\n");
+	printf("             and write every repeated chunk as a reference to " \
+		"its first copy\n");
+	printf("        --tokens\n");
+	printf("             with -e, -a or -c, code blocks of text as words " \
+		"and separators\n");
+	printf("             where that is shorter, a whole word per code\n");
+	printf("        --index\n");
+	printf("             with -e, follow the trailer with an index of the " \
+		"blocks and the\n");
+	printf("             characters each holds, for --grep\n");
+	printf("        --grep\n");
+	printf("             print the lines of 'file_name.huf' holding the " \
+		"pattern, decoding\n");
+	printf("             only the blocks that may hold it if the file has " \
+		"an index\n");
+	printf("        --jobs\n");
+	printf("             with --grep, the number of processes searching " \
+		"an indexed file\n");
+	printf("             (default, one per processor)\n");
 	printf("        -e   encode the text file 'file_name'\n");
+	printf("        -a   append the text file 'file_name' to " \
+		"'file_name.huf', writing its\n");
+	printf("             blocks over the trailer and extending the index " \
+		"if it has one\n");
 	printf("        -d   decode the compressed file 'file_name.huf'\n");
+	printf("        -t   test the checksums of 'file_name.huf' without " \
+		"creating or\n");
+	printf("             removing any file\n");
+	printf("        -c   create 'archive.huf' of the files, and of every " \
+		"file below the\n");
+	printf("             directories, given\n");
+	printf("        -l   list the members of 'archive.huf'\n");
+	printf("        -x   extract the members given, or all members, of " \
+		"'archive.huf'\n");
 	printf("        -h   print this message and exit\n\n");
 	printf("NOTE:\n");
 	printf("- All compressed files must have a '.huf' suffix.\n");
@@ -315,12 +287,81 @@ static int huff_set_names(char *uncompressed_fn, char *compressed_fn)
 	return 0;
 }
 
+/* Set huffman_aio_backend by its name.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_set_io(char *name)
+{
+	static char *names[] = {"auto", "uring", "thread", "stdio"};
+	int i;
+
+	for (i = 0; i < sizeof(names) / sizeof(char*); i++) {
+		if (!strcmp(name, names[i])) {
+			huffman_aio_backend = (huff_aio_backend_t)i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* Set huffman_decoder_engine by its name.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_set_decoder(char *name)
+{
+	static char *names[] = {"tree", "fsm"};
+	int i;
+
+	for (i = 0; i < sizeof(names) / sizeof(char*); i++) {
+		if (!strcmp(name, names[i])) {
+			huffman_decoder_engine = (huff_decoder_engine_t)i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* Set huffman_io_buf_size from a size in u8s, optionally followed by K or M.
+ * The size must be a multiple of HUFFMAN_IO_BUF_MIN up to HUFFMAN_IO_BUF_MAX.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_set_io_buf_size(char *size)
+{
+	unsigned long long val;
+	char *end = NULL;
+
+	val = strtoull(size, &end, 10);
+	switch (*end) {
+	case 'k':
+	case 'K':
+		val *= KILO_BYTE;
+		end++;
+		break;
+	case 'm':
+	case 'M':
+		val *= MEGA_BYTE;
+		end++;
+		break;
+	}
+
+	if (end == size || *end || val < HUFFMAN_IO_BUF_MIN ||
+		val > HUFFMAN_IO_BUF_MAX || val % HUFFMAN_IO_BUF_MIN) {
+		return -1;
+	}
+
+	huffman_io_buf_size = (size_t)val;
+	return 0;
+}
+
 static int huff_parse_command_line(int argc, char* argv[])
 {
-	char option;
-	int ret = 0, expected_arg_num = 3;
+	int option, ret = 0, expected_arg_num = 3, has_format = 0, has_io = 0;
+	int has_buf_size = 0, has_decoder = 0;
 
-	while (((option = getopt(argc, argv, HUFFMAN_OPTIONS)) != -1)) {
+	while (((option = getopt_long(argc, argv, HUFFMAN_OPTIONS,
+		huffman_long_options, NULL)) != -1)) {
 		switch (option) {
 		case 'h':
 			expected_arg_num = 2;
@@ -349,16 +390,37 @@ static int huff_parse_command_line(int argc, char* argv[])
 			expected_arg_num++;
 			ret |= HUFFMAN_OPT_STATISTICS;
 			break;
+		case 'n':
+			if (ret & HUFFMAN_OPT_ESTIMATE)
+				goto Error;
+			expected_arg_num++;
+			ret |= HUFFMAN_OPT_ESTIMATE;
+			break;
+		case 'f':
+			if (ret & HUFFMAN_OPT_FAST)
+				goto Error;
+			expected_arg_num++;
+			ret |= HUFFMAN_OPT_FAST;
+			break;
 		case 'e':
-			if ((ret & (HUFFMAN_OPT_ENCODE | HUFFMAN_OPT_DECODE)) ||
+			if ((ret & HUFFMAN_OPT_FILE) ||
 				huff_set_names(optarg,
 					huff_compress_file_name(optarg))) {
 				goto Error;
 			}
 			ret |= HUFFMAN_OPT_ENCODE;
 			break;
+		case 'a':
+			/* file_name.huf follows the options */
+			if ((ret & HUFFMAN_OPT_FILE) ||
+				!huff_compress_file_name(optarg)) {
+				goto Error;
+			}
+			huff_append_file = optarg;
+			ret |= HUFFMAN_OPT_APPEND;
+			break;
 		case 'd':
-			if ((ret & (HUFFMAN_OPT_ENCODE | HUFFMAN_OPT_DECODE)) ||
+			if ((ret & HUFFMAN_OPT_FILE) ||
 				huff_set_names(
 					huff_uncompress_file_name(optarg),
 					optarg)) {
@@ -366,16 +428,146 @@ static int huff_parse_command_line(int argc, char* argv[])
 			}
 			ret |= HUFFMAN_OPT_DECODE;
 			break;
+		case 't':
+			if ((ret & HUFFMAN_OPT_FILE) ||
+				huff_set_names(
+					huff_uncompress_file_name(optarg),
+					optarg)) {
+				goto Error;
+			}
+			ret |= HUFFMAN_OPT_TEST;
+			break;
+		case 'c':
+		case 'l':
+		case 'x':
+			if ((ret & HUFFMAN_OPT_FILE) ||
+				huff_set_names(
+					huff_uncompress_file_name(optarg),
+					optarg)) {
+				goto Error;
+			}
+			ret |= option == 'c' ? HUFFMAN_OPT_ARCHIVE :
+				option == 'l' ? HUFFMAN_OPT_LIST :
+				HUFFMAN_OPT_EXTRACT;
+			break;
+		case HUFFMAN_LONG_OPT_STATS_FORMAT:
+			if (has_format)
+				goto Error;
+			has_format = 1;
+
+			/* --stats-format=json or --stats-format json */
+			expected_arg_num += optarg == argv[optind - 1] ? 2 : 1;
+			if (!strcmp(optarg, HUFFMAN_STATS_FORMAT_JSON))
+				ret |= HUFFMAN_OPT_STATS_JSON;
+			else if (strcmp(optarg, HUFFMAN_STATS_FORMAT_TEXT))
+				goto Error;
+			break;
+		case HUFFMAN_LONG_OPT_IO:
+			if (has_io || huff_set_io(optarg))
+				goto Error;
+			has_io = 1;
+			expected_arg_num += optarg == argv[optind - 1] ? 2 : 1;
+			break;
+		case HUFFMAN_LONG_OPT_IO_BUFFER_SIZE:
+			if (has_buf_size || huff_set_io_buf_size(optarg))
+				goto Error;
+			has_buf_size = 1;
+			expected_arg_num += optarg == argv[optind - 1] ? 2 : 1;
+			break;
+		case HUFFMAN_LONG_OPT_DECODER:
+			if (has_decoder || huff_set_decoder(optarg))
+				goto Error;
+			has_decoder = 1;
+			expected_arg_num += optarg == argv[optind - 1] ? 2 : 1;
+			break;
+		case HUFFMAN_LONG_OPT_CODEBOOK:
+			if (huffman_codebook)
+				goto Error;
+			huffman_codebook = optarg;
+			expected_arg_num += optarg == argv[optind - 1] ? 2 : 1;
+			break;
+		case HUFFMAN_LONG_OPT_DIRECT:
+			if (huffman_io_direct)
+				goto Error;
+			huffman_io_direct = 1;
+			expected_arg_num++;
+			break;
+		case HUFFMAN_LONG_OPT_DEDUP:
+			if (huffman_dedup)
+				goto Error;
+			huffman_dedup = 1;
+			expected_arg_num++;
+			break;
+		case HUFFMAN_LONG_OPT_TOKENS:
+			if (huffman_tokens)
+				goto Error;
+			huffman_tokens = 1;
+			expected_arg_num++;
+			break;
+		case HUFFMAN_LONG_OPT_INDEX:
+			if (huffman_index)
+				goto Error;
+			huffman_index = 1;
+			expected_arg_num++;
+			break;
+		case HUFFMAN_LONG_OPT_GREP:
+			if (ret & HUFFMAN_OPT_FILE)
+				goto Error;
+			huff_grep_pattern = optarg;
+			ret |= HUFFMAN_OPT_GREP;
+
+			/* file_name.huf follows the options */
+			expected_arg_num += optarg == argv[optind - 1] ? 0 : -1;
+			break;
+		case HUFFMAN_LONG_OPT_JOBS:
+			if (huff_grep_jobs ||
+				(huff_grep_jobs = atoi(optarg)) <= 0 ||
+				huff_grep_jobs > HUFFMAN_GREP_MAX_JOBS) {
+				goto Error;
+			}
+			expected_arg_num += optarg == argv[optind - 1] ? 2 : 1;
+			break;
 		default:
 			goto Error;
 		}
 	}
 
 	if (((ret & HUFFMAN_OPT_HELP) && (ret ^ HUFFMAN_OPT_HELP)) ||
-		(expected_arg_num != argc)) {
+		(has_format &&
+		 !(ret & (HUFFMAN_OPT_STATISTICS | HUFFMAN_OPT_ESTIMATE))) ||
+		((ret & HUFFMAN_OPT_ESTIMATE) && !(ret & HUFFMAN_OPT_ENCODE)) ||
+		((ret & HUFFMAN_OPT_FAST) &&
+		 (!(ret & HUFFMAN_OPT_CODE) || (ret & HUFFMAN_OPT_ESTIMATE))) ||
+		(huffman_codebook &&
+		 (!(ret & HUFFMAN_OPT_CODE) ||
+		 (ret & (HUFFMAN_OPT_ESTIMATE | HUFFMAN_OPT_FAST)))) ||
+		(huffman_dedup &&
+		 (!(ret & HUFFMAN_OPT_CODE) || (ret & HUFFMAN_OPT_ESTIMATE))) ||
+		(huffman_tokens &&
+		 (!(ret & HUFFMAN_OPT_CODE) ||
+		 (ret & HUFFMAN_OPT_FAST) || huffman_codebook)) ||
+		(huffman_index &&
+		 (!(ret & HUFFMAN_OPT_ENCODE) || (ret & HUFFMAN_OPT_ESTIMATE))) ||
+		(huff_grep_jobs && !(ret & HUFFMAN_OPT_GREP)) ||
+		((ret & (HUFFMAN_OPT_LIST | HUFFMAN_OPT_EXTRACT |
+		 HUFFMAN_OPT_GREP)) &&
+		 (ret & (HUFFMAN_OPT_STATISTICS | HUFFMAN_OPT_PRINT_TREE))) ||
+		((ret & HUFFMAN_OPT_ARCHIVE) && optind == argc) ||
+		((ret & HUFFMAN_OPT_GREP) && (optind + 1 != argc ||
+		 huff_set_names(huff_uncompress_file_name(argv[optind]),
+		 argv[optind]))) ||
+		((ret & HUFFMAN_OPT_APPEND) && (optind + 1 != argc ||
+		 !huff_uncompress_file_name(argv[optind]) ||
+		 huff_set_names(huff_append_file, argv[optind]))) ||
+		(!(ret & (HUFFMAN_OPT_ARCHIVE | HUFFMAN_OPT_EXTRACT |
+		 HUFFMAN_OPT_GREP | HUFFMAN_OPT_APPEND)) && optind != argc) ||
+		(expected_arg_num + argc - optind != argc)) {
 		goto Error;
 	}
 
+	huff_operands = argv + optind;
+	huff_operand_count = argc - optind;
+
 	return ret;
 
 Error:
@@ -383,7 +575,7 @@ Error:
 	return HUFFMAN_OPT_FAIL;
 }
 
-static char *huff_print_length(u32 file_length)
+static char *huff_print_length(u64 file_length)
 {
 #define BUFFER_LENGTH 10
 	static char length_buf[BUFFER_LENGTH];
@@ -394,7 +586,7 @@ static char *huff_print_length(u32 file_length)
 		snprintf(length_buf, BUFFER_LENGTH -1, "1byte");
 	} else {
 		if (file_length < KILO) {
-			snprintf(length_buf, BUFFER_LENGTH - 1, "%lubytes",
+			snprintf(length_buf, BUFFER_LENGTH - 1, "%llubytes",
 				file_length);
 		} else {
 			if (file_length < MEGA) {
@@ -418,111 +610,328 @@ static char *huff_print_length(u32 file_length)
 	return length_buf;
 }
 
+/* Return part as a percentage of whole, 0 if whole is empty. */
+static double huff_percent(double part, double whole)
+{
+	return whole ? part / whole * 100 : 0;
+}
+
+/* Return the MB/s of processing bytes in elapsed nanoseconds. */
+static double huff_throughput(u64 bytes, u64 elapsed)
+{
+	return elapsed ? (double)bytes / MEGA_BYTE / ((double)elapsed / GIGA) :
+		0;
+}
+
+/* Print str as a JSON string, escaping quotes, backslashes and control
+ * characters.
+ */
+static void huff_print_json_string(char *str)
+{
+	printf("\"");
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			printf("\\%c", *str);
+		else if ((u8)*str < ' ')
+			printf("\\u%04x", (u8)*str);
+		else
+			printf("%c", *str);
+	}
+	printf("\"");
+}
+
+/* Compute the character representation length statistics printed by -v.
+ * Return 0 if there is anything to report, otherwise -1.
+ */
+static int huff_compute_verbose(huff_verbose_t *verbose)
+{
+	double uncompressed_file_length_in_bits =
+		(double)uncompressed_file_length * BYTE;
+	int i;
+
+	if (!uncompressed_file_length)
+		return -1;
+
+	memset(verbose, 0, sizeof(huff_verbose_t));
+	verbose->min_rep_length = ANSI_CHAR_SET_CARDINALITY;
+	verbose->header_ratio = huff_percent(file_stats.header_length,
+		(double)file_stats.compressed_length * BYTE);
+	verbose->huffman_ratio = huff_percent(file_stats.coded_length,
+		uncompressed_file_length_in_bits);
+	verbose->exact_ratio = huff_percent(file_stats.exact_coded_length,
+		uncompressed_file_length_in_bits);
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		if (file_stats.frequency[i])
+			verbose->cardinality++;
+	}
+
+	if (verbose->cardinality == 1)
+		return 0;
+
+	/* computing character representation length mean, varience and
+	 * stdandard deviation.
+	 * the statistics are for the characters in the uncompressed file, as
+	 * accumulated over its blocks in file_stats.length_frequency
+	 *
+	 * computing mean */
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++)
+		verbose->mean += i * (double)file_stats.length_frequency[i];
+	verbose->mean /= (double)uncompressed_file_length;
+
+	/* computing max_rep_length, min_rep_length, varince and breakdown
+	 * table */
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		if (file_stats.length_frequency[i]) {
+			verbose->min_rep_length = MIN(verbose->min_rep_length,
+				i);
+			verbose->max_rep_length = MAX(verbose->max_rep_length,
+				i);
+			verbose->var += file_stats.length_frequency[i] *
+				pow(i - verbose->mean, 2);
+			verbose->breakdown[i] = file_stats.length_frequency[i];
+		}
+	}
+	verbose->var /= (double)uncompressed_file_length;
+
+	/* computing standard deviation */
+	verbose->std_dev = sqrt(verbose->var);
+	return 0;
+}
+
+/* Return the shannon entropy of the character frequencies in bits per
+ * character, the lower bound of any character by character coding.
+ */
+static double huff_entropy(void)
+{
+	double entropy = 0, p;
+	int i;
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		if (!file_stats.frequency[i])
+			continue;
+
+		p = (double)file_stats.frequency[i] / uncompressed_file_length;
+		entropy -= p * log2(p);
+	}
+
+	return entropy;
+}
+
+/* Print the entropy bound of the file measured by huffman_estimate(). */
+static void huff_print_estimate(void)
+{
+	double entropy = huff_entropy();
+
+	printf("(estimated, %s was not created)\n", compressed_file_name);
+	printf("entropy bound: %.2fbits/character (%s)\n", entropy,
+		huff_print_length((u64)(entropy * uncompressed_file_length /
+		BYTE)));
+}
+
 static void huff_print_statistics(void)
 {
 	printf("%s: %s\n", compressed_file_name,
-		huff_print_length(compressed_file_length));
+		huff_print_length(file_stats.compressed_length));
 	printf("%s:     %s\n", uncompressed_file_name,
 		huff_print_length(uncompressed_file_length));
 	if (uncompressed_file_length) {
 		printf("length ratio: %.2f%%\n",
-			(double)compressed_file_length /
+			(double)file_stats.compressed_length /
 			uncompressed_file_length * 100);
 	}
 }
 
+/* Print the wall time and throughput of each stage that was run. */
+static void huff_print_stages(void)
+{
+	huff_stage_stat_t *stat;
+	int i;
+
+	printf("\nstage           time (ms)        MB/s\n");
+	printf("----------     ----------     -------\n");
+	for (i = 0; i < HUFF_STAGE_COUNT; i++) {
+		stat = &huff_stage_stats[i];
+		if (!stat->count)
+			continue;
+
+		printf("%-10s     %10.3f     %7.2f\n", stat->name,
+			(double)stat->elapsed / MEGA,
+			huff_throughput(stat->bytes, stat->elapsed));
+	}
+}
+
+/* Print the heap usage of each stage that was run, the overall heap usage and
+ * the peak resident set size.
+ */
+static void huff_print_memory(void)
+{
+	huff_stage_stat_t *stat;
+	int i;
+
+	printf("\nstage          allocations          bytes      peak (bytes)\n");
+	printf("----------     -----------     ----------     ------------\n");
+	for (i = 0; i < HUFF_STAGE_COUNT; i++) {
+		stat = &huff_stage_stats[i];
+		if (!stat->count || i == HUFF_STAGE_IO)
+			continue;
+
+		printf("%-10s     %11llu     %10llu     %12llu\n", stat->name,
+			stat->alloc.allocations, stat->alloc.bytes,
+			stat->alloc.peak);
+	}
+
+	printf("\nheap: %llu allocations, %llu bytes, peak %s\n",
+		huff_alloc_stats.allocations, huff_alloc_stats.bytes,
+		huff_print_length(huff_alloc_stats.peak));
+	printf("peak resident set size: %s\n",
+		huff_print_length(huff_peak_rss()));
+}
+
 static void huff_print_verbose(void)
 {
-	int header_byte_remainder = header_length % BYTE;
-	u32 breakdown[ANSI_CHAR_SET_CARDINALITY]; /* length frequency */
-	int max_rep_length = 0, min_rep_length = ANSI_CHAR_SET_CARDINALITY, i;
-	double character_weight[ANSI_CHAR_SET_CARDINALITY];
-	double mean = 0, std_dev = 0, var = 0;
-	double uncompressed_file_length_in_bytes =
-		(double)uncompressed_file_length;
+	int header_byte_remainder = file_stats.header_length % BYTE;
+	huff_verbose_t verbose;
+	int i;
 
-	if (!uncompressed_file_length)
+	if (huff_compute_verbose(&verbose))
 		return;
 
 	/* printing header details */
-	printf("huffman header size: %ibytes", (int)(header_length / BYTE));
+	printf("huffman header size: %ibytes",
+		(int)(file_stats.header_length / BYTE));
 	if (header_byte_remainder) {
 		printf(" and %ibit", header_byte_remainder);
 		if (header_byte_remainder != 1)
 			printf("s");
 	}
-	if (compressed_file_length < (GIGA / 4))
-		compressed_file_length *= BYTE;
-	else
-		header_length /= BYTE;
 
 	/* printing persentage of header in compressed file */
-	printf(" (%.2f%% of %s)\n",
-		(double)header_length / (double)compressed_file_length * 100,
+	printf(" (%.2f%% of %s)\n", verbose.header_ratio,
 		compressed_file_name);
+	printf("number of blocks: %llu\n", block_count);
 
 	/* printing huffman compression ratio */
-	if (uncompressed_file_length < (GIGA / 4))
-		uncompressed_file_length *= BYTE;
-	else
-		coded_length /= BYTE;
-	printf("huffman compression ratio: %.2f%%\n",
-		(double)coded_length / (double)uncompressed_file_length * 100);
+	printf("huffman compression ratio: %.2f%%\n", verbose.huffman_ratio);
+	if (huffman_sample || huffman_codebook) {
+		printf("with exact histograms: %.2f%% (loss: %.2f%%)\n",
+			verbose.exact_ratio,
+			verbose.huffman_ratio - verbose.exact_ratio);
+	}
 
 	/* character representation statistics */
 	printf("number of different characters used in %s: %icharacters\n",
-		uncompressed_file_name,	character_set_cardinality);
+		uncompressed_file_name,	verbose.cardinality);
 
-	if (character_set_cardinality == 1) {
+	if (verbose.cardinality == 1) {
 		printf("character representation length: 0bits\n");
 		return;
 	}
 
-	/* computing character representation length mean, varience and
-	 * stdandard deviation.
-	 * the statistics are for the characters in the uncompressed file
-	 *
-	 * computing mean */
-	memset(character_weight, 0, ANSI_CHAR_SET_CARDINALITY);
-	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
-		mean += (character_weight[i] = representation_length[i] * 
-			frequency[i]);
-	}
-	mean /= (double)uncompressed_file_length_in_bytes;
-
-	/* computing max_rep_length, min_rep_length, varince and breakdown
-	 * table */
-	memset(breakdown, 0, ANSI_CHAR_SET_CARDINALITY);
-	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
-		if (frequency[i]) {
-			min_rep_length = MIN(min_rep_length,
-				representation_length[i]);
-			max_rep_length = MAX(max_rep_length,
-				representation_length[i]);
-			var += frequency[i] * pow(representation_length[i] -
-				mean, 2);
-			breakdown[representation_length[i]] += frequency[i];
-		}
-	}
-	var /= (double)uncompressed_file_length_in_bytes;
-
-	/* computing standard deviation */
-	std_dev = sqrt(var);
-
 	/* printing character representation length  table*/
 	printf("\ncharacter representation length (bits)     " \
 		"number of characters \n");
 	printf("--------------------------------------     " \
 		"--------------------\n");
-	for (i = min_rep_length; i <= max_rep_length; i++) {
-		if (breakdown[i])
-			printf("                %-36i%-lu\n", i, breakdown[i]);
+	for (i = verbose.min_rep_length; i <= verbose.max_rep_length; i++) {
+		if (verbose.breakdown[i]) {
+			printf("                %-36i%-llu\n", i,
+				verbose.breakdown[i]);
+		}
 	}
 
 	/* printing: mean, standard deviation and varince */
-	printf("\nmean: %.2fbits/character\n", mean);
-	printf("standard deviation: %.2f\n", std_dev);
-	printf("varience: %.2f\n", var);
+	printf("\nmean: %.2fbits/character\n", verbose.mean);
+	printf("standard deviation: %.2f\n", verbose.std_dev);
+	printf("varience: %.2f\n", verbose.var);
+}
+
+/* Print the statistics (and verbose statistics if is_verbose is set) as a
+ * single JSON object for metrics collectors. With is_test, the object also
+ * carries the result of -t, which is then not printed on a line of its own.
+ */
+static void huff_print_json(int is_verbose, int is_estimate, int is_test)
+{
+	huff_stage_stat_t *stat;
+	huff_verbose_t verbose;
+	int i, first = 1;
+
+	printf("{\"compressed_file\": ");
+	huff_print_json_string(compressed_file_name);
+	printf(", \"compressed_length\": %llu, \"uncompressed_file\": ",
+		file_stats.compressed_length);
+	huff_print_json_string(uncompressed_file_name);
+	printf(", \"uncompressed_length\": %llu", uncompressed_file_length);
+	printf(", \"length_ratio\": %.2f",
+		huff_percent(file_stats.compressed_length,
+		uncompressed_file_length));
+	if (is_estimate) {
+		printf(", \"estimate\": true, \"entropy_bits_per_character\": " \
+			"%.4f, \"entropy_bound_length\": %.0f", huff_entropy(),
+			huff_entropy() * uncompressed_file_length / BYTE);
+	}
+	if (is_test)
+		printf(", \"status\": \"OK\"");
+
+	printf(", \"stages\": {");
+	for (i = 0; i < HUFF_STAGE_COUNT; i++) {
+		stat = &huff_stage_stats[i];
+		if (!stat->count)
+			continue;
+
+		printf("%s\"%s\": {\"seconds\": %.9f, \"bytes\": %llu, " \
+			"\"mb_per_sec\": %.2f", first ? "" : ", ", stat->name,
+			(double)stat->elapsed / GIGA, stat->bytes,
+			huff_throughput(stat->bytes, stat->elapsed));
+		if (is_verbose && i != HUFF_STAGE_IO) {
+			printf(", \"allocations\": %llu, \"allocated_bytes\": " \
+				"%llu, \"peak_heap_bytes\": %llu",
+				stat->alloc.allocations, stat->alloc.bytes,
+				stat->alloc.peak);
+		}
+		printf("}");
+		first = 0;
+	}
+	printf("}");
+
+	if (is_verbose) {
+		printf(", \"memory\": {\"allocations\": %llu, " \
+			"\"allocated_bytes\": %llu, \"peak_heap_bytes\": %llu, " \
+			"\"peak_rss_bytes\": %llu}",
+			huff_alloc_stats.allocations, huff_alloc_stats.bytes,
+			huff_alloc_stats.peak, huff_peak_rss());
+	}
+
+	if (is_verbose && !huff_compute_verbose(&verbose)) {
+		printf(", \"header_length_bits\": %llu",
+			file_stats.header_length);
+		printf(", \"header_ratio\": %.2f", verbose.header_ratio);
+		printf(", \"huffman_ratio\": %.2f", verbose.huffman_ratio);
+		if (huffman_sample || huffman_codebook) {
+			printf(", \"exact_huffman_ratio\": %.2f",
+				verbose.exact_ratio);
+		}
+		printf(", \"blocks\": %llu", block_count);
+		printf(", \"character_set_cardinality\": %i",
+			verbose.cardinality);
+		if (verbose.cardinality != 1) {
+			printf(", \"representation_lengths\": {");
+			first = 1;
+			for (i = verbose.min_rep_length;
+				i <= verbose.max_rep_length; i++) {
+				if (!verbose.breakdown[i])
+					continue;
+				printf("%s\"%i\": %llu", first ? "" : ", ", i,
+					verbose.breakdown[i]);
+				first = 0;
+			}
+			printf("}, \"mean\": %.2f, \"standard_deviation\": " \
+				"%.2f, \"variance\": %.2f", verbose.mean,
+				verbose.std_dev, verbose.var);
+		}
+	}
+
+	printf("}\n");
 }
 
 int main(int argc, char* argv[])
@@ -537,23 +946,72 @@ int main(int argc, char* argv[])
 
 	huffman_print_tree = (action & HUFFMAN_OPT_PRINT_TREE) ? 1 : 0;
 	huffman_keep_file = (action & HUFFMAN_OPT_KEEP_FILE) ? 1 : 0;
+	huffman_sample = (action & HUFFMAN_OPT_FAST) ? 1 : 0;
+	huffman_stats_json = (action & HUFFMAN_OPT_STATISTICS) &&
+		(action & HUFFMAN_OPT_STATS_JSON) ? 1 : 0;
+
+	if (action & HUFFMAN_OPT_ESTIMATE) {
+		if (huffman_estimate())
+			goto Error;
 
-	if ((action & HUFFMAN_OPT_ENCODE) && huffman_encode())
+		action |= HUFFMAN_OPT_STATISTICS;
+	} else if ((action & HUFFMAN_OPT_ENCODE) && huffman_encode()) {
+		goto Error;
+	}
+
+	if ((action & HUFFMAN_OPT_APPEND) && huffman_append())
 		goto Error;
 
 	if ((action & HUFFMAN_OPT_DECODE) && huffman_decode())
 		goto Error;
 
+	if ((action & HUFFMAN_OPT_TEST) && huffman_test())
+		goto Error;
+
+	if ((action & HUFFMAN_OPT_ARCHIVE) &&
+		huffman_archive_create(huff_operands, huff_operand_count)) {
+		goto Error;
+	}
+
+	if ((action & HUFFMAN_OPT_LIST) && huffman_archive_list())
+		goto Error;
+
+	if ((action & HUFFMAN_OPT_EXTRACT) &&
+		huffman_archive_extract(huff_operands, huff_operand_count)) {
+		goto Error;
+	}
+
+	if ((action & HUFFMAN_OPT_GREP) && huffman_grep(huff_grep_pattern,
+		huff_grep_jobs ? huff_grep_jobs :
+		(int)MIN(sysconf(_SC_NPROCESSORS_ONLN), HUFFMAN_GREP_MAX_JOBS))) {
+		goto Error;
+	}
+
+	if ((action & HUFFMAN_OPT_STATISTICS) &&
+		(action & HUFFMAN_OPT_STATS_JSON)) {
+		huff_print_json(action & HUFFMAN_OPT_VERBOSE,
+			action & HUFFMAN_OPT_ESTIMATE, action & HUFFMAN_OPT_TEST);
+		return 0;
+	}
+
 	if (action & HUFFMAN_OPT_STATISTICS)
 		huff_print_statistics();
 
+	if (action & HUFFMAN_OPT_ESTIMATE)
+		huff_print_estimate();
+
 	if (action & HUFFMAN_OPT_VERBOSE)
 		huff_print_verbose();
 
+	if (action & HUFFMAN_OPT_STATISTICS)
+		huff_print_stages();
+
+	if (action & HUFFMAN_OPT_VERBOSE)
+		huff_print_memory();
+
 	return 0;
 
 Error:
 	printf("aborting!\n");
 	return -1;
 }
-
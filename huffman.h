@@ -14,6 +14,26 @@
 #define FILE_LENGTH_REPRESENTATION_U16 's'
 #define MAX_FILE_LENGTH_REPRESENTATION_U32 ULONG_MAX /* 4294967295 */
 #define FILE_LENGTH_REPRESENTATION_U32 'l'
+#define FILE_LENGTH_REPRESENTATION_VARINT 'v'
+
+/* block container: HUFFMAN_CONTAINER is written where the f.l.t of a
+ * single stream file is, followed by blocks and HUFFMAN_BLOCK_END */
+#define HUFFMAN_CONTAINER 'B'
+#define HUFFMAN_BLOCK_HUFFMAN 'h'
+#define HUFFMAN_BLOCK_STORED 's' /* the characters, uncoded */
+#define HUFFMAN_BLOCK_ANS 'a' /* the characters, tANS coded */
+#define HUFFMAN_BLOCK_REF 'r' /* the characters of an earlier block */
+#define HUFFMAN_BLOCK_TOKEN 'w' /* the characters, as words and others */
+#define HUFFMAN_BLOCK_END 'E'
+#define HUFFMAN_ARCHIVE 'A' /* the first and the last u8 of an archive */
+#define HUFFMAN_ARCHIVE_INDEX 'I'
+#define HUFFMAN_INDEX 'I' /* the block index following the trailer */
+#define HUFFMAN_BLOCK_SIZE (1UL << 20) /* 1MiB */
+#define HUFFMAN_CRC_LENGTH 4 /* u8s of a crc32c */
+
+/* fast mode: the code is built from windows sampled across the file */
+#define HUFFMAN_SAMPLE_WINDOW (1UL << 16) /* 64KiB */
+#define HUFFMAN_SAMPLE_WINDOWS 16
 
 #define HUFFMAN_EOF ((unsigned char)EOF)
 #define ASSERT(x) if (x) return -1
@@ -33,13 +53,14 @@
 typedef unsigned char u8;
 typedef unsigned short u16;
 typedef unsigned long u32;
+typedef unsigned long long u64;
 
 typedef struct node {
 	struct node *left_son;
 	struct node *right_son;
 	struct node *next;
 	u8 character;
-	int frequency;
+	u64 frequency;
 } huff_tree_node_t;
 
 typedef enum bit_t {
@@ -50,26 +71,71 @@ typedef enum bit_t {
 
 extern char compressed_file_name[MAX_FILE_NAME_SIZE];
 extern char uncompressed_file_name[MAX_FILE_NAME_SIZE];
-extern u32 frequency[ANSI_CHAR_SET_CARDINALITY];
+extern u64 frequency[ANSI_CHAR_SET_CARDINALITY];
 extern u8 character_set_cardinality;
 extern u8 representation_length[ANSI_CHAR_SET_CARDINALITY];
-extern u32 uncompressed_file_length;
+extern u64 uncompressed_file_length;
 extern int huffman_print_tree;
 extern huff_tree_node_t *tree_root;
 extern bit_t *dictionary[ANSI_CHAR_SET_CARDINALITY];
 
-/* for statistics option */
+/* block container: the encoder writes blocks of at most huffman_block_size
+ * characters and the decoders reject blocks longer than the format's
+ * HUFFMAN_BLOCK_SIZE, whatever huffman_block_size is in the process, so that
+ * a block held in memory is bounded whatever length a corrupt file declares */
+extern u64 huffman_block_size;
+extern u64 block_length;
+extern u32 block_crc;
+extern u64 block_count;
+extern u32 file_crc;
+
+/* fast mode and fixed codebook mode */
+extern int huffman_sample;
+extern char *huffman_codebook;
+extern int huffman_codebook_resident; /* kept across files, see huffmand */
+
+/* chunks repeated within a file or an archive are written once */
+extern int huffman_dedup;
+
+/* a block index follows the trailer, see huffman_index.h */
+extern int huffman_index;
+
+/* blocks may be coded as words and separators, see huffman_token.h */
+extern int huffman_tokens;
+
 extern int huffman_keep_file;
-extern u32 compressed_file_length;
-extern u32 header_length;
-extern u32 coded_length;
+
+/* the statistics are printed as a JSON object, alone on stdout */
+extern int huffman_stats_json;
+
+/* for statistics option: the totals of the file being coded, cleared by
+ * huff_file_reset(). They are added up once a block's part is known, from its
+ * frequencies and code lengths, rather than counted in the coding loops.
+ */
+typedef struct huff_file_stat_t {
+	u64 compressed_length;	/* bits while coding, u8s once done */
+	u64 header_length;	/* bits */
+	u64 coded_length;	/* bits of the blocks' coded data */
+	u64 exact_coded_length;	/* bits with every block's own code, for -f */
+	u64 frequency[ANSI_CHAR_SET_CARDINALITY];
+	u64 length_frequency[ANSI_CHAR_SET_CARDINALITY];
+} huff_file_stat_t;
+
+extern huff_file_stat_t file_stats;
 
 /* tree_node opperations */
-huff_tree_node_t *huff_tree_node_alloc(u8 character, int freq);
+huff_tree_node_t *huff_tree_node_alloc(u8 character, u64 freq);
 void huff_tree_node_free(huff_tree_node_t *node);
 void huff_delete_tree(huff_tree_node_t *node);
 void huff_print_tree();
 
+/* block opperations */
+void huff_file_reset(void);
+void huff_block_reset(void);
+void huff_block_account(void);
+u64 huff_block_coded_length(u64 *freq);
+void huff_block_release(void);
+
 /* bit stack opperations */
 bit_t *bit_stack_alloc(int num);
 bit_t *bit_stack_clone(bit_t *stack, int offset);
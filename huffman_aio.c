@@ -0,0 +1,604 @@
+#define _GNU_SOURCE /* O_DIRECT */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "huffman_aio.h"
+#include "huffman_stats.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define HUFF_AIO_HAVE_URING
+#endif
+#endif
+
+huff_aio_backend_t huffman_aio_backend = HUFF_AIO_AUTO;
+
+typedef enum huff_aio_state_t {
+	HUFF_AIO_IDLE = 0,	/* not submitted, or handed to the caller */
+	HUFF_AIO_PENDING = 1,	/* submitted and not yet completed */
+	HUFF_AIO_DONE = 2,	/* completed, result is valid */
+} huff_aio_state_t;
+
+/* a read or write of one buffer */
+typedef struct huff_aio_req_t {
+	u8 *buf;
+	size_t length;		/* u8s to read or write */
+	u64 offset;		/* file offset */
+	u64 seq;		/* submission order */
+	long result;		/* u8s transferred, or -errno */
+	struct iovec iov;
+	huff_aio_state_t state;
+} huff_aio_req_t;
+
+#ifdef HUFF_AIO_HAVE_URING
+/* the submission and completion rings shared with the kernel */
+typedef struct huff_uring_t {
+	int fd;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+} huff_uring_t;
+#endif
+
+struct huff_aio_t {
+	int fd;
+	int is_write;
+	int is_direct;		/* the file is open with O_DIRECT */
+	huff_aio_backend_t backend;
+	size_t buf_size;
+	huff_aio_req_t reqs[HUFF_AIO_DEPTH];
+	int head;		/* request handed out, or to be handed out next */
+	int is_primed;		/* reader: the read ahead has been submitted */
+	int is_eof;		/* reader: the end of the file was reached */
+	size_t skip;		/* reader: u8s of the next buffer preceding the
+				 * offset sought */
+	u64 offset;		/* file offset of the next request submitted */
+	u64 seq;		/* sequence number of the next request submitted */
+	void *mem;		/* the buffers, before alignment */
+#ifdef HUFF_AIO_HAVE_URING
+	huff_uring_t ring;
+#endif
+	/* HUFF_AIO_THREAD: a worker serves the requests in submission order */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	u64 served_seq;		/* sequence number the worker serves next */
+	int is_stop;
+};
+
+#ifdef HUFF_AIO_HAVE_URING
+static void huff_uring_teardown(huff_uring_t *ring)
+{
+	if (ring->sqes && ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring && ring->cq_ring != MAP_FAILED)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring && ring->sq_ring != MAP_FAILED)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+}
+
+static void *huff_uring_map(huff_uring_t *ring, size_t size, off_t offset)
+{
+	return mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, offset);
+}
+
+/* Create an io_uring of HUFF_AIO_DEPTH entries and map its rings.
+ * Return 0 if successful, otherwise -1 (e.g. kernels without io_uring, or
+ * where it is disabled).
+ */
+static int huff_uring_setup(huff_aio_t *aio)
+{
+	huff_uring_t *ring = &aio->ring;
+	struct io_uring_params params;
+	u8 *sq, *cq;
+
+	memset(&params, 0, sizeof(params));
+	if ((ring->fd = syscall(__NR_io_uring_setup, HUFF_AIO_DEPTH,
+		&params)) < 0) {
+		return -1;
+	}
+
+	ring->sq_ring_size = params.sq_off.array +
+		params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_ring = huff_uring_map(ring, ring->sq_ring_size,
+		IORING_OFF_SQ_RING);
+	ring->cq_ring = huff_uring_map(ring, ring->cq_ring_size,
+		IORING_OFF_CQ_RING);
+	ring->sqes = huff_uring_map(ring, ring->sqes_size, IORING_OFF_SQES);
+	if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED ||
+		ring->sqes == MAP_FAILED) {
+		huff_uring_teardown(ring);
+		return -1;
+	}
+
+	sq = ring->sq_ring;
+	ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+
+	cq = ring->cq_ring;
+	ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	return 0;
+}
+
+static int huff_uring_enter(huff_uring_t *ring, unsigned to_submit,
+	unsigned min_complete, unsigned flags)
+{
+	long ret;
+
+	do {
+		ret = syscall(__NR_io_uring_enter, ring->fd, to_submit,
+			min_complete, flags, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret < 0 ? -1 : 0;
+}
+
+static int huff_uring_submit(huff_aio_t *aio, huff_aio_req_t *req)
+{
+	huff_uring_t *ring = &aio->ring;
+	unsigned tail = *ring->sq_tail;
+	unsigned index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = aio->is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+	sqe->fd = aio->fd;
+	sqe->addr = (unsigned long)&req->iov;
+	sqe->len = 1;
+	sqe->off = req->offset;
+	sqe->user_data = req - aio->reqs;
+	ring->sq_array[index] = index;
+
+	req->state = HUFF_AIO_PENDING;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	if (huff_uring_enter(ring, 1, 0, 0)) {
+		req->state = HUFF_AIO_IDLE;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Mark the requests whose completions are in the completion ring as done. */
+static void huff_uring_reap(huff_aio_t *aio)
+{
+	huff_uring_t *ring = &aio->ring;
+	unsigned head = *ring->cq_head;
+	struct io_uring_cqe *cqe;
+	huff_aio_req_t *req;
+
+	while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &ring->cqes[head & *ring->cq_mask];
+		req = &aio->reqs[cqe->user_data];
+		req->result = cqe->res;
+		req->state = HUFF_AIO_DONE;
+		head++;
+	}
+
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static int huff_uring_wait(huff_aio_t *aio, huff_aio_req_t *req)
+{
+	for (huff_uring_reap(aio); req->state != HUFF_AIO_DONE;
+		huff_uring_reap(aio)) {
+		if (huff_uring_enter(&aio->ring, 0, 1,
+			IORING_ENTER_GETEVENTS)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+#endif
+
+/* Return the pending request with sequence number seq, or NULL. */
+static huff_aio_req_t *huff_aio_find(huff_aio_t *aio, u64 seq)
+{
+	int i;
+
+	for (i = 0; i < HUFF_AIO_DEPTH; i++) {
+		if (aio->reqs[i].state == HUFF_AIO_PENDING &&
+			aio->reqs[i].seq == seq) {
+			return &aio->reqs[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void *huff_aio_worker(void *arg)
+{
+	huff_aio_t *aio = (huff_aio_t*)arg;
+	huff_aio_req_t *req = NULL;
+	long ret;
+
+	pthread_mutex_lock(&aio->lock);
+	for (;;) {
+		while (!aio->is_stop &&
+			!(req = huff_aio_find(aio, aio->served_seq))) {
+			pthread_cond_wait(&aio->cond, &aio->lock);
+		}
+
+		if (aio->is_stop)
+			break;
+		pthread_mutex_unlock(&aio->lock);
+
+		ret = aio->is_write ?
+			pwrite(aio->fd, req->buf, req->length, req->offset) :
+			pread(aio->fd, req->buf, req->length, req->offset);
+
+		pthread_mutex_lock(&aio->lock);
+		req->result = ret < 0 ? -errno : ret;
+		req->state = HUFF_AIO_DONE;
+		aio->served_seq++;
+		pthread_cond_broadcast(&aio->cond);
+	}
+	pthread_mutex_unlock(&aio->lock);
+
+	return NULL;
+}
+
+static int huff_thread_setup(huff_aio_t *aio)
+{
+	if (pthread_mutex_init(&aio->lock, NULL))
+		return -1;
+
+	if (pthread_cond_init(&aio->cond, NULL)) {
+		pthread_mutex_destroy(&aio->lock);
+		return -1;
+	}
+
+	if (pthread_create(&aio->thread, NULL, huff_aio_worker, aio)) {
+		pthread_cond_destroy(&aio->cond);
+		pthread_mutex_destroy(&aio->lock);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void huff_thread_teardown(huff_aio_t *aio)
+{
+	pthread_mutex_lock(&aio->lock);
+	aio->is_stop = 1;
+	pthread_cond_broadcast(&aio->cond);
+	pthread_mutex_unlock(&aio->lock);
+
+	pthread_join(aio->thread, NULL);
+	pthread_cond_destroy(&aio->cond);
+	pthread_mutex_destroy(&aio->lock);
+}
+
+static int huff_thread_submit(huff_aio_t *aio, huff_aio_req_t *req)
+{
+	pthread_mutex_lock(&aio->lock);
+	req->state = HUFF_AIO_PENDING;
+	pthread_cond_broadcast(&aio->cond);
+	pthread_mutex_unlock(&aio->lock);
+
+	return 0;
+}
+
+static int huff_thread_wait(huff_aio_t *aio, huff_aio_req_t *req)
+{
+	pthread_mutex_lock(&aio->lock);
+	while (req->state != HUFF_AIO_DONE)
+		pthread_cond_wait(&aio->cond, &aio->lock);
+	pthread_mutex_unlock(&aio->lock);
+
+	return 0;
+}
+
+/* Submit req for reading or writing its length u8s at its offset.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_aio_submit(huff_aio_t *aio, huff_aio_req_t *req)
+{
+	req->seq = aio->seq++;
+	req->result = 0;
+	req->iov.iov_base = req->buf;
+	req->iov.iov_len = req->length;
+
+#ifdef HUFF_AIO_HAVE_URING
+	if (aio->backend == HUFF_AIO_URING)
+		return huff_uring_submit(aio, req);
+#endif
+
+	return huff_thread_submit(aio, req);
+}
+
+/* Wait for req to complete, if it was submitted, and complete a short read or
+ * write synchronously. A read that still falls short reached the end of the
+ * file.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_aio_wait(huff_aio_t *aio, huff_aio_req_t *req)
+{
+	long ret;
+
+	if (req->state == HUFF_AIO_IDLE)
+		return 0;
+
+#ifdef HUFF_AIO_HAVE_URING
+	if (aio->backend == HUFF_AIO_URING) {
+		if (huff_uring_wait(aio, req))
+			return -1;
+	} else
+#endif
+	if (huff_thread_wait(aio, req))
+		return -1;
+
+	while (req->result >= 0 && (size_t)req->result < req->length) {
+		ret = aio->is_write ?
+			pwrite(aio->fd, req->buf + req->result,
+				req->length - req->result,
+				req->offset + req->result) :
+			pread(aio->fd, req->buf + req->result,
+				req->length - req->result,
+				req->offset + req->result);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		req->result += ret;
+	}
+
+	if (req->result < 0)
+		return -1;
+
+	if ((size_t)req->result < req->length) {
+		if (aio->is_write)
+			return -1;
+		aio->is_eof = 1;
+	}
+
+	return 0;
+}
+
+/* Wait for all submitted requests. Their results are dropped.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_aio_drain(huff_aio_t *aio)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < HUFF_AIO_DEPTH; i++) {
+		if (huff_aio_wait(aio, &aio->reqs[i]))
+			ret = -1;
+		aio->reqs[i].state = HUFF_AIO_IDLE;
+	}
+
+	return ret;
+}
+
+/* Submit a read of the next buf_size u8s of the file into req, unless the end
+ * of the file was reached.
+ */
+static int huff_aio_read_ahead(huff_aio_t *aio, huff_aio_req_t *req)
+{
+	if (aio->is_eof)
+		return 0;
+
+	req->length = aio->buf_size;
+	req->offset = aio->offset;
+	aio->offset += aio->buf_size;
+
+	return huff_aio_submit(aio, req);
+}
+
+/* Create a huff_aio_t for reading (or writing, if is_write is set) the
+ * regular file open at fd, starting at its current offset, with up to
+ * HUFF_AIO_DEPTH buffers of buf_size u8s in flight. The buffers are aligned
+ * to HUFF_AIO_ALIGN, so that fd may be open with O_DIRECT if buf_size and the
+ * offset are multiples of HUFF_AIO_ALIGN as well.
+ * Return the new huff_aio_t if successful. NULL is returned if asynchronous
+ * io is disabled, if fd is not a regular file or if no backend could be set
+ * up, in which case the caller uses stdio.
+ */
+huff_aio_t *huff_aio_open(int fd, int is_write, size_t buf_size)
+{
+	huff_aio_t *aio = NULL;
+	struct stat st;
+	off_t offset;
+	int i, flags;
+	u8 *buf;
+
+	if (huffman_aio_backend == HUFF_AIO_STDIO || fd < 0 ||
+		fstat(fd, &st) || !S_ISREG(st.st_mode) ||
+		(offset = lseek(fd, 0, SEEK_CUR)) < 0 ||
+		(flags = fcntl(fd, F_GETFL)) < 0) {
+		return NULL;
+	}
+
+	if (!(aio = huff_calloc(1, sizeof(huff_aio_t))))
+		return NULL;
+
+	if (!(aio->mem = huff_calloc(1, HUFF_AIO_DEPTH * buf_size +
+		HUFF_AIO_ALIGN))) {
+		huff_free(aio);
+		return NULL;
+	}
+
+	buf = (u8*)(((unsigned long)aio->mem + HUFF_AIO_ALIGN - 1) &
+		~(unsigned long)(HUFF_AIO_ALIGN - 1));
+	for (i = 0; i < HUFF_AIO_DEPTH; i++)
+		aio->reqs[i].buf = buf + i * buf_size;
+
+	aio->fd = fd;
+	aio->is_write = is_write;
+	aio->is_direct = (flags & O_DIRECT) ? 1 : 0;
+	aio->buf_size = buf_size;
+	aio->offset = offset;
+
+#ifdef HUFF_AIO_HAVE_URING
+	if (huffman_aio_backend != HUFF_AIO_THREAD && !huff_uring_setup(aio)) {
+		aio->backend = HUFF_AIO_URING;
+		return aio;
+	}
+#endif
+
+	if (!huff_thread_setup(aio)) {
+		aio->backend = HUFF_AIO_THREAD;
+		return aio;
+	}
+
+	huff_free(aio->mem);
+	huff_free(aio);
+	return NULL;
+}
+
+/* Wait for all requests in flight and delete aio. The file is not closed.
+ * Return 0 if all writes completed successfully, otherwise -1.
+ */
+int huff_aio_close(huff_aio_t *aio)
+{
+	int ret = huff_aio_drain(aio);
+
+#ifdef HUFF_AIO_HAVE_URING
+	if (aio->backend == HUFF_AIO_URING)
+		huff_uring_teardown(&aio->ring);
+	else
+#endif
+	huff_thread_teardown(aio);
+
+	huff_free(aio->mem);
+	huff_free(aio);
+	return ret;
+}
+
+/* Return the name of the backend used by aio. */
+const char *huff_aio_name(huff_aio_t *aio)
+{
+	return aio->backend == HUFF_AIO_URING ? "io_uring" : "thread";
+}
+
+/* Hand the next buffer of the file to the caller. The buffer handed out by
+ * the previous call is reused for reading ahead, so it must no longer be
+ * accessed.
+ * Return 0 if successful, with *len == 0 at the end of the file. Otherwise
+ * return -1.
+ */
+int huff_aio_read(huff_aio_t *aio, u8 **buf, size_t *len)
+{
+	huff_aio_req_t *req;
+	int i;
+
+	if (!aio->is_primed) {
+		for (i = 0; i < HUFF_AIO_DEPTH; i++) {
+			if (huff_aio_read_ahead(aio, &aio->reqs[(aio->head + i) %
+				HUFF_AIO_DEPTH])) {
+				return -1;
+			}
+		}
+		aio->is_primed = 1;
+	} else {
+		if (huff_aio_read_ahead(aio, &aio->reqs[aio->head]))
+			return -1;
+		aio->head = (aio->head + 1) % HUFF_AIO_DEPTH;
+	}
+
+	req = &aio->reqs[aio->head];
+	if (huff_aio_wait(aio, req))
+		return -1;
+
+	*buf = req->buf + aio->skip;
+	*len = req->state == HUFF_AIO_DONE && req->result > aio->skip ?
+		req->result - aio->skip : 0;
+	req->state = HUFF_AIO_IDLE;
+	aio->skip = 0;
+	return 0;
+}
+
+/* Restart reading at offset. The read ahead in flight is dropped. Reading
+ * restarts at offset rounded down to HUFF_AIO_ALIGN and the u8s preceding
+ * offset are skipped.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_aio_seek(huff_aio_t *aio, u64 offset)
+{
+	int ret = huff_aio_drain(aio);
+
+	aio->is_primed = 0;
+	aio->is_eof = 0;
+	aio->offset = offset & ~(u64)(HUFF_AIO_ALIGN - 1);
+	aio->skip = offset - aio->offset;
+	return ret;
+}
+
+/* Return the buffer of buf_size u8s to be filled and passed to
+ * huff_aio_write(), once the write it was last used for has completed.
+ * Return NULL if that write failed.
+ */
+u8 *huff_aio_buffer(huff_aio_t *aio)
+{
+	huff_aio_req_t *req = &aio->reqs[aio->head];
+
+	if (huff_aio_wait(aio, req))
+		return NULL;
+
+	req->state = HUFF_AIO_IDLE;
+	return req->buf;
+}
+
+/* Submit a write of the first len u8s of the buffer returned by
+ * huff_aio_buffer(), following the u8s written so far.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_aio_write(huff_aio_t *aio, size_t len)
+{
+	huff_aio_req_t *req = &aio->reqs[aio->head];
+	int flags;
+
+	/* O_DIRECT needs aligned lengths: the tail of the file, written last,
+	 * is written through the page cache once the other writes are done */
+	if (aio->is_direct && len % HUFF_AIO_ALIGN) {
+		if (huff_aio_drain(aio) ||
+			(flags = fcntl(aio->fd, F_GETFL)) < 0 ||
+			fcntl(aio->fd, F_SETFL, flags & ~O_DIRECT) < 0) {
+			return -1;
+		}
+		aio->is_direct = 0;
+	}
+
+	req->length = len;
+	req->offset = aio->offset;
+	aio->offset += len;
+	if (huff_aio_submit(aio, req))
+		return -1;
+
+	aio->head = (aio->head + 1) % HUFF_AIO_DEPTH;
+	return 0;
+}
+
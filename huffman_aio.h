@@ -0,0 +1,38 @@
+#ifndef _HUFFMAN_AIO_H_
+#define _HUFFMAN_AIO_H_
+
+#include <stddef.h>
+#include "huffman.h"
+
+#define HUFF_AIO_DEPTH 4 /* buffers in flight */
+#define HUFF_AIO_ALIGN 4096 /* buffer, size and offset alignment for O_DIRECT */
+
+/* Asynchronous io backends. HUFF_AIO_AUTO uses io_uring where the kernel
+ * provides it and a worker thread otherwise. HUFF_AIO_STDIO disables
+ * asynchronous io, the reader and writer then use fread()/fwrite().
+ */
+typedef enum huff_aio_backend_t {
+	HUFF_AIO_AUTO = 0,
+	HUFF_AIO_URING = 1,
+	HUFF_AIO_THREAD = 2,
+	HUFF_AIO_STDIO = 3,
+} huff_aio_backend_t;
+
+typedef struct huff_aio_t huff_aio_t;
+
+extern huff_aio_backend_t huffman_aio_backend;
+
+huff_aio_t *huff_aio_open(int fd, int is_write, size_t buf_size);
+int huff_aio_close(huff_aio_t *aio);
+const char *huff_aio_name(huff_aio_t *aio);
+
+/* reading */
+int huff_aio_read(huff_aio_t *aio, u8 **buf, size_t *len);
+int huff_aio_seek(huff_aio_t *aio, u64 offset);
+
+/* writing */
+u8 *huff_aio_buffer(huff_aio_t *aio);
+int huff_aio_write(huff_aio_t *aio, size_t len);
+
+#endif
+
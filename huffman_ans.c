@@ -0,0 +1,403 @@
+#include <math.h>
+#include <string.h>
+#include "huffman_ans.h"
+#include "huffman_stats.h"
+
+#define HUFF_ANS_NB_SHIFT 16
+
+/* A transition of the decoder: the character of the state, the number of
+ * bits to read and the state they are added to.
+ */
+typedef struct huff_ans_entry_t {
+	u8 character;
+	u8 nb;
+	u16 base;
+} huff_ans_entry_t;
+
+/* the block's frequencies normalized to HUFF_ANS_TABLE_SIZE */
+static u16 norm[ANSI_CHAR_SET_CARDINALITY];
+/* the character of every state */
+static u8 spread[HUFF_ANS_TABLE_SIZE];
+
+/* Return the index of the most significant bit set in val, val > 0. */
+static int huff_ans_highbit(u32 val)
+{
+	int bit = 0;
+
+	while (val >>= 1)
+		bit++;
+
+	return bit;
+}
+
+/* Scale frequency[] to norm[], so that the counts of the characters of the
+ * block add up to HUFF_ANS_TABLE_SIZE and none of them is 0. The rounding
+ * difference is given to, or taken from, the most frequent characters.
+ */
+static void huff_ans_normalize(void)
+{
+	int i, max;
+	long diff = HUFF_ANS_TABLE_SIZE;
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		norm[i] = 0;
+		if (!frequency[i])
+			continue;
+
+		norm[i] = (u16)(frequency[i] * HUFF_ANS_TABLE_SIZE /
+			block_length);
+		if (!norm[i])
+			norm[i] = 1;
+		diff -= norm[i];
+	}
+
+	while (diff) {
+		for (max = 0, i = 1; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+			if (norm[i] > norm[max])
+				max = i;
+		}
+
+		if (diff > 0) {
+			norm[max] += diff;
+			diff = 0;
+		} else {
+			norm[max]--;
+			diff++;
+		}
+	}
+}
+
+/* Spread the characters over the states, each character norm[c] times,
+ * stepping through the table so that the states of a character are far
+ * apart.
+ */
+static void huff_ans_spread(void)
+{
+	int step = (HUFF_ANS_TABLE_SIZE >> 1) + (HUFF_ANS_TABLE_SIZE >> 3) + 3;
+	int pos = 0, i, j;
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		for (j = 0; j < norm[i]; j++) {
+			spread[pos] = (u8)i;
+			pos = (pos + step) & (HUFF_ANS_TABLE_SIZE - 1);
+		}
+	}
+}
+
+/* Return the number of bits of the ans block header: the block type, the
+ * block length, the table log, the character set cardinality and the
+ * character and normalized count of every character.
+ */
+static u64 huff_ans_header_length(void)
+{
+	u64 bits = (2 + huff_varint_length(block_length) +
+		huff_varint_length(character_set_cardinality)) * BYTE;
+	int i;
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		if (norm[i]) {
+			bits += (huff_varint_length(i) +
+				huff_varint_length(norm[i])) * BYTE;
+		}
+	}
+
+	return bits;
+}
+
+/* Return the number of bits of the coded data of the block: the final state
+ * and the bits of -log2(norm[c] / HUFF_ANS_TABLE_SIZE) per character c.
+ */
+static u64 huff_ans_data_length(void)
+{
+	double bits = HUFF_ANS_TABLE_LOG;
+	int i;
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		if (norm[i]) {
+			bits += frequency[i] * (HUFF_ANS_TABLE_LOG -
+				log2(norm[i]));
+		}
+	}
+
+	return (u64)ceil(bits);
+}
+
+/* Return the number of bits the block would take as an ans block, padded to
+ * a u8 boundary, as computed from its frequencies. Blocks of a single
+ * character are not coded with ans.
+ */
+u64 huff_ans_length(void)
+{
+	u64 bits;
+
+	if (character_set_cardinality < 2)
+		return ~0ULL;
+
+	huff_ans_normalize();
+	bits = huff_ans_header_length() + huff_ans_data_length();
+
+	return bits + (BYTE - bits % BYTE) % BYTE;
+}
+
+static int huff_ans_write_header(huff_writer_t *writer)
+{
+	int i;
+
+	/* statistics */
+	file_stats.compressed_length += huff_ans_header_length();
+
+	if (huff_write_u8(writer, HUFFMAN_BLOCK_ANS) ||
+		huff_write_varint(writer, block_length) ||
+		huff_write_u8(writer, HUFF_ANS_TABLE_LOG) ||
+		huff_write_varint(writer, character_set_cardinality)) {
+		return -1;
+	}
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		if (norm[i] && (huff_write_varint(writer, i) ||
+			huff_write_varint(writer, norm[i]))) {
+			return -1;
+		}
+		representation_length[i] = norm[i] ?
+			HUFF_ANS_TABLE_LOG - huff_ans_highbit(norm[i]) : 0;
+	}
+
+	return 0;
+}
+
+/* Code the block_length characters at the reader's position. The characters
+ * are coded from the last to the first, so that the decoder decodes them from
+ * the first to the last, and the bits of every character are written in the
+ * order the decoder reads them: the final state, then the bits read after
+ * decoding each character.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_ans_write_data(huff_reader_t *reader, huff_writer_t *writer)
+{
+	u16 table[HUFF_ANS_TABLE_SIZE], *value = NULL;
+	u32 delta_nb[ANSI_CHAR_SET_CARDINALITY];
+	int delta_state[ANSI_CHAR_SET_CARDINALITY];
+	int cumul[ANSI_CHAR_SET_CARDINALITY];
+	u8 *chars = NULL, *nb = NULL;
+	u64 i, acc = 0, bits = HUFF_ANS_TABLE_LOG;
+	u32 state = HUFF_ANS_TABLE_SIZE;
+	int c, max_nb, cnt = 0, ret = -1;
+
+	if (!(chars = huff_calloc(block_length, sizeof(u8))) ||
+		!(nb = huff_calloc(block_length, sizeof(u8))) ||
+		!(value = huff_calloc(block_length, sizeof(u16)))) {
+		goto Exit;
+	}
+
+	for (i = 0; i < block_length; i++) {
+		if (huff_read_u8(reader, chars + i))
+			goto Exit;
+	}
+
+	/* the states of every character, in increasing order, and the
+	 * constants for computing the bits it writes from a state */
+	for (i = 0, c = 0; c < ANSI_CHAR_SET_CARDINALITY; c++) {
+		cumul[c] = (int)i;
+		i += norm[c];
+		if (!norm[c])
+			continue;
+
+		max_nb = HUFF_ANS_TABLE_LOG - (norm[c] == 1 ? 0 :
+			huff_ans_highbit(norm[c] - 1));
+		delta_nb[c] = ((u32)max_nb << HUFF_ANS_NB_SHIFT) -
+			((u32)norm[c] << max_nb);
+		delta_state[c] = cumul[c] - norm[c];
+	}
+	for (i = 0; i < HUFF_ANS_TABLE_SIZE; i++)
+		table[cumul[spread[i]]++] = (u16)(HUFF_ANS_TABLE_SIZE + i);
+	for (c = 0; c < ANSI_CHAR_SET_CARDINALITY; c++)
+		cumul[c] -= norm[c];
+
+	for (i = block_length; i-- > 0;) {
+		c = chars[i];
+		nb[i] = (u8)((state + delta_nb[c]) >> HUFF_ANS_NB_SHIFT);
+		value[i] = (u16)(state & ((1U << nb[i]) - 1));
+		state = table[(state >> nb[i]) + delta_state[c]];
+		bits += nb[i];
+	}
+
+	/* the final state first, then the bits of every character */
+	acc = state - HUFF_ANS_TABLE_SIZE;
+	cnt = HUFF_ANS_TABLE_LOG;
+	for (i = 0; i <= block_length; i++) {
+		for (; cnt >= BYTE; cnt -= BYTE) {
+			if (huff_write_u8(writer, (u8)(acc >> (cnt - BYTE))))
+				goto Exit;
+		}
+
+		if (i < block_length) {
+			acc = (acc << nb[i]) | value[i];
+			cnt += nb[i];
+		}
+	}
+	while (cnt) {
+		if (huff_write_bit(writer, (acc >> --cnt) & 1 ? ONE : ZERO))
+			goto Exit;
+	}
+
+	/* statistics */
+	file_stats.compressed_length += bits;
+	file_stats.coded_length += bits;
+	ret = 0;
+
+Exit:
+	huff_free(value);
+	huff_free(nb);
+	huff_free(chars);
+	return ret;
+}
+
+/* Write the block of block_length characters at the reader's position as an
+ * ans block, coded with the normalized counts computed by huff_ans_length().
+ * If is_estimate is set, the data is not written and its length is computed
+ * from the frequencies instead.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_ans_encode(huff_reader_t *reader, huff_writer_t *writer,
+	int is_estimate)
+{
+	u64 header_start = file_stats.compressed_length, data_length;
+
+	huff_ans_spread();
+
+	huff_stage_begin(HUFF_STAGE_HEADER);
+	ASSERT(huff_ans_write_header(writer));
+	huff_stage_end(HUFF_STAGE_HEADER,
+		(file_stats.compressed_length - header_start) / BYTE);
+
+	if (is_estimate) {
+		data_length = huff_ans_data_length();
+		file_stats.compressed_length += data_length;
+		file_stats.coded_length += data_length;
+		return 0;
+	}
+
+	huff_stage_begin(HUFF_STAGE_DATA);
+	ASSERT(huff_ans_write_data(reader, writer));
+	huff_stage_end(HUFF_STAGE_DATA, block_length);
+
+	return 0;
+}
+
+/* Read the header of an ans block, following its block type, into
+ * block_length, character_set_cardinality and norm[].
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_ans_read_header(huff_reader_t *reader)
+{
+	u64 cardinality, ch, count, sum = 0;
+	u8 table_log;
+	int i;
+
+	if (huff_read_varint(reader, &block_length) || !block_length ||
+		block_length > HUFFMAN_BLOCK_SIZE ||
+		huff_read_u8(reader, &table_log) ||
+		table_log != HUFF_ANS_TABLE_LOG ||
+		huff_read_varint(reader, &cardinality) || !cardinality ||
+		cardinality > ANSI_CHAR_SET_CARDINALITY) {
+		return -1;
+	}
+	character_set_cardinality = (u8)cardinality;
+
+	memset(norm, 0, sizeof(norm));
+	for (i = 0; i < cardinality; i++) {
+		if (huff_read_varint(reader, &ch) ||
+			ch >= ANSI_CHAR_SET_CARDINALITY || norm[ch] ||
+			huff_read_varint(reader, &count) || !count ||
+			(sum += count) > HUFF_ANS_TABLE_SIZE) {
+			return -1;
+		}
+		norm[ch] = (u16)count;
+		representation_length[ch] =
+			HUFF_ANS_TABLE_LOG - huff_ans_highbit(count);
+	}
+
+	/* statistics */
+	file_stats.compressed_length += huff_ans_header_length() - BYTE;
+
+	return sum == HUFF_ANS_TABLE_SIZE ? 0 : -1;
+}
+
+/* Create the decoder's transition of every state. */
+static void huff_ans_build_table(huff_ans_entry_t *table)
+{
+	u32 next[ANSI_CHAR_SET_CARDINALITY], x;
+	int i;
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++)
+		next[i] = norm[i];
+
+	for (i = 0; i < HUFF_ANS_TABLE_SIZE; i++) {
+		table[i].character = spread[i];
+		x = next[spread[i]]++;
+		table[i].nb = (u8)(HUFF_ANS_TABLE_LOG - huff_ans_highbit(x));
+		table[i].base = (u16)((x << table[i].nb) - HUFF_ANS_TABLE_SIZE);
+	}
+}
+
+/* Decode the ans block at the reader's position, following its block type,
+ * keeping the crc of its characters in block_crc.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_ans_decode(huff_reader_t *reader, huff_writer_t *writer)
+{
+	huff_ans_entry_t table[HUFF_ANS_TABLE_SIZE], *entry;
+	huff_sink_t sink;
+	u64 i, acc = 0, data_start, bits;
+	int cnt = 0, nb = HUFF_ANS_TABLE_LOG;
+	u32 state = 0;
+	u8 ch;
+
+	huff_block_reset();
+
+	huff_stage_begin(HUFF_STAGE_HEADER);
+	ASSERT(huff_ans_read_header(reader));
+	huff_stage_end(HUFF_STAGE_HEADER, huff_ans_header_length() / BYTE);
+
+	huff_stage_begin(HUFF_STAGE_TREE);
+	huff_ans_spread();
+	huff_ans_build_table(table);
+	huff_stage_end(HUFF_STAGE_TREE, block_length);
+
+	huff_stage_begin(HUFF_STAGE_DATA);
+	huff_writer_crc_begin(writer);
+	huff_writer_count(writer, frequency);
+	ASSERT(huff_sink_begin(&sink, writer));
+	data_start = huff_reader_tell(reader);
+	for (i = 0; i <= block_length; i++) {
+		/* read nb bits, the initial state or those of the previous
+		 * character, and add them to the state */
+		for (; cnt < nb; cnt += BYTE) {
+			if (huff_read_u8(reader, &ch))
+				return -1;
+			acc = (acc << BYTE) | ch;
+		}
+		cnt -= nb;
+		state += (u32)(acc >> cnt) & ((1U << nb) - 1);
+
+		if (i == block_length)
+			break;
+
+		entry = table + state;
+		if (HUFF_SINK_PUT(&sink, entry->character))
+			return -1;
+
+		nb = entry->nb;
+		state = entry->base;
+	}
+	ASSERT(huff_sink_end(&sink));
+	block_crc = huff_writer_crc_end(writer);
+	huff_stage_end(HUFF_STAGE_DATA, block_length);
+
+	/* statistics: the bits of the u8s read but the cnt left over */
+	bits = (huff_reader_tell(reader) - data_start) * BYTE - cnt;
+	file_stats.compressed_length += bits;
+	file_stats.coded_length += bits;
+
+	return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef _HUFFMAN_ANS_H_
+#define _HUFFMAN_ANS_H_
+
+#include "huffman.h"
+#include "huffman_io.h"
+
+/* Table based asymmetric numeral systems (tANS), an alternative to the
+ * huffman code of a block for skewed distributions, where a character can
+ * take less than a bit. The block's frequencies are normalized to
+ * HUFF_ANS_TABLE_SIZE states. An ans block is written where it is expected to
+ * be at least HUFF_ANS_GAIN_PERCENT shorter than the huffman block.
+ */
+#define HUFF_ANS_TABLE_LOG 12
+#define HUFF_ANS_TABLE_SIZE (1 << HUFF_ANS_TABLE_LOG)
+#define HUFF_ANS_GAIN_PERCENT 1
+
+u64 huff_ans_length(void);
+int huff_ans_encode(huff_reader_t *reader, huff_writer_t *writer,
+	int is_estimate);
+int huff_ans_decode(huff_reader_t *reader, huff_writer_t *writer);
+
+#endif
+
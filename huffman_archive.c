@@ -0,0 +1,532 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "huffman.h"
+#include "huffman_io.h"
+#include "huffman_codec.h"
+#include "huffman_stats.h"
+#include "huffman_archive.h"
+#include "huffman_dedup.h"
+
+#define HUFFMAN_ARCHIVE_MEMBERS 64 /* initial size of the index */
+#define HUFFMAN_ARCHIVE_DIR_MODE 0755
+
+/* A member of the archive, as recorded in the index. */
+typedef struct huff_member_t {
+	char *name;		/* the path archived, while creating */
+	u64 offset;		/* of the member's container */
+	u64 length;		/* of the member's container */
+	u64 file_length;	/* of the uncompressed member */
+	u32 crc;		/* of the uncompressed member */
+} huff_member_t;
+
+static huff_member_t *members;
+static u64 member_count;
+static u64 member_size;
+static u64 archive_file_length;	/* of the uncompressed members */
+static struct stat archive_stat;
+
+/* Append a member named name to the index, growing it as needed.
+ * Return the new member if successful, otherwise NULL.
+ */
+static huff_member_t *huff_archive_new_member(char *name)
+{
+	huff_member_t *grown, *member;
+	u64 size;
+
+	if (member_count == member_size) {
+		size = member_size ? 2 * member_size : HUFFMAN_ARCHIVE_MEMBERS;
+		if (!(grown = huff_calloc(size, sizeof(huff_member_t))))
+			return NULL;
+
+		if (members) {
+			memcpy(grown, members,
+				member_count * sizeof(huff_member_t));
+			huff_free(members);
+		}
+		members = grown;
+		member_size = size;
+	}
+
+	member = members + member_count;
+	if (!(member->name = huff_calloc(strlen(name) + 1, sizeof(char))))
+		return NULL;
+	strcpy(member->name, name);
+	member_count++;
+
+	return member;
+}
+
+static void huff_archive_free(void)
+{
+	u64 i;
+
+	for (i = 0; i < member_count; i++)
+		huff_free(members[i].name);
+	huff_free(members);
+
+	members = NULL;
+	member_count = 0;
+	member_size = 0;
+}
+
+/* Return the name path is archived under, path without its leading '/'s and
+ * "./"s.
+ */
+static char *huff_archive_name(char *path)
+{
+	for (;;) {
+		if (*path == '/')
+			path++;
+		else if (path[0] == '.' && path[1] == '/')
+			path += 2;
+		else
+			return path;
+	}
+}
+
+/* Return 1 if name is extracted below the current directory: it is not empty,
+ * not absolute and has no ".." component. Otherwise return 0.
+ */
+static int huff_archive_valid_name(char *name)
+{
+	char *component = name;
+
+	if (!*name || *name == '/')
+		return 0;
+
+	while (component) {
+		if (component[0] == '.' && component[1] == '.' &&
+			(component[2] == '/' || !component[2])) {
+			return 0;
+		}
+
+		if ((component = strchr(component, '/')))
+			component++;
+	}
+
+	return 1;
+}
+
+/* Append the regular file path to the archive as a container of its own, and
+ * record it in the index.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_archive_add_file(huff_writer_t *writer, char *path)
+{
+	huff_reader_t *reader = NULL;
+	huff_member_t *member;
+	int ret;
+
+	if (!huff_archive_valid_name(huff_archive_name(path))) {
+		printf("%s: invalid member name\n", path);
+		return -1;
+	}
+
+	/* the index reader takes no longer names */
+	if (strlen(huff_archive_name(path)) >= MAX_FILE_NAME_SIZE) {
+		printf("%s: name too long\n", path);
+		return -1;
+	}
+
+	if (!(member = huff_archive_new_member(path)) ||
+		!(reader = huff_reader_open(path))) {
+		return -1;
+	}
+
+	snprintf(uncompressed_file_name, MAX_FILE_NAME_SIZE, "%s", path);
+	member->offset = huff_writer_tell(writer);
+
+	/* the trailer is checked against the member's length and crc */
+	uncompressed_file_length = 0;
+	file_crc = 0;
+	ret = huff_encoder_compress(reader, writer, 0);
+	if (huff_reader_close(reader) || ret)
+		return -1;
+
+	member->length = huff_writer_tell(writer) - member->offset;
+	member->file_length = uncompressed_file_length;
+	member->crc = file_crc;
+	archive_file_length += uncompressed_file_length;
+
+	return 0;
+}
+
+/* Append the file path to the archive, or every file below it if it is a
+ * directory. Files other than regular files and directories, and the archive
+ * itself, are skipped.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_archive_add(huff_writer_t *writer, char *path)
+{
+	char child[MAX_FILE_NAME_SIZE];
+	struct dirent *entry;
+	struct stat st;
+	DIR *dir;
+	int ret = 0;
+
+	if (lstat(path, &st)) {
+		printf("the file %s does not exist or can not be read\n", path);
+		return -1;
+	}
+
+	if (st.st_dev == archive_stat.st_dev &&
+		st.st_ino == archive_stat.st_ino) {
+		return 0;
+	}
+
+	if (S_ISREG(st.st_mode))
+		return huff_archive_add_file(writer, path);
+
+	if (!S_ISDIR(st.st_mode)) {
+		printf("%s: not a regular file or a directory, skipped\n",
+			path);
+		return 0;
+	}
+
+	if (!(dir = opendir(path))) {
+		printf("the directory %s can not be read\n", path);
+		return -1;
+	}
+
+	while (!ret && (entry = readdir(dir))) {
+		if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+			continue;
+
+		if (snprintf(child, MAX_FILE_NAME_SIZE, "%s%s%s", path,
+			path[strlen(path) - 1] == '/' ? "" : "/",
+			entry->d_name) >= MAX_FILE_NAME_SIZE) {
+			printf("%s/%s: name too long\n", path, entry->d_name);
+			ret = -1;
+			break;
+		}
+
+		ret = huff_archive_add(writer, child);
+	}
+	closedir(dir);
+
+	return ret;
+}
+
+/* Write the index: the index magic, the number of members, the name, offset,
+ * length, uncompressed length and crc of every member and the crc of the
+ * index, followed by the footer: the offset of the index and the archive
+ * magic.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_archive_write_index(huff_writer_t *writer)
+{
+	u64 offset = huff_writer_tell(writer), i;
+	huff_member_t *member;
+	char *name;
+	u32 crc;
+
+	huff_writer_crc_begin(writer);
+	ASSERT(huff_write_u8(writer, HUFFMAN_ARCHIVE_INDEX));
+	ASSERT(huff_write_varint(writer, member_count));
+	for (i = 0; i < member_count; i++) {
+		member = members + i;
+		name = huff_archive_name(member->name);
+
+		ASSERT(huff_write_varint(writer, strlen(name)));
+		for (; *name; name++)
+			ASSERT(huff_write_u8(writer, (u8)*name));
+		ASSERT(huff_write_varint(writer, member->offset));
+		ASSERT(huff_write_varint(writer, member->length));
+		ASSERT(huff_write_varint(writer, member->file_length));
+		ASSERT(huff_write_u32(writer, member->crc));
+	}
+	crc = huff_writer_crc_end(writer);
+	ASSERT(huff_write_u32(writer, crc));
+
+	ASSERT(huff_write_u32(writer, (u32)(offset & 0xFFFFFFFF)));
+	ASSERT(huff_write_u32(writer, (u32)(offset >> 32)));
+
+	return huff_write_u8(writer, HUFFMAN_ARCHIVE);
+}
+
+/* Read the index of the archive read by reader, locating it through the
+ * footer, and set *index_offset to its offset.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_archive_read_index(huff_reader_t *reader, u64 *index_offset)
+{
+	char name[MAX_FILE_NAME_SIZE];
+	u64 length, count, name_length, i, j;
+	huff_member_t *member;
+	u32 low, high, crc;
+	u8 ch;
+
+	if (huff_reader_length(reader, &length) ||
+		length < 1 + HUFFMAN_ARCHIVE_FOOTER_LENGTH ||
+		huff_reader_seek(reader,
+			length - HUFFMAN_ARCHIVE_FOOTER_LENGTH) ||
+		huff_read_u32(reader, &low) || huff_read_u32(reader, &high) ||
+		huff_read_u8(reader, &ch) || ch != HUFFMAN_ARCHIVE) {
+		goto Error;
+	}
+
+	*index_offset = ((u64)high << 32) | low;
+	if (*index_offset >= length - HUFFMAN_ARCHIVE_FOOTER_LENGTH ||
+		huff_reader_seek(reader, *index_offset)) {
+		goto Error;
+	}
+
+	huff_reader_crc_begin(reader);
+	if (huff_read_u8(reader, &ch) || ch != HUFFMAN_ARCHIVE_INDEX ||
+		huff_read_varint(reader, &count) || count > length) {
+		goto Error;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (huff_read_varint(reader, &name_length) || !name_length ||
+			name_length >= MAX_FILE_NAME_SIZE) {
+			goto Error;
+		}
+
+		for (j = 0; j < name_length; j++) {
+			if (huff_read_u8(reader, &ch))
+				goto Error;
+			name[j] = (char)ch;
+		}
+		name[name_length] = '\0';
+
+		if (!(member = huff_archive_new_member(name)) ||
+			huff_read_varint(reader, &member->offset) ||
+			huff_read_varint(reader, &member->length) ||
+			huff_read_varint(reader, &member->file_length) ||
+			huff_read_u32(reader, &member->crc) ||
+			member->offset > *index_offset ||
+			member->length > *index_offset - member->offset) {
+			goto Error;
+		}
+	}
+
+	crc = huff_reader_crc_end(reader);
+	if (huff_read_u32(reader, &low) || low != crc)
+		goto Error;
+
+	return 0;
+
+Error:
+	printf("%s: not an archive or its index is corrupted\n",
+		compressed_file_name);
+	return -1;
+}
+
+/* Create the directories leading to name. */
+static int huff_archive_mkdirs(char *name)
+{
+	char *slash;
+	int ret = 0;
+
+	for (slash = strchr(name, '/'); slash && !ret;
+		slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		if (mkdir(name, HUFFMAN_ARCHIVE_DIR_MODE) && errno != EEXIST) {
+			printf("the directory %s can not be created\n", name);
+			ret = -1;
+		}
+		*slash = '/';
+	}
+
+	return ret;
+}
+
+/* Decode member from the archive read by reader into a file of its name, and
+ * check it against the index.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_archive_extract_member(huff_reader_t *reader,
+	huff_member_t *member)
+{
+	huff_writer_t *writer = NULL;
+	int ret;
+
+	if (!huff_archive_valid_name(member->name)) {
+		printf("%s: invalid member name %s\n", compressed_file_name,
+			member->name);
+		return -1;
+	}
+
+	snprintf(uncompressed_file_name, MAX_FILE_NAME_SIZE, "%s",
+		member->name);
+	if (huff_archive_mkdirs(member->name) ||
+		huff_reader_seek(reader, member->offset) ||
+		!(writer = huff_writer_open(member->name))) {
+		return -1;
+	}
+
+	uncompressed_file_length = 0;
+	file_crc = 0;
+	ret = huff_decoder_blocks(reader, writer) ||
+		huff_reader_tell(reader) != member->offset + member->length ||
+		uncompressed_file_length != member->file_length ||
+		file_crc != member->crc;
+	if (huff_writer_close(writer))
+		ret = 1;
+
+	if (ret) {
+		remove(member->name);
+		printf("%s: member %s FAILED\n", compressed_file_name,
+			member->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Return 1 if name is one of the count names, or if count is 0, otherwise 0.
+ */
+static int huff_archive_selected(char *name, char **names, int count)
+{
+	int i;
+
+	if (!count)
+		return 1;
+
+	for (i = 0; i < count; i++) {
+		if (!strcmp(name, huff_archive_name(names[i])))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Create the archive compressed_file_name of the files names, directories
+ * being archived with every file below them. If huffman_dedup is set, a chunk
+ * already written to the archive by any member is referred to. The files
+ * archived are removed unless huffman_keep_file is set.
+ * Return 0 if successful, otherwise -1.
+ */
+int huffman_archive_create(char **names, int count)
+{
+	char archive_name[MAX_FILE_NAME_SIZE];
+	huff_writer_t *writer = NULL;
+	u64 archive_length = 0, i;
+	int ret;
+
+	huff_stage_begin(HUFF_STAGE_TOTAL);
+	strncpy(archive_name, uncompressed_file_name, MAX_FILE_NAME_SIZE);
+	if (!(writer = huff_writer_open(compressed_file_name)))
+		return -1;
+
+	ret = fstat(fileno(writer->file), &archive_stat) ||
+		huff_write_u8(writer, HUFFMAN_ARCHIVE);
+	for (i = 0; !ret && i < count; i++)
+		ret = huff_archive_add(writer, names[i]);
+	if (!ret && !member_count) {
+		printf("no files to archive\n");
+		ret = -1;
+	}
+	if (!ret) {
+		ret = huff_archive_write_index(writer);
+		archive_length = huff_writer_tell(writer);
+	}
+	if (huff_writer_close(writer))
+		ret = -1;
+	huff_dedup_free();
+
+	if (ret) {
+		remove(compressed_file_name);
+		huff_archive_free();
+		return -1;
+	}
+
+	for (i = 0; !huffman_keep_file && i < member_count; i++)
+		remove(members[i].name);
+	huff_archive_free();
+
+	/* statistics */
+	strncpy(uncompressed_file_name, archive_name, MAX_FILE_NAME_SIZE);
+	uncompressed_file_length = archive_file_length;
+	file_stats.compressed_length = archive_length;
+	file_stats.header_length = archive_length * BYTE -
+		file_stats.coded_length;
+	huff_stage_end(HUFF_STAGE_TOTAL, uncompressed_file_length);
+
+	return 0;
+}
+
+/* Print the uncompressed and compressed length and the name of every member
+ * of the archive compressed_file_name, reading its index only.
+ * Return 0 if successful, otherwise -1.
+ */
+int huffman_archive_list(void)
+{
+	huff_reader_t *reader = NULL;
+	u64 index_offset, file_length = 0, i;
+	huff_member_t *member;
+	int ret;
+
+	if (!(reader = huff_reader_open(compressed_file_name)))
+		return -1;
+
+	ret = huff_archive_read_index(reader, &index_offset);
+	if (huff_reader_close(reader) || ret) {
+		huff_archive_free();
+		return -1;
+	}
+
+	printf("%12s %12s  %s\n", "length", "compressed", "name");
+	for (i = 0; i < member_count; i++) {
+		member = members + i;
+		printf("%12llu %12llu  %s\n", member->file_length,
+			member->length, member->name);
+		file_length += member->file_length;
+	}
+	printf("%12llu %12llu  %llu members\n", file_length, index_offset - 1,
+		member_count);
+
+	huff_archive_free();
+	return 0;
+}
+
+/* Extract the members names of the archive compressed_file_name, or all of its
+ * members if count is 0. Each member is read from its offset in the index, and
+ * its checksums are verified. The archive is not removed.
+ * Return 0 if successful, otherwise -1.
+ */
+int huffman_archive_extract(char **names, int count)
+{
+	huff_reader_t *reader = NULL;
+	u64 index_offset, file_length = 0, i;
+	int ret, j;
+
+	huff_stage_begin(HUFF_STAGE_TOTAL);
+	if (!(reader = huff_reader_open(compressed_file_name)))
+		return -1;
+
+	ret = huff_archive_read_index(reader, &index_offset);
+	for (j = 0; !ret && j < count; j++) {
+		for (i = 0; i < member_count; i++) {
+			if (!strcmp(members[i].name,
+				huff_archive_name(names[j]))) {
+				break;
+			}
+		}
+
+		if (i == member_count) {
+			printf("%s: no member %s\n", compressed_file_name,
+				names[j]);
+			ret = -1;
+		}
+	}
+
+	for (i = 0; !ret && i < member_count; i++) {
+		if (!huff_archive_selected(members[i].name, names, count))
+			continue;
+
+		ret = huff_archive_extract_member(reader, members + i);
+		file_length += members[i].file_length;
+	}
+
+	if (huff_reader_close(reader))
+		ret = -1;
+	huff_archive_free();
+	huff_stage_end(HUFF_STAGE_TOTAL, file_length);
+
+	return ret;
+}
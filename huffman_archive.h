@@ -0,0 +1,19 @@
+#ifndef _HUFFMAN_ARCHIVE_H_
+#define _HUFFMAN_ARCHIVE_H_
+
+#include "huffman.h"
+
+/* An archive packs many members, each a container with its own blocks and
+ * codes, into the single file compressed_file_name, followed by a central
+ * index of their names, offsets and lengths and a fixed length footer
+ * locating the index. Listing reads the footer and the index only, and a
+ * member is extracted with a seek to its offset.
+ */
+#define HUFFMAN_ARCHIVE_FOOTER_LENGTH 9 /* index offset (u64) and magic */
+
+int huffman_archive_create(char **names, int count);
+int huffman_archive_list(void);
+int huffman_archive_extract(char **names, int count);
+
+#endif
+
@@ -0,0 +1,686 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include "huffman.h"
+#include "huffman_io.h"
+#include "huffman_codec.h"
+#include "huffman_cpu.h"
+
+#define BENCH_OPTIONS "hr:l:b:"
+#define BENCH_DEFAULT_REPETITIONS 21
+#define BENCH_DEFAULT_LENGTH (1024 * 1024)
+#define BENCH_PERCENTILE 99
+#define BENCH_SCRATCH_FACTOR 16
+#define NSEC_PER_SEC 1000000000ULL
+#define NSEC_PER_USEC 1000.0
+#define BENCH_FILE_TEMPLATE "/tmp/huffman_benchXXXXXX"
+#define BENCH_FEED_LENGTH 4096 /* u8s per huff_encoder_feed() */
+
+typedef unsigned long long bench_ns_t;
+
+/* A kernel is timed in isolation: prepare() restores the state the kernel
+ * expects and is not timed, run() is the timed repetition.
+ */
+typedef struct bench_kernel_t {
+	char *name;
+	void (*prepare)(void);
+	int (*run)(void);
+} bench_kernel_t;
+
+static u8 *bench_data;
+static size_t bench_length;
+static u8 *bench_scratch;
+static size_t bench_scratch_length;
+static char *bench_coded;
+static size_t bench_coded_length;
+static int bench_repetitions = BENCH_DEFAULT_REPETITIONS;
+
+static huff_reader_t *bench_reader;
+static huff_writer_t *bench_writer;
+static huff_reader_t *bench_coded_reader;
+static u64 bench_coded_offset;
+static u8 bench_coded_minor_buf;
+static u8 bench_coded_minor_offset;
+static char bench_file_name[] = BENCH_FILE_TEMPLATE;
+static int bench_has_file;
+static u8 *bench_container;	/* the sample, by huff_encoder_compress() */
+static size_t bench_container_length;
+static size_t bench_pushed;	/* u8s emitted by the push encoder */
+
+static bench_ns_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (bench_ns_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int bench_ns_cmp(const void *a, const void *b)
+{
+	bench_ns_t x = *(const bench_ns_t*)a;
+	bench_ns_t y = *(const bench_ns_t*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Fill bench_data with text whose character distribution resembles english
+ * prose, using a fixed seed so that runs are comparable.
+ */
+static void bench_synthesize(void)
+{
+	static char alphabet[] = "  eeeetttaaooiinnsshhrrddlluuccmmwwffggyypp"
+		"bbvkjxqz\n,.ETAOI";
+	unsigned int seed = 2003;
+	size_t i;
+
+	for (i = 0; i < bench_length; i++) {
+		seed = seed * 1103515245 + 12345;
+		bench_data[i] = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+	}
+}
+
+static int bench_load(char *file_name)
+{
+	FILE *fd = NULL;
+	size_t i;
+
+	if (!(fd = fopen(file_name, "rb"))) {
+		printf("the file %s does not exist or can not be read\n",
+			file_name);
+		return -1;
+	}
+
+	fseek(fd, 0, SEEK_END);
+	bench_length = ftell(fd);
+	rewind(fd);
+	if (!bench_length || !(bench_data = malloc(bench_length)) ||
+		fread(bench_data, 1, bench_length, fd) != bench_length) {
+		printf("can not load %s\n", file_name);
+		fclose(fd);
+		return -1;
+	}
+	fclose(fd);
+
+	for (i = 0; i < bench_length; i++) {
+		if (bench_data[i] >= ANSI_CHAR_SET_CARDINALITY) {
+			printf("non ANSI character in %s\n", file_name);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void bench_reset_statistics(void)
+{
+	huff_block_reset();
+	uncompressed_file_length = 0;
+	file_stats.compressed_length = 0;
+	file_stats.header_length = 0;
+	file_stats.coded_length = 0;
+}
+
+static void bench_free_dictionary(void)
+{
+	int i;
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		if (dictionary[i])
+			bit_stack_free(dictionary[i]);
+		dictionary[i] = NULL;
+	}
+}
+
+static void bench_free_tree(void)
+{
+	if (tree_root)
+		huff_delete_tree(tree_root);
+	tree_root = NULL;
+}
+
+static void bench_writer_rewind(void)
+{
+	bench_writer->minor_buf = 0;
+	bench_writer->minor_offset = 0;
+	bench_writer->major_offset = 0;
+	bench_writer->buf_length = 0;
+	rewind(bench_writer->file);
+}
+
+static void bench_reader_rewind(void)
+{
+	huff_reader_reset(bench_reader);
+}
+
+/* prepare functions */
+static void bench_prepare_writer(void)
+{
+	bench_writer_rewind();
+}
+
+static void bench_prepare_reader(void)
+{
+	bench_reader_rewind();
+}
+
+static void bench_prepare_histogram(void)
+{
+	bench_reset_statistics();
+	bench_reader_rewind();
+}
+
+static void bench_prepare_tree(void)
+{
+	bench_free_tree();
+}
+
+static void bench_prepare_dictionary(void)
+{
+	bench_free_dictionary();
+}
+
+static void bench_prepare_encode(void)
+{
+	bench_writer_rewind();
+	bench_reader_rewind();
+}
+
+static void bench_prepare_decode(void)
+{
+	huff_reader_seek(bench_coded_reader, bench_coded_offset);
+	bench_coded_reader->minor_buf = bench_coded_minor_buf;
+	bench_coded_reader->minor_offset = bench_coded_minor_offset;
+	bench_writer_rewind();
+}
+
+/* the encoder builds every block's tree from an empty queue */
+static void bench_prepare_push(void)
+{
+	bench_free_tree();
+	bench_free_dictionary();
+	bench_pushed = 0;
+}
+
+static void bench_prepare_stdio(void)
+{
+	huffman_aio_backend = HUFF_AIO_STDIO;
+}
+
+static void bench_prepare_thread(void)
+{
+	huffman_aio_backend = HUFF_AIO_THREAD;
+}
+
+static void bench_prepare_aio(void)
+{
+	huffman_aio_backend = HUFF_AIO_AUTO;
+}
+
+/* kernels */
+static int bench_write_bit(void)
+{
+	size_t i;
+	int j;
+
+	for (i = 0; i < bench_length; i++) {
+		for (j = BYTE - 1; j >= 0; j--) {
+			if (huff_write_bit(bench_writer,
+				(bench_data[i] >> j) & 1 ? ONE : ZERO)) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int bench_write_u8(void)
+{
+	size_t i;
+
+	for (i = 0; i < bench_length; i++) {
+		if (huff_write_u8(bench_writer, bench_data[i]))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int bench_read_bit(void)
+{
+	size_t i;
+	bit_t bit;
+
+	for (i = 0; i < bench_length * BYTE; i++) {
+		if (huff_read_bit(bench_reader, &bit))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int bench_read_u8(void)
+{
+	size_t i;
+	u8 ch;
+
+	for (i = 0; i < bench_length; i++) {
+		if (huff_read_u8(bench_reader, &ch))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int bench_histogram(void)
+{
+	return huff_encoder_parse(bench_reader);
+}
+
+static int bench_tree(void)
+{
+	return huff_encoder_create_tree();
+}
+
+static int bench_dictionary(void)
+{
+	return huff_encoder_create_dictionary();
+}
+
+static int bench_encode(void)
+{
+	return huff_encoder_write_data(bench_reader, bench_writer);
+}
+
+static int bench_decode(void)
+{
+	return huff_decoder_decompress(bench_coded_reader, bench_writer);
+}
+
+static int bench_decode_fsm(void)
+{
+	return huff_decoder_decompress_fsm(bench_coded_reader, bench_writer);
+}
+
+/* Append the u8s emitted by the push encoder to bench_scratch. */
+static int bench_emit(void *arg, const u8 *buf, size_t len)
+{
+	if (len > bench_scratch_length - bench_pushed)
+		return -1;
+
+	memcpy(bench_scratch + bench_pushed, buf, len);
+	bench_pushed += len;
+	return 0;
+}
+
+/* Feed the sample to the push encoder BENCH_FEED_LENGTH u8s at a time. What
+ * it emits must be the container huff_encoder_compress() writes, u8 for u8,
+ * otherwise the kernel fails.
+ */
+static int bench_push(void)
+{
+	huff_encoder_ctx_t *ctx;
+	size_t i, len;
+
+	if (!(ctx = huff_encoder_begin(bench_emit, NULL)))
+		return -1;
+
+	for (i = 0; i < bench_length; i += len) {
+		len = bench_length - i < BENCH_FEED_LENGTH ?
+			bench_length - i : BENCH_FEED_LENGTH;
+		if (huff_encoder_feed(ctx, bench_data + i, len))
+			break;
+	}
+
+	if (huff_encoder_end(ctx) || i < bench_length)
+		return -1;
+
+	return bench_pushed != bench_container_length ||
+		memcmp(bench_scratch, bench_container, bench_pushed) ? -1 : 0;
+}
+
+/* Read the sample from a file through a reader opened with the backend set
+ * by the prepare function.
+ */
+static int bench_file_read(void)
+{
+	huff_reader_t *reader = NULL;
+	size_t i;
+	u8 ch;
+
+	if (!(reader = huff_reader_open(bench_file_name)))
+		return -1;
+
+	for (i = 0; i < bench_length; i++) {
+		if (huff_read_u8(reader, &ch)) {
+			huff_reader_close(reader);
+			return -1;
+		}
+	}
+
+	return huff_reader_close(reader);
+}
+
+/* Write the sample to a file through a writer opened with the backend set by
+ * the prepare function.
+ */
+static int bench_file_write(void)
+{
+	huff_writer_t *writer = NULL;
+	size_t i;
+
+	if (!(writer = huff_writer_open(bench_file_name)))
+		return -1;
+
+	for (i = 0; i < bench_length; i++) {
+		if (huff_write_u8(writer, bench_data[i])) {
+			huff_writer_close(writer);
+			return -1;
+		}
+	}
+
+	return huff_writer_close(writer);
+}
+
+static bench_kernel_t bench_kernels[] = {
+	{"huff_write_bit", bench_prepare_writer, bench_write_bit},
+	{"huff_write_u8", bench_prepare_writer, bench_write_u8},
+	{"huff_read_bit", bench_prepare_reader, bench_read_bit},
+	{"huff_read_u8", bench_prepare_reader, bench_read_u8},
+	{"histogram", bench_prepare_histogram, bench_histogram},
+	{"tree build", bench_prepare_tree, bench_tree},
+	{"dictionary", bench_prepare_dictionary, bench_dictionary},
+	{"encode data", bench_prepare_encode, bench_encode},
+	{"decode loop", bench_prepare_decode, bench_decode},
+	{"decode fsm", bench_prepare_decode, bench_decode_fsm},
+	{"push encode", bench_prepare_push, bench_push},
+};
+
+/* run if a temporary file could be created for the sample */
+static bench_kernel_t bench_file_kernels[] = {
+	{"read stdio", bench_prepare_stdio, bench_file_read},
+	{"read thread", bench_prepare_thread, bench_file_read},
+	{"read aio", bench_prepare_aio, bench_file_read},
+	{"write stdio", bench_prepare_stdio, bench_file_write},
+	{"write thread", bench_prepare_thread, bench_file_write},
+	{"write aio", bench_prepare_aio, bench_file_write},
+};
+
+/* Run kernel bench_repetitions times and print its median and percentile
+ * timing. Return 0 if all repetitions succeeded, otherwise -1.
+ */
+static int bench_run(bench_kernel_t *kernel)
+{
+	bench_ns_t *samples = NULL, start, median, tail;
+	int i, tail_index;
+
+	if (!(samples = calloc(bench_repetitions, sizeof(bench_ns_t))))
+		return -1;
+
+	for (i = 0; i < bench_repetitions; i++) {
+		kernel->prepare();
+		start = bench_now();
+		if (kernel->run()) {
+			printf("%-16s failed\n", kernel->name);
+			free(samples);
+			return -1;
+		}
+		samples[i] = bench_now() - start;
+	}
+
+	qsort(samples, bench_repetitions, sizeof(bench_ns_t), bench_ns_cmp);
+	median = samples[bench_repetitions / 2];
+	tail_index = (bench_repetitions * BENCH_PERCENTILE + 99) / 100 - 1;
+	tail = samples[tail_index];
+
+	printf("%-16s %12.1f %12.1f %10.3f %10.1f\n", kernel->name,
+		median / NSEC_PER_USEC, tail / NSEC_PER_USEC,
+		(double)median / bench_length,
+		median ? (double)bench_length * NSEC_PER_SEC / median /
+		(1024 * 1024) : 0);
+
+	free(samples);
+	return 0;
+}
+
+/* Encode bench_data into an in memory .huf image and prepare a reader
+ * positioned at its coded data, for the decode loop kernel.
+ * Return 0 if successful, otherwise -1.
+ */
+static int bench_prepare_coded(void)
+{
+	huff_writer_t *writer = NULL;
+
+	if (!(writer = huff_writer_attach(open_memstream(&bench_coded,
+		&bench_coded_length)))) {
+		return -1;
+	}
+
+	bench_reset_statistics();
+	bench_reader_rewind();
+	if (huff_encoder_parse(bench_reader) || huff_encoder_create_tree() ||
+		huff_encoder_create_dictionary() ||
+		huff_encoder_write_header(writer) ||
+		huff_reader_reset(bench_reader) ||
+		huff_encoder_write_data(bench_reader, writer) ||
+		huff_writer_close(writer)) {
+		return -1;
+	}
+
+	/* rebuild the decoder's view of the tree from the image's header */
+	bench_free_tree();
+	bench_free_dictionary();
+	bench_reset_statistics();
+	if (!(bench_coded_reader = huff_reader_attach(fmemopen(bench_coded,
+		bench_coded_length, "rb"))) ||
+		huff_decoder_parse_header(bench_coded_reader, NULL) ||
+		huff_decoder_creat_tree()) {
+		return -1;
+	}
+
+	bench_coded_offset = huff_reader_tell(bench_coded_reader);
+	bench_coded_minor_buf = bench_coded_reader->minor_buf;
+	bench_coded_minor_offset = bench_coded_reader->minor_offset;
+	return 0;
+}
+
+/* Encode bench_data as huffman -e does, into bench_container, for comparing
+ * with the output of the push encoder.
+ * Return 0 if successful, otherwise -1.
+ */
+static int bench_prepare_container(void)
+{
+	huff_writer_t *writer = NULL;
+	size_t length;
+	u8 *data;
+	int ret;
+
+	if (!(writer = huff_writer_memory()))
+		return -1;
+
+	bench_prepare_push();
+	huff_file_reset();
+	bench_reader_rewind();
+	ret = huff_encoder_compress(bench_reader, writer, 0);
+	data = huff_writer_memory_data(writer, &length);
+	if (!ret && (bench_container = malloc(length))) {
+		memcpy(bench_container, data, length);
+		bench_container_length = length;
+	}
+
+	return huff_writer_close(writer) || !bench_container ? -1 : 0;
+}
+
+/* Restore the encoder's tree and dictionary after bench_prepare_coded()
+ * replaced them with the decoder's.
+ */
+static int bench_prepare_encoder(void)
+{
+	bench_free_tree();
+	bench_free_dictionary();
+	bench_reset_statistics();
+	bench_reader_rewind();
+
+	return huff_encoder_parse(bench_reader) || huff_encoder_create_tree() ||
+		huff_encoder_create_dictionary() ? -1 : 0;
+}
+
+/* Write the sample to a temporary file for the file kernels.
+ * Return 0 if successful, otherwise -1.
+ */
+static int bench_prepare_file(void)
+{
+	FILE *fd = NULL;
+	int fildes, ret;
+
+	if ((fildes = mkstemp(bench_file_name)) < 0)
+		return -1;
+
+	if (!(fd = fdopen(fildes, "wb"))) {
+		close(fildes);
+		unlink(bench_file_name);
+		return -1;
+	}
+
+	ret = fwrite(bench_data, 1, bench_length, fd) != bench_length;
+	if (fclose(fd) == EOF || ret) {
+		unlink(bench_file_name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int bench_open(void)
+{
+	/* the codec stages run over all of bench_data as a single block */
+	huffman_block_size = bench_length;
+
+	bench_scratch_length = bench_length * BENCH_SCRATCH_FACTOR;
+	if (!(bench_scratch = malloc(bench_scratch_length)))
+		return -1;
+
+	if (!(bench_reader = huff_reader_attach(fmemopen(bench_data,
+		bench_length, "rb"))) ||
+		!(bench_writer = huff_writer_attach(fmemopen(bench_scratch,
+		bench_scratch_length, "w+")))) {
+		return -1;
+	}
+
+	bench_has_file = !bench_prepare_file();
+	return bench_prepare_coded() || bench_prepare_container() ||
+		bench_prepare_encoder() ? -1 : 0;
+}
+
+static void bench_close(void)
+{
+	bench_free_tree();
+	bench_free_dictionary();
+	if (bench_coded_reader)
+		huff_reader_close(bench_coded_reader);
+	if (bench_reader)
+		huff_reader_close(bench_reader);
+	if (bench_writer) {
+		bench_writer_rewind();
+		huff_writer_close(bench_writer);
+	}
+	if (bench_has_file)
+		unlink(bench_file_name);
+	free(bench_coded);
+	free(bench_container);
+	free(bench_scratch);
+	free(bench_data);
+}
+
+static void bench_usage(char *argv[])
+{
+	printf("Usage: %s [-r repetitions] [-l length] [-b buffer_size] " \
+		"[file_name]\n", argv[0]);
+	printf("       %s [-h]\n\n", argv[0]);
+	printf("  Where -r   number of timed repetitions per kernel " \
+		"(default %i)\n", BENCH_DEFAULT_REPETITIONS);
+	printf("        -l   length of the synthesized sample in bytes " \
+		"(default %i)\n", BENCH_DEFAULT_LENGTH);
+	printf("        -b   size of the io buffers in bytes, a multiple " \
+		"of %i (default %i)\n", HUFFMAN_IO_BUF_MIN,
+		HUFFMAN_IO_BUF_SIZE);
+	printf("        -h   print this message and exit\n\n");
+	printf("If file_name is given it is benchmarked instead of a " \
+		"synthesized sample.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int option, i, ret = 0;
+
+	bench_length = BENCH_DEFAULT_LENGTH;
+	while ((option = getopt(argc, argv, BENCH_OPTIONS)) != -1) {
+		switch (option) {
+		case 'r':
+			if ((bench_repetitions = atoi(optarg)) < 1)
+				goto Error;
+			break;
+		case 'l':
+			if (!(bench_length = strtoul(optarg, NULL, 0)))
+				goto Error;
+			break;
+		case 'b':
+			huffman_io_buf_size = strtoul(optarg, NULL, 0);
+			if (huffman_io_buf_size < HUFFMAN_IO_BUF_MIN ||
+				huffman_io_buf_size > HUFFMAN_IO_BUF_MAX ||
+				huffman_io_buf_size % HUFFMAN_IO_BUF_MIN) {
+				goto Error;
+			}
+			break;
+		case 'h':
+			bench_usage(argv);
+			return 0;
+		default:
+			goto Error;
+		}
+	}
+
+	if (optind < argc - 1)
+		goto Error;
+
+	if (optind == argc - 1) {
+		if (bench_load(argv[optind]))
+			return -1;
+	} else {
+		if (!(bench_data = malloc(bench_length)))
+			return -1;
+		bench_synthesize();
+	}
+
+	if (bench_open()) {
+		printf("failed to prepare the benchmark\n");
+		bench_close();
+		return -1;
+	}
+
+	printf("sample: %lu bytes, %i characters, coded: %lu bytes, " \
+		"%i repetitions, cpu: %s\n\n", (unsigned long)bench_length,
+		character_set_cardinality, (unsigned long)bench_coded_length,
+		bench_repetitions, huff_cpu_name(huff_cpu_level()));
+	printf("%-16s %12s %12s %10s %10s\n", "kernel", "median(us)",
+		"p99(us)", "ns/byte", "MB/s");
+	printf("%-16s %12s %12s %10s %10s\n", "------", "----------",
+		"-------", "-------", "----");
+	for (i = 0; i < sizeof(bench_kernels) / sizeof(bench_kernel_t); i++)
+		ret |= bench_run(&bench_kernels[i]);
+
+	for (i = 0; bench_has_file &&
+		i < sizeof(bench_file_kernels) / sizeof(bench_kernel_t); i++) {
+		ret |= bench_run(&bench_file_kernels[i]);
+	}
+
+	bench_close();
+	return ret;
+
+Error:
+	printf("try `%s -h' for more information\n", argv[0]);
+	return -1;
+}
+
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "huffman.h"
+#include "huffman_proto.h"
+
+#define CLIENT_OPTIONS "hksS:e:d:"
+#define CLIENT_SUFFIX ".huf"
+#define CLIENT_FILE_MODE 0644
+
+static char in_name[MAX_FILE_NAME_SIZE];
+static char out_name[MAX_FILE_NAME_SIZE];
+
+/* Set in_name and out_name for encoding name into name.huf, or for decoding
+ * name.huf into name.
+ * Return 0 if successful, otherwise -1.
+ */
+static int client_set_names(char *name, u8 op)
+{
+	size_t len = strlen(name), suffix_len = strlen(CLIENT_SUFFIX);
+
+	if (len + suffix_len >= MAX_FILE_NAME_SIZE)
+		return -1;
+
+	strcpy(in_name, name);
+	strcpy(out_name, name);
+	if (op == HUFFMAN_REQUEST_ENCODE) {
+		strcat(out_name, CLIENT_SUFFIX);
+		return 0;
+	}
+
+	if (len <= suffix_len || strcmp(name + len - suffix_len, CLIENT_SUFFIX))
+		return -1;
+	out_name[len - suffix_len] = '\0';
+
+	return 0;
+}
+
+/* Return a socket connected to the daemon at path, or -1 on failure. */
+static int client_connect(char *path)
+{
+	struct sockaddr_un addr;
+	int sock;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+
+	if (connect(sock, (struct sockaddr*)&addr, sizeof(addr))) {
+		printf("huffmand is not listening on %s\n", path);
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+/* Have the daemon at path code in_name into out_name.
+ * Return 0 if successful, otherwise -1.
+ */
+static int client_request(char *path, u8 op, huff_reply_t *reply)
+{
+	int in_fd = -1, out_fd = -1, sock = -1, ret = -1;
+
+	if ((in_fd = open(in_name, O_RDONLY)) < 0) {
+		printf("the file %s does not exist or can not be read\n",
+			in_name);
+		goto Exit;
+	}
+
+	if ((out_fd = open(out_name, O_WRONLY | O_CREAT | O_TRUNC,
+		CLIENT_FILE_MODE)) < 0) {
+		printf("the file %s can not be created\n", out_name);
+		goto Exit;
+	}
+
+	if ((sock = client_connect(path)) < 0 ||
+		huff_proto_send_request(sock, op, in_fd, out_fd) ||
+		huff_proto_recv_reply(sock, reply)) {
+		goto Exit;
+	}
+
+	ret = reply->status == HUFFMAN_REPLY_OK ? 0 : -1;
+
+Exit:
+	if (sock >= 0)
+		close(sock);
+	if (out_fd >= 0) {
+		close(out_fd);
+		if (ret)
+			unlink(out_name);
+	}
+	if (in_fd >= 0)
+		close(in_fd);
+
+	return ret;
+}
+
+static void client_usage(char *argv[])
+{
+	printf("Usage: %s [-k] [-s] [-S socket] <-e file_name | " \
+		"-d file_name.huf>\n", argv[0]);
+	printf("       %s [-h]\n\n", argv[0]);
+	printf("  Where -k   keep the original file\n");
+	printf("        -s   display the lengths of both files\n");
+	printf("        -S   the socket huffmand listens on (default %s)\n",
+		HUFFMAN_DAEMON_SOCKET);
+	printf("        -e   encode the text file 'file_name'\n");
+	printf("        -d   decode the compressed file 'file_name.huf'\n");
+	printf("        -h   print this message and exit\n\n");
+	printf("Codes the file as huffman does, through huffmand, without " \
+		"starting a coder.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	char *path = HUFFMAN_DAEMON_SOCKET;
+	int option, keep = 0, stats = 0;
+	huff_reply_t reply;
+	u8 op = 0;
+
+	while ((option = getopt(argc, argv, CLIENT_OPTIONS)) != -1) {
+		switch (option) {
+		case 'k':
+			keep = 1;
+			break;
+		case 's':
+			stats = 1;
+			break;
+		case 'S':
+			path = optarg;
+			break;
+		case 'e':
+		case 'd':
+			if (op)
+				goto Error;
+			op = option == 'e' ? HUFFMAN_REQUEST_ENCODE :
+				HUFFMAN_REQUEST_DECODE;
+			if (client_set_names(optarg, op))
+				goto Error;
+			break;
+		case 'h':
+			client_usage(argv);
+			return 0;
+		default:
+			goto Error;
+		}
+	}
+
+	if (!op || optind != argc)
+		goto Error;
+
+	if (client_request(path, op, &reply)) {
+		printf("aborting!\n");
+		return -1;
+	}
+
+	if (stats) {
+		printf("%s: %llu bytes\n%s: %llu bytes\n", in_name,
+			reply.in_length, out_name, reply.out_length);
+	}
+
+	if (!keep)
+		unlink(in_name);
+
+	return 0;
+
+Error:
+	printf("try `%s -h' for more information\n", argv[0]);
+	return -1;
+}
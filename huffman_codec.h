@@ -0,0 +1,81 @@
+#ifndef _HUFFMAN_CODEC_H_
+#define _HUFFMAN_CODEC_H_
+
+#include <sys/types.h>
+#include "huffman.h"
+#include "huffman_io.h"
+
+/* encoder */
+int huffman_encode(void);
+int huffman_estimate(void);
+int huffman_append(void);
+int huff_encoder_parse(huff_reader_t *reader);
+int huff_encoder_create_tree(void);
+int huff_encoder_create_dictionary(void);
+int huff_encoder_write_header(huff_writer_t *writer);
+int huff_encoder_write_data(huff_reader_t *reader, huff_writer_t *writer);
+int huff_encoder_compress(huff_reader_t *reader, huff_writer_t *writer,
+	int is_estimate);
+int huff_encoder_read_codebook(void);
+
+/* push encoding: the characters of a file, fed a buffer at a time, and the
+ * compressed file emitted a block at a time */
+typedef int (*huff_encoder_emit_t)(void *arg, const u8 *buf, size_t len);
+typedef struct huff_encoder_ctx_t huff_encoder_ctx_t;
+
+huff_encoder_ctx_t *huff_encoder_begin(huff_encoder_emit_t emit, void *arg);
+int huff_encoder_feed(huff_encoder_ctx_t *ctx, const u8 *buf, size_t len);
+int huff_encoder_flush(huff_encoder_ctx_t *ctx);
+int huff_encoder_end(huff_encoder_ctx_t *ctx);
+
+/* decoder engines: walking the tree a bit at a time, or a finite state
+ * machine over the tree's internal nodes consuming a u8 at a time */
+typedef enum huff_decoder_engine_t {
+	HUFF_DECODER_TREE = 0,
+	HUFF_DECODER_FSM = 1,
+} huff_decoder_engine_t;
+
+extern huff_decoder_engine_t huffman_decoder_engine;
+
+#define HUFF_FSM_INPUTS 256 /* u8 values */
+
+/* A transition of the decoding finite state machine: the characters completed
+ * by walking the tree along the bits of an input u8 from a state, and the
+ * state the walk ends at. The states are the internal nodes of the tree.
+ */
+typedef struct huff_fsm_entry_t {
+	u8 next;
+	u8 count;
+	u8 character[BYTE];
+} huff_fsm_entry_t;
+
+/* decodes the data of a huffman block, see huffman_decode_codebook() */
+typedef int (*huff_decompress_t)(huff_reader_t *reader, huff_writer_t *writer);
+
+/* decoder */
+int huffman_decode(void);
+int huffman_test(void);
+int huff_decoder_blocks(huff_reader_t *reader, huff_writer_t *writer);
+int huff_decoder_block_at(huff_reader_t *reader, huff_writer_t *writer,
+	u64 offset);
+int huff_decoder_find_header(huff_reader_t *reader);
+int huff_decoder_find_trailer(huff_reader_t *reader, u64 end, u64 *offset);
+int huff_decoder_parse_header(huff_reader_t *reader, huff_writer_t *writer);
+int huff_decoder_creat_tree(void);
+int huff_decoder_decompress(huff_reader_t *reader, huff_writer_t *writer);
+int huff_decoder_decompress_fsm(huff_reader_t *reader, huff_writer_t *writer);
+int huff_decoder_number_states(huff_tree_node_t *node,
+	huff_tree_node_t **states, int n);
+void huff_decoder_fsm_build(huff_fsm_entry_t *table,
+	huff_tree_node_t **states, int num);
+int huffman_decode_codebook(huff_decompress_t decompress);
+
+/* pull decoding: the decoded data of a file, read a buffer at a time */
+typedef struct huff_decoder_ctx_t huff_decoder_ctx_t;
+
+huff_decoder_ctx_t *huff_decoder_open(const char *file_name);
+ssize_t huff_decoder_read(huff_decoder_ctx_t *ctx, u8 *buf, size_t len);
+int huff_decoder_close(huff_decoder_ctx_t *ctx);
+
+#endif
+
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "huffman.h"
+#include "huffman_stats.h"
+
+char compressed_file_name[MAX_FILE_NAME_SIZE];
+char uncompressed_file_name[MAX_FILE_NAME_SIZE];
+u64 frequency[ANSI_CHAR_SET_CARDINALITY];
+u8 character_set_cardinality;
+u8 representation_length[ANSI_CHAR_SET_CARDINALITY];
+u64 uncompressed_file_length;
+int huffman_print_tree;
+huff_tree_node_t *tree_root;
+bit_t *dictionary[ANSI_CHAR_SET_CARDINALITY];
+
+u64 huffman_block_size = HUFFMAN_BLOCK_SIZE;
+u64 block_length;
+u32 block_crc;
+u64 block_count;
+u32 file_crc;
+
+int huffman_sample;
+char *huffman_codebook;
+int huffman_codebook_resident;
+
+int huffman_dedup;
+
+int huffman_index;
+
+int huffman_tokens;
+
+int huffman_keep_file;
+int huffman_stats_json;
+huff_file_stat_t file_stats;
+
+/* Allocates a new node for the huffman tree. */
+huff_tree_node_t *huff_tree_node_alloc(u8 character, u64 freq)
+{
+	huff_tree_node_t *node = (huff_tree_node_t*)huff_calloc(1,
+		sizeof(huff_tree_node_t));
+
+	if (!node)
+		return NULL;
+
+	HUFF_NODE_CHAR(node)=character;
+	HUFF_NODE_FREQ(node)=freq;
+
+	return node;
+}
+
+/* Frees a huffman tree node. */
+void huff_tree_node_free(huff_tree_node_t *node)
+{
+	huff_free(node);
+}
+
+/* Insert node into the minimum priority queue rooted at tree_root. */
+void huff_tree_insert_node(huff_tree_node_t *node)
+{
+	huff_tree_node_t **tree_ptr = &tree_root;
+
+	while (*tree_ptr) {
+		if (HUFF_NODE_FREQ(node) < HUFF_NODE_FREQ(*tree_ptr))
+			break;
+		tree_ptr=&HUFF_NODE_NEXT(*tree_ptr);
+	}
+
+	HUFF_NODE_NEXT(node)=*tree_ptr;
+	*tree_ptr=node;
+}
+
+void huff_delete_tree(huff_tree_node_t *node) 
+{
+	if (HUFF_NODE_LSON(node))
+		huff_delete_tree(HUFF_NODE_LSON(node));
+
+	if (HUFF_NODE_RSON(node))
+		huff_delete_tree(HUFF_NODE_RSON(node));
+
+	if (HUFF_NODE_NEXT(node))
+		huff_delete_tree(HUFF_NODE_NEXT(node));
+
+	huff_tree_node_free(node);
+}
+
+static void huff_print_tree_rec(huff_tree_node_t *node, int offset,
+	char node_char)
+{
+#define NODE_OFFSET 3
+#define CHARACTER_BUF_LEN 10
+#define CHAR_ZERO 0
+#define CHAR_SLASH_A 7
+#define CHAR_SLASH_B 8
+#define CHAR_TAB 9
+#define CHAR_NEWLINE 10
+#define CHAR_RETURN 13
+#define CHAR_BACKSPACE 27
+#define CHAR_SPACE 32
+#define CHARACTER(X) ('A' <= X && X <= 'Z')
+
+	int i;
+
+	for (i = 0; i < offset; i++)
+		printf(" ");
+
+	printf("%c", node_char);
+	if (HUFF_NODE_ISLEAF(node))
+		printf("(%i)", representation_length[node->character]);
+	printf("->");
+
+	if (!node) {
+		printf("NULL\n");
+		goto Exit;
+	}
+
+	if (HUFF_NODE_ISLEAF(node)) {
+		static char ch[10];
+
+		switch(node->character) {
+		case CHAR_ZERO:
+			snprintf(ch, CHARACTER_BUF_LEN, "\\0");
+			break;
+		case CHAR_SLASH_A:
+			snprintf(ch, CHARACTER_BUF_LEN, "\\a");
+			break;
+		case CHAR_SLASH_B:
+			snprintf(ch, CHARACTER_BUF_LEN, "\\b");
+			break;
+		case CHAR_TAB:
+			snprintf(ch, CHARACTER_BUF_LEN, "\\tab");
+			break;
+		case CHAR_NEWLINE:
+			snprintf(ch, CHARACTER_BUF_LEN, "\\n");
+			break;
+		case CHAR_RETURN:
+			snprintf(ch, CHARACTER_BUF_LEN, "\\r");
+			break;
+		case CHAR_BACKSPACE:
+			snprintf(ch, CHARACTER_BUF_LEN, "\\backspace");
+			break;
+		case CHAR_SPACE:
+			snprintf(ch, CHARACTER_BUF_LEN, "\\space");
+			break;
+		default:
+			snprintf(ch, CHARACTER_BUF_LEN, "%c", node->character);
+			break;
+		}
+
+		/* printing character */
+		printf("'%s'", ch);
+		printf(" (%llu)", frequency[node->character]);
+		printf("\n");
+		goto Exit;
+	}
+
+	printf("\n");
+	huff_print_tree_rec(HUFF_NODE_RSON(node), offset + NODE_OFFSET,
+		HUFF_PRINT_RIGHT);
+	huff_print_tree_rec(HUFF_NODE_LSON(node), offset + NODE_OFFSET,
+		HUFF_PRINT_LEFT);
+
+Exit:
+	return;
+}
+
+void huff_print_tree(void)
+{
+	huff_print_tree_rec(tree_root, 0, HUFF_PRINT_ROOT);
+	printf("\n");
+}
+
+/* Clear the per file totals and statistics, for coding another file in the
+ * same process.
+ */
+void huff_file_reset(void)
+{
+	memset(&file_stats, 0, sizeof(file_stats));
+	uncompressed_file_length = 0;
+	block_count = 0;
+	file_crc = 0;
+}
+
+/* Clear the per block tables before a block is parsed or its header read. */
+void huff_block_reset(void)
+{
+	memset(frequency, 0, sizeof(frequency));
+	memset(representation_length, 0, sizeof(representation_length));
+	character_set_cardinality = 0;
+	block_length = 0;
+	block_crc = 0;
+}
+
+/* Add the block's tables to the file wide statistics. */
+void huff_block_account(void)
+{
+	int i;
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		file_stats.frequency[i] += frequency[i];
+		file_stats.length_frequency[representation_length[i]] +=
+			frequency[i];
+	}
+	uncompressed_file_length += block_length;
+	block_count++;
+}
+
+/* Return the number of bits of the block's coded data, freq holding the
+ * counts of its characters: freq x representation length summed over the
+ * character set. The data of a block of a single character is not coded.
+ */
+u64 huff_block_coded_length(u64 *freq)
+{
+	u64 bits = 0;
+	int i;
+
+	if (character_set_cardinality == 1)
+		return 0;
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++)
+		bits += freq[i] * representation_length[i];
+
+	return bits;
+}
+
+/* Print the tree if requested and release the tree and the dictionary. */
+void huff_block_release(void)
+{
+	int i;
+
+	if (huffman_print_tree && tree_root)
+		huff_print_tree();
+
+	if (tree_root)
+		huff_delete_tree(tree_root);
+	tree_root = NULL;
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		if (dictionary[i])
+			bit_stack_free(dictionary[i]);
+		dictionary[i] = NULL;
+	}
+}
+
+bit_t *bit_stack_alloc(int num)
+{
+	int i;
+	bit_t *stack = NULL;
+
+	if (!(stack = (bit_t*)huff_calloc(num, sizeof(bit_t))))
+		return NULL;
+
+	for (i = 0; i<num; i++)
+		stack[i] = NO_BIT;
+
+	return stack;
+}
+
+bit_t *bit_stack_clone(bit_t *stack, int offset)
+{
+	int i;
+	bit_t *new_stack = NULL;
+
+	if (!(new_stack = huff_calloc(offset + 1, sizeof(bit_t))))
+		return NULL;
+
+	for (i = 0; i < offset; i++)
+		new_stack[i] = stack[i];
+	new_stack[offset] = NO_BIT;
+	return new_stack;
+}
+
+void bit_stack_free(bit_t *ptr)
+{
+	huff_free(ptr);
+}
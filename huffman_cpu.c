@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <string.h>
+#include "huffman_cpu.h"
+
+static char *huff_cpu_names[HUFF_CPU_LEVELS] = {
+	"scalar",
+	"sse4.2",
+	"avx2",
+	"avx512",
+};
+
+/* Return the highest level all of whose instructions the cpu has. */
+static int huff_cpu_detect(void)
+{
+	int level = HUFF_CPU_SCALAR;
+
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (!__builtin_cpu_supports("sse4.2"))
+		return level;
+	level = HUFF_CPU_SSE42;
+
+	if (!__builtin_cpu_supports("avx2"))
+		return level;
+	level = HUFF_CPU_AVX2;
+
+	if (!__builtin_cpu_supports("avx512f") ||
+		!__builtin_cpu_supports("avx512bw")) {
+		return level;
+	}
+	level = HUFF_CPU_AVX512;
+#endif
+
+	return level;
+}
+
+/* Return the level of the kernel variants to run: the cpu's own, detected
+ * once, or the one named by HUFFMAN_CPU_ENV if that is lower. A name that is
+ * not a level's, or a level the cpu does not have, is ignored.
+ */
+int huff_cpu_level(void)
+{
+	static int level = -1;
+	char *name;
+	int i;
+
+	if (level >= 0)
+		return level;
+
+	level = huff_cpu_detect();
+	if (!(name = getenv(HUFF_CPU_ENV)))
+		return level;
+
+	for (i = 0; i < level; i++) {
+		if (!strcmp(name, huff_cpu_names[i])) {
+			level = i;
+			break;
+		}
+	}
+
+	return level;
+}
+
+/* Return the name of level, as given in HUFFMAN_CPU_ENV. */
+const char *huff_cpu_name(int level)
+{
+	if (level < 0 || level >= HUFF_CPU_LEVELS)
+		return "unknown";
+
+	return huff_cpu_names[level];
+}
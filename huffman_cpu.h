@@ -0,0 +1,23 @@
+#ifndef _HUFFMAN_CPU_H_
+#define _HUFFMAN_CPU_H_
+
+/* The instruction set levels the kernels are built for, each implying the
+ * ones below it. Every kernel is compiled in a variant per level it has a use
+ * for, whatever the build flags, and the variant run is chosen at run time by
+ * the level of the cpu: huff_crc32c() uses the SSE4.2 crc32 instruction and
+ * huff_pack_write() AVX2 or AVX-512 gathers. Setting HUFFMAN_CPU_ENV to the
+ * name of a level caps it there, so that the variants below the cpu's own can
+ * be run and compared.
+ */
+#define HUFF_CPU_SCALAR 0
+#define HUFF_CPU_SSE42 1
+#define HUFF_CPU_AVX2 2
+#define HUFF_CPU_AVX512 3
+#define HUFF_CPU_LEVELS 4
+
+#define HUFF_CPU_ENV "HUFFMAN_CPU"
+
+int huff_cpu_level(void);
+const char *huff_cpu_name(int level);
+
+#endif
@@ -0,0 +1,167 @@
+#include "huffman_crc.h"
+#include "huffman_cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define HUFF_CRC32C_HW
+#endif
+
+#define CRC32C_POLY 0x82F63B78UL /* reversed 0x1EDC6F41 */
+#define CRC32C_MASK 0xFFFFFFFFUL
+#define CRC32C_BITS 32
+#define CRC32C_SLICES 8
+#define CRC32C_TABLE_SIZE 256
+
+static u32 crc32c_table[CRC32C_SLICES][CRC32C_TABLE_SIZE];
+static int crc32c_table_ready;
+
+/* Create the tables for slicing by 8: crc32c_table[0] is the classic byte at
+ * a time table, crc32c_table[k][n] is the crc of n followed by k zero u8s.
+ */
+static void huff_crc32c_init_table(void)
+{
+	u32 crc;
+	int n, k;
+
+	for (n = 0; n < CRC32C_TABLE_SIZE; n++) {
+		crc = n;
+		for (k = 0; k < BYTE; k++)
+			crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		crc32c_table[0][n] = crc;
+	}
+
+	for (n = 0; n < CRC32C_TABLE_SIZE; n++) {
+		crc = crc32c_table[0][n];
+		for (k = 1; k < CRC32C_SLICES; k++) {
+			crc = crc32c_table[0][crc & 0xFF] ^ (crc >> BYTE);
+			crc32c_table[k][n] = crc;
+		}
+	}
+
+	crc32c_table_ready = 1;
+}
+
+/* Table driven crc, 8 u8s per step. crc is the raw (non inverted) state. */
+static u32 huff_crc32c_sw(u32 crc, const u8 *buf, size_t len)
+{
+	u32 lo, hi;
+
+	if (!crc32c_table_ready)
+		huff_crc32c_init_table();
+
+	for (; len >= CRC32C_SLICES; len -= CRC32C_SLICES, buf += CRC32C_SLICES) {
+		lo = crc ^ ((u32)buf[0] | (u32)buf[1] << 8 |
+			(u32)buf[2] << 16 | (u32)buf[3] << 24);
+		hi = (u32)buf[4] | (u32)buf[5] << 8 | (u32)buf[6] << 16 |
+			(u32)buf[7] << 24;
+		crc = crc32c_table[7][lo & 0xFF] ^
+			crc32c_table[6][(lo >> 8) & 0xFF] ^
+			crc32c_table[5][(lo >> 16) & 0xFF] ^
+			crc32c_table[4][lo >> 24] ^
+			crc32c_table[3][hi & 0xFF] ^
+			crc32c_table[2][(hi >> 8) & 0xFF] ^
+			crc32c_table[1][(hi >> 16) & 0xFF] ^
+			crc32c_table[0][hi >> 24];
+	}
+
+	while (len--)
+		crc = crc32c_table[0][(crc ^ *buf++) & 0xFF] ^ (crc >> BYTE);
+
+	return crc;
+}
+
+#ifdef HUFF_CRC32C_HW
+/* SSE4.2 crc32 instruction, 8 u8s per instruction. */
+__attribute__((target("sse4.2")))
+static u32 huff_crc32c_hw(u32 crc, const u8 *buf, size_t len)
+{
+#ifdef __x86_64__
+	unsigned long long crc64 = crc, word;
+
+	for (; len >= sizeof(word); len -= sizeof(word), buf += sizeof(word)) {
+		__builtin_memcpy(&word, buf, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	crc = (u32)crc64;
+#endif
+
+	while (len--)
+		crc = _mm_crc32_u8((unsigned int)crc, *buf++);
+
+	return crc;
+}
+#endif
+
+/* Return the crc of buf[0..len) continuing from crc, the crc of the preceding
+ * data (0 if there is none). The SSE4.2 instruction is used at HUFF_CPU_SSE42
+ * and above, otherwise a table driven implementation.
+ */
+u32 huff_crc32c(u32 crc, const u8 *buf, size_t len)
+{
+#ifdef HUFF_CRC32C_HW
+	if (huff_cpu_level() >= HUFF_CPU_SSE42)
+		return huff_crc32c_hw(crc ^ CRC32C_MASK, buf, len) ^ CRC32C_MASK;
+#endif
+
+	return huff_crc32c_sw(crc ^ CRC32C_MASK, buf, len) ^ CRC32C_MASK;
+}
+
+static u32 huff_gf2_matrix_times(u32 *mat, u32 vec)
+{
+	u32 sum = 0;
+
+	for (; vec; vec >>= 1, mat++) {
+		if (vec & 1)
+			sum ^= *mat;
+	}
+
+	return sum;
+}
+
+static void huff_gf2_matrix_square(u32 *square, u32 *mat)
+{
+	int n;
+
+	for (n = 0; n < CRC32C_BITS; n++)
+		square[n] = huff_gf2_matrix_times(mat, mat[n]);
+}
+
+/* Return the crc of a followed by b, given crc1 the crc of a, crc2 the crc of
+ * b and len2 the length of b, without access to the data. Zeros are appended
+ * to a by repeatedly squaring the operator of a single zero bit.
+ */
+u32 huff_crc32c_combine(u32 crc1, u32 crc2, u64 len2)
+{
+	u32 even[CRC32C_BITS], odd[CRC32C_BITS], row = 1;
+	int n;
+
+	if (!len2)
+		return crc1;
+
+	/* the operator for one zero bit */
+	odd[0] = CRC32C_POLY;
+	for (n = 1; n < CRC32C_BITS; n++, row <<= 1)
+		odd[n] = row;
+
+	/* the operators for two and four zero bits */
+	huff_gf2_matrix_square(even, odd);
+	huff_gf2_matrix_square(odd, even);
+
+	/* apply len2 zero u8s to crc1 */
+	do {
+		huff_gf2_matrix_square(even, odd);
+		if (len2 & 1)
+			crc1 = huff_gf2_matrix_times(even, crc1);
+		len2 >>= 1;
+		if (!len2)
+			break;
+
+		huff_gf2_matrix_square(odd, even);
+		if (len2 & 1)
+			crc1 = huff_gf2_matrix_times(odd, crc1);
+		len2 >>= 1;
+	} while (len2);
+
+	return crc1 ^ crc2;
+}
+
@@ -0,0 +1,15 @@
+#ifndef _HUFFMAN_CRC_H_
+#define _HUFFMAN_CRC_H_
+
+#include <stddef.h>
+#include "huffman.h"
+
+/* CRC-32C (Castagnoli), as used by iSCSI and ext4. A crc of 0 is the crc of
+ * no data, and huff_crc32c(huff_crc32c(0, a), b) is the crc of a followed by
+ * b.
+ */
+u32 huff_crc32c(u32 crc, const u8 *buf, size_t len);
+u32 huff_crc32c_combine(u32 crc1, u32 crc2, u64 len2);
+
+#endif
+
@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "huffman.h"
+#include "huffman_io.h"
+#include "huffman_aio.h"
+#include "huffman_codec.h"
+#include "huffman_proto.h"
+
+#define DAEMON_OPTIONS "hS:w:b:c:"
+#define DAEMON_BACKLOG 64
+#define DAEMON_MAX_WORKERS 256
+#define DAEMON_NAME "request"
+
+static char *daemon_socket = HUFFMAN_DAEMON_SOCKET;
+static int daemon_workers;
+static pid_t daemon_pids[DAEMON_MAX_WORKERS];
+static volatile sig_atomic_t daemon_stop;
+
+static void daemon_signal(int sig)
+{
+	daemon_stop = 1;
+}
+
+/* Code the file in_fd into the file out_fd, encoding if op is
+ * HUFFMAN_REQUEST_ENCODE and decoding if it is HUFFMAN_REQUEST_DECODE, and
+ * fill reply in. Both file descriptors are closed.
+ */
+static void daemon_request(u8 op, int in_fd, int out_fd, huff_reply_t *reply)
+{
+	huff_reader_t *reader = NULL;
+	huff_writer_t *writer = NULL;
+	FILE *in = NULL, *out = NULL;
+	int ret = -1;
+
+	memset(reply, 0, sizeof(*reply));
+	reply->status = HUFFMAN_REPLY_FAIL;
+	huff_file_reset();
+
+	if (!(in = fdopen(in_fd, "rb")) || !(out = fdopen(out_fd, "wb")) ||
+		!(reader = huff_reader_attach(in)) ||
+		!(writer = huff_writer_attach(out))) {
+		goto Exit;
+	}
+
+	switch (op) {
+	case HUFFMAN_REQUEST_ENCODE:
+		ret = huff_encoder_compress(reader, writer, 0) ||
+			!uncompressed_file_length;
+		reply->in_length = uncompressed_file_length;
+		reply->out_length = file_stats.compressed_length;
+		break;
+	case HUFFMAN_REQUEST_DECODE:
+		ret = huff_decoder_blocks(reader, writer);
+		reply->in_length = huff_reader_tell(reader);
+		reply->out_length = uncompressed_file_length;
+		break;
+	}
+
+Exit:
+	/* a failed request may leave the tables of a block behind */
+	huff_block_release();
+
+	if (writer) {
+		ret |= huff_writer_close(writer);
+	} else {
+		out ? fclose(out) : close(out_fd);
+	}
+
+	if (reader) {
+		ret |= huff_reader_close(reader);
+	} else {
+		in ? fclose(in) : close(in_fd);
+	}
+
+	if (!ret)
+		reply->status = HUFFMAN_REPLY_OK;
+}
+
+/* Serve the requests of the connection sock until the client closes it. */
+static void daemon_serve(int sock)
+{
+	huff_reply_t reply;
+	int in_fd, out_fd;
+	u8 op;
+
+	while (!huff_proto_recv_request(sock, &op, &in_fd, &out_fd)) {
+		daemon_request(op, in_fd, out_fd, &reply);
+		if (huff_proto_send_reply(sock, &reply))
+			break;
+	}
+}
+
+/* The loop of a worker process: accept a connection and serve it. */
+static void daemon_worker(int listener)
+{
+	int sock;
+
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGPIPE, SIG_IGN);
+
+	for (;;) {
+		if ((sock = accept(listener, NULL, NULL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			exit(-1);
+		}
+
+		daemon_serve(sock);
+		close(sock);
+	}
+}
+
+/* Fork the worker of slot i.
+ * Return 0 if successful, otherwise -1.
+ */
+static int daemon_fork(int listener, int i)
+{
+	pid_t pid;
+
+	if ((pid = fork()) < 0)
+		return -1;
+
+	if (!pid)
+		daemon_worker(listener);
+
+	daemon_pids[i] = pid;
+	return 0;
+}
+
+/* Create the listening socket at daemon_socket, replacing a stale one.
+ * Return the socket if successful, otherwise -1.
+ */
+static int daemon_listen(void)
+{
+	struct sockaddr_un addr;
+	int listener;
+
+	if (strlen(daemon_socket) >= sizeof(addr.sun_path)) {
+		printf("%s: name too long\n", daemon_socket);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, daemon_socket);
+
+	if ((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+
+	unlink(daemon_socket);
+	if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) ||
+		listen(listener, DAEMON_BACKLOG)) {
+		printf("the socket %s can not be created\n", daemon_socket);
+		close(listener);
+		return -1;
+	}
+
+	return listener;
+}
+
+/* Run daemon_workers workers on the listening socket, replacing those that
+ * exit, until SIGTERM or SIGINT.
+ * Return 0 if successful, otherwise -1.
+ */
+static int daemon_run(void)
+{
+	struct sigaction action;
+	int listener, i, status;
+	pid_t pid;
+
+	if ((listener = daemon_listen()) < 0)
+		return -1;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = daemon_signal;
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+
+	for (i = 0; i < daemon_workers; i++) {
+		if (daemon_fork(listener, i))
+			daemon_stop = 1;
+	}
+	printf("huffmand: %i workers on %s\n", daemon_workers, daemon_socket);
+	fflush(stdout);
+
+	while (!daemon_stop) {
+		if ((pid = wait(&status)) < 0)
+			continue;
+
+		for (i = 0; i < daemon_workers; i++) {
+			if (daemon_pids[i] == pid) {
+				daemon_pids[i] = 0;
+				if (!daemon_stop && daemon_fork(listener, i))
+					daemon_stop = 1;
+			}
+		}
+	}
+
+	for (i = 0; i < daemon_workers; i++) {
+		if (daemon_pids[i])
+			kill(daemon_pids[i], SIGTERM);
+	}
+	while (wait(&status) > 0);
+
+	close(listener);
+	unlink(daemon_socket);
+	return 0;
+}
+
+static void daemon_usage(char *argv[])
+{
+	printf("Usage: %s [-S socket] [-w workers] [-b size] " \
+		"[-c codebook.huf]\n", argv[0]);
+	printf("       %s [-h]\n\n", argv[0]);
+	printf("  Where -S   the Unix domain socket to listen on (default " \
+		"%s)\n", HUFFMAN_DAEMON_SOCKET);
+	printf("        -w   number of worker processes (default: the " \
+		"number of cpus)\n");
+	printf("        -b   io buffer size of each request in bytes, a " \
+		"multiple of 4K\n");
+	printf("        -c   encode every request with the codebook of " \
+		"'codebook.huf',\n");
+	printf("             read once, see huffman --codebook\n");
+	printf("        -h   print this message and exit\n\n");
+	printf("Serves encode and decode requests of huffmanc, each worker " \
+		"a request at a time.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int option;
+
+	daemon_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	while ((option = getopt(argc, argv, DAEMON_OPTIONS)) != -1) {
+		switch (option) {
+		case 'S':
+			daemon_socket = optarg;
+			break;
+		case 'w':
+			daemon_workers = atoi(optarg);
+			break;
+		case 'b':
+			huffman_io_buf_size = strtoul(optarg, NULL, 0);
+			if (huffman_io_buf_size < HUFFMAN_IO_BUF_MIN ||
+				huffman_io_buf_size > HUFFMAN_IO_BUF_MAX ||
+				huffman_io_buf_size % HUFFMAN_IO_BUF_MIN) {
+				goto Error;
+			}
+			break;
+		case 'c':
+			huffman_codebook = optarg;
+			break;
+		case 'h':
+			daemon_usage(argv);
+			return 0;
+		default:
+			goto Error;
+		}
+	}
+
+	if (optind != argc || daemon_workers < 1 ||
+		daemon_workers > DAEMON_MAX_WORKERS) {
+		goto Error;
+	}
+
+	/* requests are small and served one at a time by each worker, a
+	 * ring or a thread per file would cost more than it saves */
+	huffman_aio_backend = HUFF_AIO_STDIO;
+	strcpy(compressed_file_name, DAEMON_NAME);
+	strcpy(uncompressed_file_name, DAEMON_NAME);
+
+	/* the workers inherit the codebook */
+	if (huffman_codebook) {
+		huffman_codebook_resident = 1;
+		if (huff_encoder_read_codebook())
+			return -1;
+	}
+
+	return daemon_run();
+
+Error:
+	printf("try `%s -h' for more information\n", argv[0]);
+	return -1;
+}
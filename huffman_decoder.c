@@ -1,5 +1,25 @@
+#include <string.h>
 #include "huffman.h"
 #include "huffman_io.h"
+#include "huffman_codec.h"
+#include "huffman_stats.h"
+#include "huffman_crc.h"
+#include "huffman_ans.h"
+#include "huffman_token.h"
+
+#define VARINT_MORE 0x80 /* 1000 0000 */
+#define HUFFMAN_TRAILER_MAX_LENGTH (1 + 10 + HUFFMAN_CRC_LENGTH) /* 'E', f.l */
+
+huff_decoder_engine_t huffman_decoder_engine = HUFF_DECODER_FSM;
+
+/* the file length type of the header being parsed */
+static u8 header_length_type;
+/* the character of a block with character set cardinality == 1 */
+static u8 single_character;
+/* set if the file was written before the block container */
+static int is_legacy;
+/* the data decoder of huffman_decode_codebook(), NULL otherwise */
+static huff_decompress_t codebook_decompress;
 
 static int huff_decoder_prologue(huff_reader_t **r_ptr, huff_writer_t **w_ptr)
 {
@@ -13,79 +33,121 @@ static int huff_decoder_prologue(huff_reader_t **r_ptr, huff_writer_t **w_ptr)
 
 static int huff_decoder_epilogue(huff_reader_t *reader, huff_writer_t *writer)
 {
-	int i;
-
 	if (huff_reader_close(reader) || huff_writer_close(writer))
 		return -1;
 
 	if (!huffman_keep_file)
 		remove(compressed_file_name);
 
-	if (huffman_print_tree)
-		huff_print_tree();
-
-	if (tree_root)
-		huff_delete_tree(tree_root);
-
-	if (!uncompressed_file_length || (character_set_cardinality == 1))
-		return 0;
-
-	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
-		if (dictionary[i])
-			bit_stack_free(dictionary[i]);
-	}
-
 	return 0;
 }
 
 static int huff_decoder_read_file_length(huff_reader_t *reader)
 {
-	u8 length_type;
+	u8 length_type, u8_length;
+	u16 u16_length;
+	u32 u32_length;
 
-	huff_read_u8(reader, &length_type);
+	if (huff_read_u8(reader, &length_type))
+		return -1;
 
+	header_length_type = length_type;
 	switch (length_type) {
 	case (FILE_LENGTH_REPRESENTATION_U8):
-		huff_read_u8(reader, (u8*)&uncompressed_file_length);
+		if (huff_read_u8(reader, &u8_length))
+			return -1;
+		block_length = u8_length;
 
 		/* statistics */
-		compressed_file_length += 2 * BYTE;
+		file_stats.compressed_length += 2 * BYTE;
 		break;
 	case (FILE_LENGTH_REPRESENTATION_U16):
-		huff_read_u16(reader, (u16*)&uncompressed_file_length);
+		if (huff_read_u16(reader, &u16_length))
+			return -1;
+		block_length = u16_length;
 
 		/* statistics */
-		compressed_file_length += 3 * BYTE;
+		file_stats.compressed_length += 3 * BYTE;
 		break;
 	case (FILE_LENGTH_REPRESENTATION_U32):
-		huff_read_u32(reader, &uncompressed_file_length);
+		if (huff_read_u32(reader, &u32_length))
+			return -1;
+		block_length = u32_length;
 
 		/* statistics */
-		compressed_file_length += 5 * BYTE;
+		file_stats.compressed_length += 5 * BYTE;
+		break;
+	case (FILE_LENGTH_REPRESENTATION_VARINT):
+		if (huff_read_varint(reader, &block_length))
+			return -1;
+
+		/* statistics */
+		file_stats.compressed_length +=
+			(1 + huff_varint_length(block_length)) *
+			BYTE;
 		break;
 	default:
 		return -1;
 	}
 
+	/* a single stream file is a single block of any length */
+	if (!block_length || (!is_legacy && block_length > HUFFMAN_BLOCK_SIZE))
+		return -1;
+
 	return 0;
 }
 
+/* Read a field of the header's character table into *field. Headers with a
+ * variable length integer file length have varint fields, older headers have
+ * u8 fields.
+ * Return 0 if successful and the field is not greater than max, otherwise -1.
+ */
+static int huff_decoder_read_field(huff_reader_t *reader, u64 *field, u64 max)
+{
+	u8 ch;
+
+	if (header_length_type == FILE_LENGTH_REPRESENTATION_VARINT) {
+		if (huff_read_varint(reader, field))
+			return -1;
+
+		/* statistics */
+		file_stats.compressed_length +=
+			huff_varint_length(*field) * BYTE;
+	} else {
+		if (huff_read_u8(reader, &ch))
+			return -1;
+		*field = ch;
+
+		/* statistics */
+		file_stats.compressed_length += BYTE;
+	}
+
+	return *field <= max ? 0 : -1;
+}
+
 static int huff_decoder_read_char_set_cardinality(huff_reader_t *reader)
 {
-	/* statistics */
-	compressed_file_length += BYTE;
+	u64 cardinality;
 
-	return huff_read_u8(reader, &character_set_cardinality);
+	if (huff_decoder_read_field(reader, &cardinality,
+		ANSI_CHAR_SET_CARDINALITY) || !cardinality) {
+		return -1;
+	}
+
+	character_set_cardinality = (u8)cardinality;
+	return 0;
 }
 
 static int huff_decoder_create_dictionary_entry(huff_reader_t *reader)
 {
-	u8 character, rep_length;
+	u64 character, rep_length;
 	bit_t *stack = NULL;
 	int i;
 
-	if (huff_read_u8(reader, &character) ||
-		huff_read_u8(reader, &rep_length) ||
+	if (huff_decoder_read_field(reader, &character,
+		ANSI_CHAR_SET_CARDINALITY - 1) ||
+		huff_decoder_read_field(reader, &rep_length,
+		ANSI_CHAR_SET_CARDINALITY - 1) ||
 		!(stack = bit_stack_alloc((int)rep_length + 1))) {
 		return -1;
 	}
@@ -98,13 +160,13 @@ static int huff_decoder_create_dictionary_entry(huff_reader_t *reader)
 	dictionary[character] = stack;
 
 	/* statisics */
-	compressed_file_length += 2 * BYTE + rep_length;
-	representation_length[character] = rep_length;
+	file_stats.compressed_length += rep_length;
+	representation_length[character] = (u8)rep_length;
 
 	return 0;
 }
 
-static int huff_decoder_parse_header(huff_reader_t *reader,
+int huff_decoder_parse_header(huff_reader_t *reader,
 		huff_writer_t *writer)
 {
 	int i;
@@ -122,8 +184,13 @@ static int huff_decoder_parse_header(huff_reader_t *reader,
 	/* no dictionary is created for a huffman file with character set 
 	 * cardinality == 1 */
 	if (character_set_cardinality == 1) {
+		if (huff_read_u8(reader, &single_character) ||
+			single_character >= ANSI_CHAR_SET_CARDINALITY) {
+			return -1;
+		}
+
 		/* statistics */
-		header_length = compressed_file_length + BYTE;
+		file_stats.compressed_length += BYTE;
 
 		return 0;
 	}
@@ -134,9 +201,6 @@ static int huff_decoder_parse_header(huff_reader_t *reader,
 			return -1;
 	}
 
-	/* statisics */
-	header_length = compressed_file_length;
-
 	return 0;
 }
 
@@ -164,8 +228,28 @@ static int huff_decoder_insert_node(u8 character, bit_t *stack)
 	return 0;
 }
 
+/* Count the leaves of the tree rooted at node.
+ * Return -1 if an internal node is missing a son, so that a corrupted
+ * dictionary can not lead the decompression off the tree.
+ */
+static int huff_decoder_count_leaves(huff_tree_node_t *node)
+{
+	int left, right;
+
+	if (HUFF_NODE_ISLEAF(node))
+		return 1;
+
+	if (!HUFF_NODE_LSON(node) || !HUFF_NODE_RSON(node))
+		return -1;
+
+	left = huff_decoder_count_leaves(HUFF_NODE_LSON(node));
+	right = huff_decoder_count_leaves(HUFF_NODE_RSON(node));
+
+	return (left < 0 || right < 0) ? -1 : left + right;
+}
+
 /* creating a huffman tree based on the dictionary in the header */
-static int huff_decoder_creat_tree(void)
+int huff_decoder_creat_tree(void)
 {
 	u8 ch;
 
@@ -182,34 +266,31 @@ static int huff_decoder_creat_tree(void)
 		}
 	}
 
+	/* every character must have its own leaf */
+	if (huff_decoder_count_leaves(tree_root) != character_set_cardinality)
+		return -1;
+
 	return 0;
 }
 
-/* decoding the huffman file */
-static int huff_decoder_decompress(huff_reader_t *reader, huff_writer_t *writer)
+/* decoding the huffman file, the characters decoded stored through a byte
+ * sink, and a block of a single character expanded with memset()
+ */
+int huff_decoder_decompress(huff_reader_t *reader, huff_writer_t *writer)
 {
-	u32 file_size;
+	u64 file_size;
 	huff_tree_node_t *node = NULL;
+	huff_sink_t sink;
 	bit_t bit;
-	u8 character;
 
+	ASSERT(huff_sink_begin(&sink, writer));
 	switch (character_set_cardinality) {
 	case 1:
-		if (huff_read_u8(reader, &character))
+		if (huff_sink_fill(&sink, single_character, block_length))
 			return -1;
-
-		for (file_size = 0; file_size < uncompressed_file_length;
-			file_size++) {
-			if (huff_write_u8(writer, character))
-				return -1;
-		}
-
-		/* statisics */
-		compressed_file_length += BYTE;
-		frequency[character] = uncompressed_file_length;
 		break;
 	default:
-		for (file_size = 0; file_size < uncompressed_file_length;
+		for (file_size = 0; file_size < block_length;
 			file_size++) {
 			node = tree_root;
 			do {
@@ -218,43 +299,752 @@ static int huff_decoder_decompress(huff_reader_t *reader, huff_writer_t *writer)
 
 				node = (bit == ZERO) ? HUFF_NODE_LSON(node) :
 					HUFF_NODE_RSON(node);
-
-				/* statistics */
-				compressed_file_length++;
 			} while (!HUFF_NODE_ISLEAF(node));
 
-			if (huff_write_u8(writer, node->character))
+			if (HUFF_SINK_PUT(&sink, node->character))
 				return -1;
+		}
+		break;
+	}
+
+	return huff_sink_end(&sink);
+}
+
+/* Position reader at the header of the first huffman block of the file it
+ * reads, skipping stored blocks. Ans blocks do not record the length of their
+ * data, so a file whose first coded block is an ans block has no codebook
+ * found. Files written before the block container
+ * have a single header at their beginning. Used for reading the codebook of a
+ * file, see huffman_gen and huff_encoder_read_codebook().
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_decoder_find_header(huff_reader_t *reader)
+{
+	u64 length;
+	u8 type;
+
+	if (huff_read_u8(reader, &type))
+		return -1;
+
+	is_legacy = type != HUFFMAN_CONTAINER;
+	if (is_legacy)
+		return huff_reader_reset(reader) ? -1 : 0;
+
+	while (!huff_read_u8(reader, &type)) {
+		switch (type) {
+		case HUFFMAN_BLOCK_HUFFMAN:
+			return 0;
+		case HUFFMAN_BLOCK_STORED:
+			if (huff_read_varint(reader, &length) ||
+				huff_reader_seek(reader, huff_reader_tell(
+				reader) + length + HUFFMAN_CRC_LENGTH)) {
+				return -1;
+			}
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	return -1;
+}
+
+/* Number the internal nodes of the tree rooted at node from n on, in pre
+ * order, and keep them in states. The decoder's nodes have no frequency, so
+ * the frequency of an internal node is used for its state number.
+ * Return the number following the last state numbered.
+ */
+int huff_decoder_number_states(huff_tree_node_t *node,
+	huff_tree_node_t **states, int n)
+{
+	if (HUFF_NODE_ISLEAF(node))
+		return n;
 
-			/* statistics */
-			frequency[node->character]++;
+	HUFF_NODE_FREQ(node) = n;
+	states[n++] = node;
+	n = huff_decoder_number_states(HUFF_NODE_LSON(node), states, n);
+	return huff_decoder_number_states(HUFF_NODE_RSON(node), states, n);
+}
+
+/* Fill the transitions of the num states: for every state and every input
+ * u8, walk the tree from the state along the bits of the u8, most significant
+ * first as huff_write_bit() stores them, restarting at the root after every
+ * leaf.
+ */
+void huff_decoder_fsm_build(huff_fsm_entry_t *table,
+	huff_tree_node_t **states, int num)
+{
+	huff_tree_node_t *node = NULL;
+	huff_fsm_entry_t *entry = table;
+	int state, input, i;
+
+	for (state = 0; state < num; state++) {
+		for (input = 0; input < HUFF_FSM_INPUTS; input++, entry++) {
+			node = states[state];
+			for (i = BYTE - 1; i >= 0; i--) {
+				node = ((input >> i) & 1) ?
+					HUFF_NODE_RSON(node) :
+					HUFF_NODE_LSON(node);
+				if (HUFF_NODE_ISLEAF(node)) {
+					entry->character[entry->count++] =
+						HUFF_NODE_CHAR(node);
+					node = tree_root;
+				}
+			}
+			entry->next = (u8)HUFF_NODE_FREQ(node);
+		}
+	}
+}
+
+/* Decode the huffman file a u8 at a time: a finite state machine whose states
+ * are the internal nodes of the tree is built, holding for every state and
+ * input u8 the characters decoded and the next state. The tree is walked a bit
+ * at a time only up to the first u8 boundary of the data, which follows the
+ * header's bits.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_decoder_decompress_fsm(huff_reader_t *reader, huff_writer_t *writer)
+{
+	huff_tree_node_t *states[ANSI_CHAR_SET_CARDINALITY];
+	huff_tree_node_t *node = tree_root;
+	huff_fsm_entry_t *table = NULL, *entry;
+	huff_sink_t sink;
+	u64 decoded = 0;
+	int num, state, count;
+	bit_t bit;
+	u8 input;
+
+	if (character_set_cardinality == 1)
+		return huff_decoder_decompress(reader, writer);
+
+	num = huff_decoder_number_states(tree_root, states, 0);
+	if (!(table = huff_calloc(num * HUFF_FSM_INPUTS,
+		sizeof(huff_fsm_entry_t)))) {
+		return -1;
+	}
+	huff_decoder_fsm_build(table, states, num);
+
+	if (huff_sink_begin(&sink, writer))
+		goto Error;
+
+	while (reader->minor_offset && decoded < block_length) {
+		if (huff_read_bit(reader, &bit))
+			goto Error;
+
+		node = (bit == ZERO) ? HUFF_NODE_LSON(node) :
+			HUFF_NODE_RSON(node);
+		if (!HUFF_NODE_ISLEAF(node))
+			continue;
+
+		if (HUFF_SINK_PUT(&sink, HUFF_NODE_CHAR(node)))
+			goto Error;
+
+		decoded++;
+		node = tree_root;
+	}
+
+	state = (int)HUFF_NODE_FREQ(node);
+	while (decoded < block_length) {
+		if (huff_read_u8(reader, &input))
+			goto Error;
+
+		entry = table + state * HUFF_FSM_INPUTS + input;
+		count = entry->count;
+		if (count > block_length - decoded)
+			count = (int)(block_length - decoded);
+
+		/* all BYTE characters are copied where there is room, those past
+		 * count being overwritten by the next */
+		if (sink.end - sink.cur >= BYTE) {
+			memcpy(sink.cur, entry->character, BYTE);
+			sink.cur += count;
+		} else if (huff_sink_write(&sink, entry->character, count)) {
+			goto Error;
 		}
+
+		decoded += count;
+		state = entry->next;
+	}
+
+	if (huff_sink_end(&sink))
+		goto Error;
+
+	huff_free(table);
+	return 0;
+
+Error:
+	huff_free(table);
+	return -1;
+}
+
+/* Decode the block at the reader's position: its header, its tree and its
+ * data. The writer's crc is kept over the data into block_crc.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_decoder_block(huff_reader_t *reader, huff_writer_t *writer)
+{
+	u64 header_start = file_stats.compressed_length, coded;
+
+	huff_block_reset();
+
+	huff_stage_begin(HUFF_STAGE_HEADER);
+	ASSERT(huff_decoder_parse_header(reader, writer));
+	huff_stage_end(HUFF_STAGE_HEADER,
+		(file_stats.compressed_length - header_start) / BYTE);
+
+	huff_stage_begin(HUFF_STAGE_TREE);
+	if (huff_decoder_creat_tree()) {
+		printf("%s: corrupted dictionary in block %llu\n",
+			compressed_file_name, block_count);
+		return -1;
+	}
+	huff_stage_end(HUFF_STAGE_TREE, block_length);
+
+	huff_stage_begin(HUFF_STAGE_DATA);
+	huff_writer_crc_begin(writer);
+	huff_writer_count(writer, frequency);
+	if (codebook_decompress) {
+		ASSERT(codebook_decompress(reader, writer));
+	} else if (huffman_decoder_engine == HUFF_DECODER_FSM) {
+		ASSERT(huff_decoder_decompress_fsm(reader, writer));
+	} else {
+		ASSERT(huff_decoder_decompress(reader, writer));
+	}
+	block_crc = huff_writer_crc_end(writer);
+	huff_stage_end(HUFF_STAGE_DATA, block_length);
+
+	/* statistics */
+	coded = huff_block_coded_length(frequency);
+	file_stats.compressed_length += coded;
+	file_stats.coded_length += coded;
+
+	return 0;
+}
+
+/* Copy the stored block at the reader's position: its length followed by its
+ * characters, uncoded. The writer's crc is kept over the characters into
+ * block_crc.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_decoder_stored(huff_reader_t *reader, huff_writer_t *writer)
+{
+	int i;
+
+	huff_block_reset();
+
+	huff_stage_begin(HUFF_STAGE_HEADER);
+	if (huff_read_varint(reader, &block_length) || !block_length ||
+		block_length > HUFFMAN_BLOCK_SIZE) {
+		return -1;
+	}
+
+	/* statistics */
+	file_stats.compressed_length += huff_varint_length(block_length) * BYTE;
+	huff_stage_end(HUFF_STAGE_HEADER, huff_varint_length(block_length));
+
+	huff_stage_begin(HUFF_STAGE_DATA);
+	huff_writer_crc_begin(writer);
+	ASSERT(huff_io_copy(reader, writer, block_length, frequency));
+	block_crc = huff_writer_crc_end(writer);
+	huff_stage_end(HUFF_STAGE_DATA, block_length);
+
+	/* statistics */
+	file_stats.compressed_length += block_length * BYTE;
+	file_stats.coded_length += block_length * BYTE;
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++)
+		representation_length[i] = frequency[i] ? BYTE : 0;
+
+	return 0;
+}
+
+/* Decode a file written before the block container, from its start: a single
+ * header followed by the data, without checksums.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_decoder_legacy(huff_reader_t *reader, huff_writer_t *writer)
+{
+	if (huff_decoder_block(reader, writer))
+		return -1;
+
+	huff_block_account();
+	huff_block_release();
+
+	return 0;
+}
+
+/* Skip the block's padding, read the crc of its data and compare it with the
+ * crc of the data decoded.
+ * Return 0 if they match, otherwise -1.
+ */
+static int huff_decoder_check_block(huff_reader_t *reader)
+{
+	u32 crc;
+
+	/* statistics */
+	file_stats.compressed_length +=
+		(BYTE - file_stats.compressed_length % BYTE) % BYTE;
+	file_stats.compressed_length += HUFFMAN_CRC_LENGTH * BYTE;
+
+	huff_reader_align(reader);
+	if (huff_read_u32(reader, &crc))
+		return -1;
+
+	if (crc != block_crc) {
+		printf("%s: checksum mismatch in block %llu\n",
+			compressed_file_name, block_count);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Read the trailer and compare its file length and crc with those of the
+ * data decoded.
+ * Return 0 if they match, otherwise -1.
+ */
+static int huff_decoder_check_trailer(huff_reader_t *reader)
+{
+	u64 length;
+	u32 crc;
+
+	if (huff_read_varint(reader, &length) || huff_read_u32(reader, &crc))
+		return -1;
+
+	/* statistics */
+	file_stats.compressed_length +=
+		(huff_varint_length(length) + HUFFMAN_CRC_LENGTH) * BYTE;
+
+	if (length != uncompressed_file_length || crc != file_crc) {
+		printf("%s: checksum mismatch in trailer\n",
+			compressed_file_name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Decode the block referred to by the reference block at the reader's
+ * position, following its block type: the block at its distance before the
+ * reference, which is a huffman, stored or ans block. The reader is then
+ * positioned after the reference. The referred block is not counted in the
+ * statistics, its characters are represented by the reference.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_decoder_reference(huff_reader_t *reader, huff_writer_t *writer)
+{
+	u64 start = huff_reader_tell(reader) - 1, distance, resume;
+	u64 compressed = file_stats.compressed_length;
+	u64 coded = file_stats.coded_length;
+	int ret = -1;
+	u8 type;
+
+	if (huff_read_varint(reader, &distance) || !distance ||
+		distance > start) {
+		return -1;
+	}
+	resume = huff_reader_tell(reader);
+
+	ASSERT(huff_reader_seek(reader, start - distance));
+	ASSERT(huff_read_u8(reader, &type));
+	switch (type) {
+	case HUFFMAN_BLOCK_HUFFMAN:
+		ret = huff_decoder_block(reader, writer);
 		break;
+	case HUFFMAN_BLOCK_STORED:
+		ret = huff_decoder_stored(reader, writer);
+		break;
+	case HUFFMAN_BLOCK_ANS:
+		ret = huff_ans_decode(reader, writer);
+		break;
+	case HUFFMAN_BLOCK_TOKEN:
+		ret = huff_token_decode(reader, writer);
+		break;
+	}
+	if (ret || huff_decoder_check_block(reader)) {
+		printf("%s: invalid reference in block %llu\n",
+			compressed_file_name, block_count);
+		return -1;
+	}
+
+	/* statistics */
+	file_stats.compressed_length = compressed +
+		huff_varint_length(distance) * BYTE;
+	file_stats.coded_length = coded;
+	memset(representation_length, 0, sizeof(representation_length));
+
+	return huff_reader_seek(reader, resume);
+}
+
+/* Read the magic at the start of the file.
+ * Return 0 for a block container, 1 for a file written before it and -1
+ * otherwise. The reader is positioned after the magic of a container and at
+ * the start of an older file.
+ */
+static int huff_decoder_magic(huff_reader_t *reader)
+{
+	u8 type;
+
+	if (huff_read_u8(reader, &type))
+		return -1;
+
+	if (type == HUFFMAN_ARCHIVE) {
+		printf("%s: an archive, its members are extracted with -x\n",
+			compressed_file_name);
+		return -1;
 	}
 
+	is_legacy = type != HUFFMAN_CONTAINER;
+	if (is_legacy)
+		return huff_reader_reset(reader) ? -1 : 1;
+
 	/* statistics */
-	coded_length = compressed_file_length - header_length;
+	file_stats.compressed_length += BYTE;
+
 	return 0;
 }
 
-/* Encode the file text_file_name. */
+/* Locate the trailer of the container read by reader, which ends at end,
+ * without reading the blocks: its crc precedes end, the last u8 of the file
+ * length before it is the only one with VARINT_MORE clear and 'E' precedes
+ * the first. uncompressed_file_length and file_crc are set to those of the
+ * trailer and *offset to that of its 'E'.
+ * Return 0 if successful, otherwise -1, also if the file is not a container.
+ */
+int huff_decoder_find_trailer(huff_reader_t *reader, u64 end, u64 *offset)
+{
+	u8 buf[HUFFMAN_TRAILER_MAX_LENGTH];
+	u64 start, length;
+	u32 crc;
+	int i, n;
+
+	switch (huff_decoder_magic(reader)) {
+	case 0:
+		break;
+	case 1:
+		printf("%s: written before the block container\n",
+			compressed_file_name);
+		/* fall through */
+	default:
+		return -1;
+	}
+
+	start = end > HUFFMAN_TRAILER_MAX_LENGTH ?
+		end - HUFFMAN_TRAILER_MAX_LENGTH : 1;
+	n = (int)(end - start);
+	ASSERT(n < 2 + HUFFMAN_CRC_LENGTH || huff_reader_seek(reader, start));
+	for (i = 0; i < n; i++)
+		ASSERT(huff_read_u8(reader, buf + i));
+
+	i = n - HUFFMAN_CRC_LENGTH - 1;
+	if (buf[i] & VARINT_MORE)
+		goto Error;
+	while (i && (buf[i - 1] & VARINT_MORE))
+		i--;
+	if (!i || buf[i - 1] != HUFFMAN_BLOCK_END)
+		goto Error;
+
+	*offset = start + i - 1;
+	if (huff_reader_seek(reader, *offset + 1) ||
+		huff_read_varint(reader, &length) ||
+		huff_read_u32(reader, &crc) || huff_reader_tell(reader) != end) {
+		goto Error;
+	}
+
+	uncompressed_file_length = length;
+	file_crc = crc;
+	return 0;
+
+Error:
+	printf("%s: no trailer found\n", compressed_file_name);
+	return -1;
+}
+
+/* Decode the next block of the container and verify its checksum, or read and
+ * verify the trailer if the blocks have ended.
+ * Return 0 after a block, 1 after the trailer and -1 on failure.
+ */
+static int huff_decoder_next(huff_reader_t *reader, huff_writer_t *writer)
+{
+	u8 type;
+
+	if (huff_read_u8(reader, &type)) {
+		printf("%s: truncated\n", compressed_file_name);
+		return -1;
+	}
+
+	/* statistics */
+	file_stats.compressed_length += BYTE;
+
+	switch (type) {
+	case HUFFMAN_BLOCK_HUFFMAN:
+		if (huff_decoder_block(reader, writer) ||
+			huff_decoder_check_block(reader)) {
+			return -1;
+		}
+		break;
+	case HUFFMAN_BLOCK_STORED:
+		if (huff_decoder_stored(reader, writer) ||
+			huff_decoder_check_block(reader)) {
+			return -1;
+		}
+		break;
+	case HUFFMAN_BLOCK_ANS:
+		if (huff_ans_decode(reader, writer) ||
+			huff_decoder_check_block(reader)) {
+			return -1;
+		}
+		break;
+	case HUFFMAN_BLOCK_TOKEN:
+		if (huff_token_decode(reader, writer) ||
+			huff_decoder_check_block(reader)) {
+			return -1;
+		}
+		break;
+	case HUFFMAN_BLOCK_REF:
+		if (huff_decoder_reference(reader, writer))
+			return -1;
+		break;
+	case HUFFMAN_BLOCK_END:
+		return huff_decoder_check_trailer(reader) ? -1 : 1;
+	default:
+		printf("%s: unknown block type in block %llu\n",
+			compressed_file_name, block_count);
+		return -1;
+	}
+
+	file_crc = huff_crc32c_combine(file_crc, block_crc, block_length);
+	huff_block_account();
+	huff_block_release();
+
+	return 0;
+}
+
+/* Decode the block whose type is at offset, as located through the block
+ * index, and verify its checksum.
+ * Return 0 if successful, otherwise -1, also if the blocks end at offset.
+ */
+int huff_decoder_block_at(huff_reader_t *reader, huff_writer_t *writer,
+	u64 offset)
+{
+	if (huff_reader_seek(reader, offset))
+		return -1;
+
+	return huff_decoder_next(reader, writer) ? -1 : 0;
+}
+
+/* Decode the blocks of the container up to the end of blocks marker and
+ * verify the checksums. Files written before the block container are decoded
+ * as a single stream.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_decoder_blocks(huff_reader_t *reader, huff_writer_t *writer)
+{
+	int ret;
+
+	switch (huff_decoder_magic(reader)) {
+	case 0:
+		break;
+	case 1:
+		return huff_decoder_legacy(reader, writer);
+	default:
+		return -1;
+	}
+
+	while (!(ret = huff_decoder_next(reader, writer)));
+
+	return ret < 0 ? -1 : 0;
+}
+
+static void huff_decoder_statistics(void)
+{
+	file_stats.header_length = file_stats.compressed_length -
+		file_stats.coded_length;
+	file_stats.compressed_length =
+		((file_stats.compressed_length % BYTE) ? 1 : 0) +
+		(file_stats.compressed_length / BYTE);
+}
+
 /* Decode the file text_file_name.huf */
 int huffman_decode(void)
 {
 	huff_reader_t *reader = NULL;
 	huff_writer_t *writer = NULL;
 
+	huff_stage_begin(HUFF_STAGE_TOTAL);
 	ASSERT(huff_decoder_prologue(&reader, &writer));
-	ASSERT(huff_decoder_parse_header(reader, writer));
-	ASSERT(huff_decoder_creat_tree());
-	ASSERT(huff_decoder_decompress(reader, writer));
+	ASSERT(huff_decoder_blocks(reader, writer));
 	ASSERT(huff_decoder_epilogue(reader, writer));
+	huff_stage_end(HUFF_STAGE_TOTAL, uncompressed_file_length);
 
-	/* statistics */
-	compressed_file_length =
-		((compressed_file_length % BYTE) ? 1 : 0) +
-		(compressed_file_length / BYTE);
+	huff_decoder_statistics();
+	return 0;
+}
+
+/* Decode the file text_file_name.huf as huffman_decode() does, with the data
+ * of its huffman blocks decoded by decompress. Used by the decoders that
+ * huffman_gen generates for a fixed codebook.
+ * Return 0 if successful, otherwise -1.
+ */
+int huffman_decode_codebook(huff_decompress_t decompress)
+{
+	int ret;
+
+	codebook_decompress = decompress;
+	ret = huffman_decode();
+	codebook_decompress = NULL;
+
+	return ret;
+}
+
+/* Decode the file text_file_name.huf without writing the decoded data and
+ * verify its checksums. Neither file is created or removed.
+ * Return 0 if the file is intact, otherwise -1.
+ */
+int huffman_test(void)
+{
+	huff_reader_t *reader = NULL;
+	huff_writer_t *writer = NULL;
+
+	huff_stage_begin(HUFF_STAGE_TOTAL);
+	if (!(reader = huff_reader_open(compressed_file_name)) ||
+		!(writer = huff_writer_discard())) {
+		return -1;
+	}
 
+	if (huff_decoder_blocks(reader, writer)) {
+		huff_reader_close(reader);
+		huff_writer_close(writer);
+		printf("%s: FAILED\n", compressed_file_name);
+		return -1;
+	}
+
+	ASSERT(huff_reader_close(reader) || huff_writer_close(writer));
+	huff_stage_end(HUFF_STAGE_TOTAL, uncompressed_file_length);
+
+	huff_decoder_statistics();
+	/* the JSON statistics carry the result */
+	if (!huffman_stats_json) {
+		printf("%s: OK%s\n", compressed_file_name,
+			is_legacy ? " (no checksums)" : "");
+	}
 	return 0;
 }
 
+/* A decoder pulled by its caller through huff_decoder_read(). The file is
+ * decoded a block at a time into a memory writer, whose buffer is reused for
+ * every block, and the caller's reads are served from it: at most a block is
+ * held, and only once its checksum has been verified.
+ */
+struct huff_decoder_ctx_t {
+	huff_reader_t *reader;
+	huff_writer_t *block;	/* the block decoded */
+	size_t offset;		/* u8s of the block already read */
+	int state;		/* 0 in the blocks, 1 after the trailer, -1 failed */
+};
+
+/* set while a context is open */
+static int is_ctx_open;
+
+/* Open file_name for reading its decoded data with huff_decoder_read().
+ * The codec's state is global, so a single context is open at a time. A file
+ * written before the block container is decoded whole by the first read.
+ * Return the new context if successful, otherwise NULL, also while another
+ * context is open.
+ */
+huff_decoder_ctx_t *huff_decoder_open(const char *file_name)
+{
+	huff_decoder_ctx_t *ctx;
+
+	if (is_ctx_open || strlen(file_name) >= MAX_FILE_NAME_SIZE ||
+		!(ctx = huff_calloc(1, sizeof(*ctx)))) {
+		return NULL;
+	}
+	is_ctx_open = 1;
+
+	/* strcpy() may not copy a buffer onto itself */
+	if (file_name != compressed_file_name)
+		strcpy(compressed_file_name, file_name);
+	huff_file_reset();
+	is_legacy = 0;
+
+	if (!(ctx->reader = huff_reader_open(file_name)) ||
+		!(ctx->block = huff_writer_memory()) ||
+		huff_decoder_magic(ctx->reader) < 0) {
+		huff_decoder_close(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+/* Decode the next block of ctx into its memory writer.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_decoder_fill(huff_decoder_ctx_t *ctx)
+{
+	huff_writer_memory_clear(ctx->block);
+	ctx->offset = 0;
+
+	if (is_legacy) {
+		ctx->state = huff_decoder_legacy(ctx->reader, ctx->block) ?
+			-1 : 1;
+	} else {
+		ctx->state = huff_decoder_next(ctx->reader, ctx->block);
+	}
+
+	return ctx->state < 0 ? -1 : 0;
+}
+
+/* Read up to len decoded u8s of ctx's file into buf, decoding the blocks as
+ * they are needed.
+ * Return the number of u8s read, which is less than len only at the end of
+ * the file and 0 after it, or -1 if the file is corrupt or can not be read.
+ */
+ssize_t huff_decoder_read(huff_decoder_ctx_t *ctx, u8 *buf, size_t len)
+{
+	size_t done = 0, length, chunk;
+	u8 *data;
+
+	if (ctx->state < 0)
+		return -1;
+
+	while (done < len) {
+		data = huff_writer_memory_data(ctx->block, &length);
+		if (ctx->offset == length) {
+			if (ctx->state)
+				break;
+			if (huff_decoder_fill(ctx))
+				return -1;
+			continue;
+		}
+
+		chunk = length - ctx->offset;
+		if (chunk > len - done)
+			chunk = len - done;
+		memcpy(buf + done, data + ctx->offset, chunk);
+		ctx->offset += chunk;
+		done += chunk;
+	}
+
+	return (ssize_t)done;
+}
+
+/* Close the file of ctx and delete ctx.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_decoder_close(huff_decoder_ctx_t *ctx)
+{
+	int ret = 0;
+
+	huff_block_release();
+	is_ctx_open = 0;
+
+	if (ctx->block)
+		ret |= huff_writer_close(ctx->block);
+	if (ctx->reader)
+		ret |= huff_reader_close(ctx->reader);
+	huff_free(ctx);
+
+	return ret ? -1 : 0;
+}
+
@@ -0,0 +1,134 @@
+#include <string.h>
+#include "huffman_dedup.h"
+#include "huffman_stats.h"
+
+#define HUFF_DEDUP_GEAR_SEED 0x9E3779B97F4A7C15ULL
+#define HUFF_DEDUP_FNV_BASIS 0xCBF29CE484222325ULL
+#define HUFF_DEDUP_FNV_PRIME 0x100000001B3ULL
+#define HUFF_DEDUP_TABLE_SIZE 1024 /* initial number of slots, a power of 2 */
+
+/* a chunk written, at the offset of its block */
+typedef struct huff_dedup_entry_t {
+	huff_chunk_t chunk;
+	u64 offset;	/* 0 for an empty slot */
+} huff_dedup_entry_t;
+
+static u64 gear[1 << BYTE];
+static int is_gear;
+
+/* an open addressing hash table of the chunks written, keyed by their hash */
+static huff_dedup_entry_t *table;
+static u64 table_size;
+static u64 table_count;
+
+/* Fill the gear table with a fixed sequence of random values (splitmix64),
+ * so that the chunk boundaries of a file do not change between runs.
+ */
+static void huff_dedup_gear_init(void)
+{
+	u64 x = 0, z;
+	int i;
+
+	for (i = 0; i < (1 << BYTE); i++) {
+		z = (x += HUFF_DEDUP_GEAR_SEED);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		gear[i] = z ^ (z >> 31);
+	}
+	is_gear = 1;
+}
+
+/* Read the next chunk from the reader's position, counting its characters in
+ * frequency, and fingerprint it into chunk.
+ * Return 1 if there are no more characters, 0 if a chunk was read.
+ */
+int huff_dedup_chunk(huff_reader_t *reader, huff_chunk_t *chunk)
+{
+	u64 hash = 0, fnv = HUFF_DEDUP_FNV_BASIS, length = 0;
+	u64 mask = (1ULL << HUFF_DEDUP_MASK_BITS) - 1;
+	u8 ch;
+
+	if (!is_gear)
+		huff_dedup_gear_init();
+
+	huff_reader_crc_begin(reader);
+	while (length < HUFF_DEDUP_MAX_CHUNK && !huff_read_u8(reader, &ch)) {
+		frequency[ch & (ANSI_CHAR_SET_CARDINALITY - 1)]++;
+		fnv = (fnv ^ ch) * HUFF_DEDUP_FNV_PRIME;
+		hash = (hash << 1) + gear[ch];
+		length++;
+
+		if (length >= HUFF_DEDUP_MIN_CHUNK && !(hash & mask))
+			break;
+	}
+	chunk->crc = huff_reader_crc_end(reader);
+	chunk->hash = fnv;
+	chunk->length = length;
+
+	return length ? 0 : 1;
+}
+
+static huff_dedup_entry_t *huff_dedup_slot(huff_dedup_entry_t *slots,
+	u64 size, huff_chunk_t *chunk)
+{
+	u64 i = chunk->hash & (size - 1);
+
+	while (slots[i].offset && (slots[i].chunk.hash != chunk->hash ||
+		slots[i].chunk.crc != chunk->crc ||
+		slots[i].chunk.length != chunk->length)) {
+		i = (i + 1) & (size - 1);
+	}
+
+	return slots + i;
+}
+
+/* Return the offset of the block holding a chunk with chunk's fingerprint,
+ * or 0 if no such chunk was written.
+ */
+u64 huff_dedup_find(huff_chunk_t *chunk)
+{
+	return table ? huff_dedup_slot(table, table_size, chunk)->offset : 0;
+}
+
+/* Record that chunk was written as the block at offset, growing the table
+ * to keep it at most half full.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_dedup_insert(huff_chunk_t *chunk, u64 offset)
+{
+	huff_dedup_entry_t *grown, *slot;
+	u64 size, i;
+
+	if (2 * (table_count + 1) > table_size) {
+		size = table_size ? 2 * table_size : HUFF_DEDUP_TABLE_SIZE;
+		if (!(grown = huff_calloc(size, sizeof(huff_dedup_entry_t))))
+			return -1;
+
+		for (i = 0; i < table_size; i++) {
+			if (table[i].offset) {
+				*huff_dedup_slot(grown, size, &table[i].chunk) =
+					table[i];
+			}
+		}
+		huff_free(table);
+		table = grown;
+		table_size = size;
+	}
+
+	slot = huff_dedup_slot(table, table_size, chunk);
+	if (!slot->offset)
+		table_count++;
+	slot->chunk = *chunk;
+	slot->offset = offset;
+
+	return 0;
+}
+
+/* Forget the chunks written. */
+void huff_dedup_free(void)
+{
+	huff_free(table);
+	table = NULL;
+	table_size = 0;
+	table_count = 0;
+}
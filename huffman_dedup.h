@@ -0,0 +1,30 @@
+#ifndef _HUFFMAN_DEDUP_H_
+#define _HUFFMAN_DEDUP_H_
+
+#include "huffman.h"
+#include "huffman_io.h"
+
+/* Content defined chunking: a chunk ends where the gear hash of the
+ * characters preceding it has its low HUFF_DEDUP_MASK_BITS bits clear, but
+ * not before HUFF_DEDUP_MIN_CHUNK characters and not after
+ * HUFF_DEDUP_MAX_CHUNK. Inserting or removing characters moves the boundaries
+ * near the edit only, so that the chunks of shared regions are identical.
+ */
+#define HUFF_DEDUP_MIN_CHUNK (1UL << 13) /* 8KiB */
+#define HUFF_DEDUP_MASK_BITS 15 /* 32KiB average */
+#define HUFF_DEDUP_MAX_CHUNK (1UL << 17) /* 128KiB */
+
+/* the fingerprint of a chunk */
+typedef struct huff_chunk_t {
+	u64 hash;	/* 64 bit FNV-1a */
+	u32 crc;	/* crc32c */
+	u64 length;
+} huff_chunk_t;
+
+int huff_dedup_chunk(huff_reader_t *reader, huff_chunk_t *chunk);
+u64 huff_dedup_find(huff_chunk_t *chunk);
+int huff_dedup_insert(huff_chunk_t *chunk, u64 offset);
+void huff_dedup_free(void);
+
+#endif
+
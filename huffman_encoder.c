@@ -1,9 +1,29 @@
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "huffman.h"
 #include "huffman_io.h"
+#include "huffman_codec.h"
+#include "huffman_stats.h"
+#include "huffman_crc.h"
+#include "huffman_ans.h"
+#include "huffman_token.h"
+#include "huffman_dedup.h"
+#include "huffman_index.h"
+#include "huffman_pack.h"
 
 static int tree_height;
 
+/* fast mode: the character counts of the windows sampled across the file,
+ * their total and the length of the file */
+static u64 sample_frequency[ANSI_CHAR_SET_CARDINALITY];
+static u64 sample_length;
+static u64 sample_file_length;
+
+/* fixed codebook mode: the representations read from huffman_codebook */
+static bit_t *codebook[ANSI_CHAR_SET_CARDINALITY];
+static u8 codebook_cardinality;
+
 static int huff_encoder_prologue(huff_reader_t **r_ptr, huff_writer_t **w_ptr)
 {
 	if (!(*r_ptr = huff_reader_open(uncompressed_file_name)) ||
@@ -16,8 +36,6 @@ static int huff_encoder_prologue(huff_reader_t **r_ptr, huff_writer_t **w_ptr)
 
 static int huff_encoder_epilogue(huff_reader_t *reader, huff_writer_t *writer)
 {
-	int i;
-
 	if (huff_reader_close(reader) || huff_writer_close(writer))
 		return -1;
 
@@ -32,37 +50,23 @@ static int huff_encoder_epilogue(huff_reader_t *reader, huff_writer_t *writer)
 	if (!huffman_keep_file)
 		remove(uncompressed_file_name);
 
-	if (huffman_print_tree)
-		huff_print_tree();
-
-	if (tree_root)
-		huff_delete_tree(tree_root);
-
-	if (!uncompressed_file_length || (character_set_cardinality == 1))
-		return 0;
-
-	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
-		if (dictionary[i])
-			bit_stack_free(dictionary[i]);
-	}
-
 	return 0;
 }
 
-/* Reads file_name and increases the character count in frequency for each
- * occurence of a character from the ANSI character set.
- * Return -1 if failed to open file_name for reading, if a character read does
- * not belong to the ANSI character set or if failed to close file_name.
+/* Reads up to huffman_block_size characters from the reader's position and
+ * increases the character count in frequency for each occurence of a
+ * character from the ANSI character set. The crc of the characters read is
+ * kept in block_crc.
+ * Return -1 if a character read does not belong to the ANSI character set.
  * Otherwise, return 0.
  */
-static int huff_encoder_parse(huff_reader_t *reader)
+int huff_encoder_parse(huff_reader_t *reader)
 {
 	u8 ch;
 
-	if (huff_reader_reset(reader) == HUFFMAN_EOF)
-		return -1;
-
-	while (!huff_read_u8(reader, &ch)) {
+	huff_reader_crc_begin(reader);
+	while (block_length < huffman_block_size &&
+		!huff_read_u8(reader, &ch)) {
 		if (ch >= ANSI_CHAR_SET_CARDINALITY) {
 			printf("non ANSI character in %s\n",
 				uncompressed_file_name);
@@ -72,8 +76,9 @@ static int huff_encoder_parse(huff_reader_t *reader)
 		if (!frequency[ch])
 			character_set_cardinality++;
 		frequency[ch]++;
-		uncompressed_file_length++;
+		block_length++;
 	}
+	block_crc = huff_reader_crc_end(reader);
 
 	return 0;
 }
@@ -117,12 +122,12 @@ static void huff_tree_insert_node(huff_tree_node_t *node)
  *   - Insert the new node into the remaining minimum priority queue.
  * Return 0 if successful, otherwise -1.
  */
-static int huff_encoder_create_tree(void)
+int huff_encoder_create_tree(void)
 {
 	huff_tree_node_t *node = NULL;
 	int ch;
 
-	if (!uncompressed_file_length || (character_set_cardinality == 1))
+	if (!block_length || (character_set_cardinality == 1))
 		return 0;
 
 	for (ch = 0; ch < ANSI_CHAR_SET_CARDINALITY; ch++) {
@@ -206,12 +211,12 @@ static int huff_encoder_dictionary_gen(huff_tree_node_t *node,
  * huff_encoder_dictionary_gen() is called to create the dictionary.
  * Return 0 if successful, otherwise -1.
  */
-static int huff_encoder_create_dictionary(void)
+int huff_encoder_create_dictionary(void)
 {
 	bit_t *stack = NULL;
 	int ret;
 
-	if (!uncompressed_file_length || (character_set_cardinality == 1))
+	if (!block_length || (character_set_cardinality == 1))
 		return 0;
 
 	if (!(stack = bit_stack_alloc(tree_height)))
@@ -222,36 +227,19 @@ static int huff_encoder_create_dictionary(void)
 	return ret;
 }
 
-/* Write the file length type and the file length into the file header.
+/* Write the file length type and the block length into the block header.
+ * The length is written as a variable length integer, so that blocks of any
+ * 64 bit length can be represented while short blocks get a short header.
  * Return 0 if successful, otherwise -1;
  */
 static int huff_encoder_write_file_length(huff_writer_t *writer)
 {
-	if (uncompressed_file_length < MAX_FILE_LENGTH_REPRESENTATION_U8) {
-		/* statistics */
-		compressed_file_length += 2 * BYTE;
-
-		return (huff_write_u8(writer, FILE_LENGTH_REPRESENTATION_U8) ||
-			huff_write_u8(writer, (u8)uncompressed_file_length));
-	}
-
-	if (uncompressed_file_length < MAX_FILE_LENGTH_REPRESENTATION_U16) {
-		/* statistics */
-		compressed_file_length += 3 * BYTE;
-
-		return (huff_write_u8(writer, FILE_LENGTH_REPRESENTATION_U16) ||
-			huff_write_u16(writer, (u16)uncompressed_file_length));
-	}
-
-	if (uncompressed_file_length < MAX_FILE_LENGTH_REPRESENTATION_U32) {
-		/* statistics */
-		compressed_file_length += 5 * BYTE;
-
-		return (huff_write_u8(writer, FILE_LENGTH_REPRESENTATION_U32) ||
-			huff_write_u32(writer, uncompressed_file_length));
-	}
+	/* statistics */
+	file_stats.compressed_length +=
+		(1 + huff_varint_length(block_length)) * BYTE;
 
-	return -1;
+	return (huff_write_u8(writer, FILE_LENGTH_REPRESENTATION_VARINT) ||
+		huff_write_varint(writer, block_length));
 }
 
 /* Writer the character set cardinality into the file header.
@@ -260,9 +248,21 @@ static int huff_encoder_write_file_length(huff_writer_t *writer)
 static int huff_encoder_write_character_set_cardinality(huff_writer_t *writer)
 {
 	/* statistics */
-	compressed_file_length += BYTE;
+	file_stats.compressed_length +=
+		huff_varint_length(character_set_cardinality) * BYTE;
+
+	return huff_write_varint(writer, character_set_cardinality);
+}
+
+/* Return the number of bits in the representation stack. */
+static int huff_encoder_stack_length(bit_t *stack)
+{
+	int stack_len = 0;
+
+	while (*stack++ != NO_BIT)
+		stack_len++;
 
-	return huff_write_u8(writer, character_set_cardinality);
+	return stack_len;
 }
 
 /* Write character representation
@@ -281,9 +281,6 @@ static int huff_encoder_write_dictionary_entry(huff_writer_t *writer,
 			return -1;
 
 		stack_ptr++;
-
-		/* statistics */
-		compressed_file_length++;
 	}
 
 	return 0;
@@ -295,24 +292,21 @@ static int huff_encoder_write_dictionary_entry(huff_writer_t *writer,
 static int huff_encoder_write_character_representation(huff_writer_t *writer,
 	u8 character, bit_t *stack)
 {
-	u8 stack_len = 0;
-	bit_t *stack_ptr = stack;
-
-	while (*stack_ptr++ != NO_BIT)
-		stack_len++;
+	u8 stack_len = (u8)huff_encoder_stack_length(stack);
 
 	/* writing character, representation length and representation
 	 * representation length and representation are written only if the
 	 * length is greater than 0
 	 */
-	if (huff_write_u8(writer, character) || (stack_len && 
-		(huff_write_u8(writer, stack_len) ||
+	if (huff_write_varint(writer, character) || (stack_len && 
+		(huff_write_varint(writer, stack_len) ||
 		 huff_encoder_write_dictionary_entry(writer, stack)))) {
 		return -1;
 	}
 
 	/* statstics */
-	compressed_file_length += 2 * BYTE;
+	file_stats.compressed_length += (huff_varint_length(character) +
+		huff_varint_length(stack_len)) * BYTE + stack_len;
 	representation_length[character] = stack_len;
 
 	return 0;
@@ -321,7 +315,7 @@ static int huff_encoder_write_character_representation(huff_writer_t *writer,
 /* Writer the header into the compressed file.
  * Return 0 if successful, otherwise -1.
  */
-static int huff_encoder_write_header(huff_writer_t *writer)
+int huff_encoder_write_header(huff_writer_t *writer)
 {
 	int i;
 
@@ -336,9 +330,9 @@ static int huff_encoder_write_header(huff_writer_t *writer)
 	/* if character_set_cardinality == 1 no dictionary is needed */
 	if (character_set_cardinality == 1) {
 		/* statstics */
-		compressed_file_length += BYTE;
+		file_stats.compressed_length += BYTE;
 
-		goto Exit;
+		return 0;
 	}
 
 	/* write character dictionary */
@@ -350,52 +344,735 @@ static int huff_encoder_write_header(huff_writer_t *writer)
 		}
 	}
 
-Exit:
+	return 0;
+}
+
+/* Write the block_length characters at the reader's position into the
+ * compressed file, their codes packed a span of the reader's buffer at a time
+ * (huffman_pack.h), or a bit at a time if a code is too long to be packed.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_encoder_write_data(huff_reader_t *reader, huff_writer_t *writer)
+{
+	huff_pack_t pack;
+	const u8 *buf;
+	size_t len;
+	u8 ch;
+	u64 i;
+
+	if (character_set_cardinality == 1)
+		return (huff_read_u8(reader, &ch) || huff_write_u8(writer, ch));
+
+	if (!huff_pack_init(&pack, dictionary)) {
+		for (i = block_length; i; i -= len) {
+			if (!(len = huff_read_span(reader, &buf, i)) ||
+				huff_pack_write(&pack, writer, buf, len)) {
+				return -1;
+			}
+		}
+		return huff_pack_flush(&pack, writer);
+	}
+
+	for (i = 0; i < block_length; i++) {
+		if (huff_read_u8(reader, &ch) ||
+			huff_encoder_write_dictionary_entry(writer,
+			dictionary[ch])) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Write the block_length characters at the reader's position into the
+ * compressed file, counting the occurences of every character in freq. Used
+ * where the dictionary was not created from the block's own frequencies.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_encoder_write_counted(huff_reader_t *reader,
+	huff_writer_t *writer, u64 *freq)
+{
+	int is_packed;
+	huff_pack_t pack;
+	const u8 *buf;
+	size_t len, j;
+	u64 i;
+
+	is_packed = !huff_pack_init(&pack, dictionary);
+	for (i = block_length; i; i -= len) {
+		if (!(len = huff_read_span(reader, &buf, i)))
+			return -1;
+
+		for (j = 0; j < len; j++) {
+			if (buf[j] >= ANSI_CHAR_SET_CARDINALITY) {
+				printf("non ANSI character in %s\n",
+					uncompressed_file_name);
+				return -1;
+			}
+
+			if (!dictionary[buf[j]]) {
+				printf("character %i of %s is not in the "
+					"codebook\n", buf[j],
+					uncompressed_file_name);
+				return -1;
+			}
+
+			freq[buf[j]]++;
+			if (!is_packed && huff_encoder_write_dictionary_entry(
+				writer, dictionary[buf[j]])) {
+				return -1;
+			}
+		}
+
+		if (is_packed && huff_pack_write(&pack, writer, buf, len))
+			return -1;
+	}
+
+	return is_packed ? huff_pack_flush(&pack, writer) : 0;
+}
+
+/* Return the number of bits the block would take as a huffman block: the
+ * block type, the header and the coded data, padded to a u8 boundary. The
+ * lengths are those huff_encoder_write_header() and huff_encoder_write_data()
+ * write, computed from the dictionary before either is called.
+ */
+static u64 huff_encoder_huffman_length(void)
+{
+	u64 bits = (2 + huff_varint_length(block_length) +
+		huff_varint_length(character_set_cardinality)) * BYTE;
+	int i, len;
+
+	if (character_set_cardinality == 1)
+		return bits + BYTE;
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		if (!dictionary[i])
+			continue;
+
+		len = huff_encoder_stack_length(dictionary[i]);
+		bits += (huff_varint_length(i) + huff_varint_length(len)) *
+			BYTE + len + frequency[i] * len;
+	}
+
+	return bits + (BYTE - bits % BYTE) % BYTE;
+}
+
+/* Return the number of bits the block would take as a stored block: the
+ * block type, the block length and the characters.
+ */
+static u64 huff_encoder_stored_length(void)
+{
+	return (1 + huff_varint_length(block_length) + block_length) * BYTE;
+}
+
+/* Write the block at block_start as a stored block, its characters copied
+ * uncoded. Used where coding would not make the block shorter, the character
+ * representation lengths are those of the characters as stored. If freq is
+ * not NULL, the characters are copied from the reader's position and counted
+ * in freq.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_encoder_write_stored(huff_reader_t *reader,
+	huff_writer_t *writer, u64 block_start, int is_estimate, u64 *freq)
+{
+	u64 header_start = file_stats.compressed_length;
+	int i;
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++)
+		representation_length[i] = BYTE;
+
+	huff_stage_begin(HUFF_STAGE_HEADER);
+	file_stats.compressed_length +=
+		(1 + huff_varint_length(block_length)) * BYTE;
+	ASSERT(huff_write_u8(writer, HUFFMAN_BLOCK_STORED));
+	ASSERT(huff_write_varint(writer, block_length));
+	huff_stage_end(HUFF_STAGE_HEADER,
+		(file_stats.compressed_length - header_start) / BYTE);
+
+	if (!is_estimate) {
+		huff_stage_begin(HUFF_STAGE_DATA);
+		if (!freq)
+			ASSERT(huff_reader_seek(reader, block_start));
+		ASSERT(huff_io_copy(reader, writer, block_length, freq));
+		huff_stage_end(HUFF_STAGE_DATA, block_length);
+	}
+	file_stats.compressed_length += block_length * BYTE;
+	file_stats.coded_length += block_length * BYTE;
+
+	return 0;
+}
+
+/* Write the container magic that precedes the blocks.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_encoder_write_container(huff_writer_t *writer)
+{
+	/* statistics */
+	file_stats.compressed_length += BYTE;
+
+	return huff_write_u8(writer, HUFFMAN_CONTAINER);
+}
+
+/* Pad the block to a u8 boundary and write the crc of its characters.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_encoder_write_block_crc(huff_writer_t *writer)
+{
+	/* statistics */
+	file_stats.compressed_length +=
+		(BYTE - file_stats.compressed_length % BYTE) % BYTE;
+	file_stats.compressed_length += HUFFMAN_CRC_LENGTH * BYTE;
+
+	return (huff_writer_align(writer) || huff_write_u32(writer, block_crc));
+}
+
+/* Write the end of blocks marker followed by the trailer: length and crc, the
+ * length and the crc of the whole file.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_encoder_write_trailer(huff_writer_t *writer, u64 length,
+	u32 crc)
+{
+	/* statistics */
+	file_stats.compressed_length += (1 + huff_varint_length(length) +
+		HUFFMAN_CRC_LENGTH) * BYTE;
+
+	return (huff_write_u8(writer, HUFFMAN_BLOCK_END) ||
+		huff_write_varint(writer, length) ||
+		huff_write_u32(writer, crc));
+}
+
+/* Write the block between block_start and block_end as a huffman block: its
+ * header, then the data, after seeking the reader back to block_start. If
+ * is_estimate is set, the data is not written and its length is computed from
+ * the frequencies instead. If freq is not NULL, the data is coded from the
+ * reader's position and its characters are counted in freq.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_encoder_write_huffman(huff_reader_t *reader,
+	huff_writer_t *writer, u64 block_start, u64 block_end, int is_estimate,
+	u64 *freq)
+{
+	u64 header_start, coded;
+
+	huff_stage_begin(HUFF_STAGE_HEADER);
+	header_start = file_stats.compressed_length;
+	file_stats.compressed_length += BYTE;
+	ASSERT(huff_write_u8(writer, HUFFMAN_BLOCK_HUFFMAN));
+	ASSERT(huff_encoder_write_header(writer));
+	huff_stage_end(HUFF_STAGE_HEADER,
+		(file_stats.compressed_length - header_start) / BYTE);
+
+	if (freq && !is_estimate) {
+		huff_stage_begin(HUFF_STAGE_DATA);
+		ASSERT(huff_encoder_write_counted(reader, writer, freq));
+		huff_stage_end(HUFF_STAGE_DATA, block_length);
+	} else if (!is_estimate) {
+		huff_stage_begin(HUFF_STAGE_DATA);
+		ASSERT(huff_reader_seek(reader, block_start));
+		ASSERT(huff_encoder_write_data(reader, writer));
+		huff_stage_end(HUFF_STAGE_DATA, block_length);
+
+		/* a single character block reads only one character */
+		if (huff_reader_tell(reader) != block_end)
+			ASSERT(huff_reader_seek(reader, block_end));
+	}
+
 	/* statistics */
-	header_length = compressed_file_length;
+	coded = huff_block_coded_length(freq && !is_estimate ? freq :
+		frequency);
+	file_stats.compressed_length += coded;
+	file_stats.coded_length += coded;
 
 	return 0;
 }
 
-/* Write the data into the compressed file.
+/* Return the number of bits the data of the block would take if coded with
+ * the huffman code of its own frequencies: the sum of the frequencies of the
+ * internal nodes of its huffman tree, which is computed without building the
+ * tree.
+ */
+static u64 huff_encoder_optimal_length(void)
+{
+	u64 weight[ANSI_CHAR_SET_CARDINALITY], bits = 0;
+	int i, a, b, n = 0;
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		if (frequency[i])
+			weight[n++] = frequency[i];
+	}
+
+	/* merge the two lightest weights until a single one is left */
+	while (n > 1) {
+		a = weight[0] <= weight[1] ? 0 : 1;
+		b = 1 - a;
+		for (i = 2; i < n; i++) {
+			if (weight[i] < weight[a]) {
+				b = a;
+				a = i;
+			} else if (weight[i] < weight[b]) {
+				b = i;
+			}
+		}
+
+		weight[a] += weight[b];
+		bits += weight[a];
+		weight[b] = weight[--n];
+	}
+
+	return bits;
+}
+
+/* Read characters from windows spread evenly across the file into
+ * sample_frequency: HUFFMAN_SAMPLE_WINDOWS windows of HUFFMAN_SAMPLE_WINDOW
+ * characters, or the whole file if it is not longer than that. Every
+ * character of the ANSI character set is then counted at least once, so that
+ * characters missing from the sample can still be coded. The reader is sought
+ * back to the beginning of the file.
  * Return 0 if successful, otherwise -1.
  */
-static int huff_encoder_write_data(huff_reader_t *reader, huff_writer_t *writer)
+static int huff_encoder_sample(huff_reader_t *reader)
 {
+	u64 window = HUFFMAN_SAMPLE_WINDOW, stride = 0, i;
+	int windows = HUFFMAN_SAMPLE_WINDOWS, w;
 	u8 ch;
-	int ret;
 
-	if (huff_reader_reset(reader))
+	if (huff_reader_length(reader, &sample_file_length)) {
+		printf("%s can not be sampled\n", uncompressed_file_name);
 		return -1;
+	}
 
-	if (character_set_cardinality == 1) {
-		/* statistics */
-		coded_length = 0;
+	if (sample_file_length <= window * windows) {
+		windows = 1;
+		window = sample_file_length;
+	} else {
+		stride = (sample_file_length - window) / (windows - 1);
+	}
 
-		return (huff_read_u8(reader, &ch) || huff_write_u8(writer, ch));
+	huff_stage_begin(HUFF_STAGE_PARSE);
+	for (w = 0; w < windows; w++) {
+		ASSERT(huff_reader_seek(reader, w * stride));
+		for (i = 0; i < window; i++) {
+			if (huff_read_u8(reader, &ch))
+				return -1;
+
+			if (ch >= ANSI_CHAR_SET_CARDINALITY) {
+				printf("non ANSI character in %s\n",
+					uncompressed_file_name);
+				return -1;
+			}
+			sample_frequency[ch]++;
+		}
 	}
+	sample_length = windows * window;
+	huff_stage_end(HUFF_STAGE_PARSE, sample_length);
 
-	while (!(ret = huff_read_u8(reader, &ch))) {
-		if (huff_encoder_write_dictionary_entry(writer, dictionary[ch]))
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		if (!sample_frequency[i]) {
+			sample_frequency[i] = 1;
+			sample_length++;
+		}
+	}
+
+	return huff_reader_seek(reader, 0);
+}
+
+/* Read the dictionary of the first huffman block of huffman_codebook into
+ * codebook, for coding every block with it, unless it is already read. The
+ * dictionary must be that of a full tree, as the decoder verifies.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_encoder_read_codebook(void)
+{
+	huff_reader_t *cb_reader = NULL;
+	u64 length = file_stats.compressed_length;
+	int ret, i;
+
+	if (codebook_cardinality)
+		return 0;
+
+	if (!(cb_reader = huff_reader_open(huffman_codebook)))
+		return -1;
+
+	ret = huff_decoder_find_header(cb_reader) ||
+		huff_decoder_parse_header(cb_reader, NULL) ||
+		character_set_cardinality == 1 || huff_decoder_creat_tree();
+	huff_reader_close(cb_reader);
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		codebook[i] = dictionary[i];
+		dictionary[i] = NULL;
+	}
+	codebook_cardinality = character_set_cardinality;
+	huff_block_release();
+
+	/* reading the codebook is not part of the compressed file */
+	file_stats.compressed_length = length;
+
+	if (ret) {
+		printf("%s: no huffman codebook found\n", huffman_codebook);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Free the codebook read by huff_encoder_read_codebook(). */
+static void huff_encoder_free_codebook(void)
+{
+	int i;
+
+	codebook_cardinality = 0;
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		if (codebook[i])
+			bit_stack_free(codebook[i]);
+		codebook[i] = NULL;
+	}
+}
+
+/* Set the block's dictionary to a copy of the codebook.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_encoder_codebook_dictionary(void)
+{
+	int i;
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		if (codebook[i] && !(dictionary[i] = bit_stack_clone(
+			codebook[i], huff_encoder_stack_length(codebook[i])))) {
 			return -1;
+		}
 	}
+	character_set_cardinality = codebook_cardinality;
 
-	/* statistics */
-	coded_length = compressed_file_length - header_length;
+	return 0;
+}
+
+/* Set the block's dictionary to that of sample_frequency scaled to the block
+ * length.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_encoder_sample_dictionary(void)
+{
+	int i;
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		frequency[i] = (u64)((double)sample_frequency[i] *
+			block_length / sample_length);
+		if (!frequency[i])
+			frequency[i] = 1;
+	}
+	character_set_cardinality = ANSI_CHAR_SET_CARDINALITY;
+
+	huff_stage_begin(HUFF_STAGE_TREE);
+	ASSERT(huff_encoder_create_tree());
+	huff_stage_end(HUFF_STAGE_TREE, block_length);
+
+	huff_stage_begin(HUFF_STAGE_DICTIONARY);
+	ASSERT(huff_encoder_create_dictionary());
+	huff_stage_end(HUFF_STAGE_DICTIONARY, block_length);
+
+	return 0;
+}
+
+/* Code the block of up to huffman_block_size characters at the reader's
+ * position in a single pass, with a dictionary that is not created from the
+ * block: the codebook if huffman_codebook is set, otherwise that of the
+ * sample. A block of the sample is written as a stored block if coding the
+ * sample would not make it shorter. The characters are counted while being
+ * written, so that the statistics are those of the block, and
+ * file_stats.exact_coded_length is increased by the length of the data coded
+ * with the block's own frequencies.
+ * Return 1 if there are no more characters, 0 if a block was coded and -1 on
+ * failure.
+ */
+static int huff_encoder_code_single_pass(huff_reader_t *reader,
+	huff_writer_t *writer)
+{
+	u64 block_start = huff_reader_tell(reader);
+	u64 freq[ANSI_CHAR_SET_CARDINALITY], optimal;
+
+	if (block_start >= sample_file_length)
+		return 1;
+
+	huff_block_reset();
+	block_length = sample_file_length - block_start;
+	if (block_length > huffman_block_size)
+		block_length = huffman_block_size;
+
+	if (huffman_codebook) {
+		ASSERT(huff_encoder_codebook_dictionary());
+	} else {
+		ASSERT(huff_encoder_sample_dictionary());
+	}
+
+	memset(freq, 0, sizeof(freq));
+	huff_reader_crc_begin(reader);
+	if (!huffman_codebook &&
+		huff_encoder_huffman_length() >= huff_encoder_stored_length()) {
+		ASSERT(huff_encoder_write_stored(reader, writer, block_start, 0,
+			freq));
+	} else {
+		ASSERT(huff_encoder_write_huffman(reader, writer, block_start,
+			0, 0, freq));
+	}
+	block_crc = huff_reader_crc_end(reader);
+
+	memcpy(frequency, freq, sizeof(frequency));
+	optimal = huff_encoder_optimal_length();
+	file_stats.exact_coded_length += optimal < block_length * BYTE ?
+		optimal : block_length * BYTE;
+
+	return 0;
+}
+
+/* Code the block of up to huffman_block_size characters at the reader's
+ * position. The block is parsed and its tree and dictionary are created. It
+ * is then written as a token block if huffman_tokens is set and that is
+ * HUFF_TOKEN_GAIN_PERCENT shorter than any other, as an ans block if that is
+ * HUFF_ANS_GAIN_PERCENT shorter, otherwise as a huffman block, or as a stored
+ * block if coding would not make it shorter.
+ * Return 1 if there are no more characters, 0 if a block was coded and -1 on
+ * failure.
+ */
+static int huff_encoder_code(huff_reader_t *reader, huff_writer_t *writer,
+	int is_estimate)
+{
+	u64 block_start = huff_reader_tell(reader);
+	u64 block_end, huffman_length, stored_length, ans_length, shortest;
+	u64 token_length = ~0ULL;
+	int ret;
+
+	huff_block_reset();
+
+	huff_stage_begin(HUFF_STAGE_PARSE);
+	ASSERT(huff_encoder_parse(reader));
+	huff_stage_end(HUFF_STAGE_PARSE, block_length);
+
+	if (!block_length)
+		return 1;
+	block_end = huff_reader_tell(reader);
+
+	huff_stage_begin(HUFF_STAGE_TREE);
+	ASSERT(huff_encoder_create_tree());
+	huff_stage_end(HUFF_STAGE_TREE, block_length);
+
+	huff_stage_begin(HUFF_STAGE_DICTIONARY);
+	ASSERT(huff_encoder_create_dictionary());
+	huff_stage_end(HUFF_STAGE_DICTIONARY, block_length);
+
+	huffman_length = huff_encoder_huffman_length();
+	stored_length = huff_encoder_stored_length();
+	ans_length = huff_ans_length();
+	shortest = huffman_length < stored_length ? huffman_length :
+		stored_length;
+
+	/* the block is read again, and kept, to be split into tokens */
+	if (huffman_tokens)
+		ASSERT(huff_token_length(reader, block_start, &token_length));
+
+	if (token_length < (ans_length < shortest ? ans_length : shortest) *
+		100 / (100 + HUFF_TOKEN_GAIN_PERCENT)) {
+		ret = huff_token_encode(writer, is_estimate);
+	} else if (ans_length < shortest * 100 /
+		(100 + HUFF_ANS_GAIN_PERCENT)) {
+		ret = (!is_estimate &&
+			huff_reader_seek(reader, block_start)) ||
+			huff_ans_encode(reader, writer, is_estimate);
+	} else if (huffman_length >= stored_length) {
+		ret = huff_encoder_write_stored(reader, writer, block_start,
+			is_estimate, NULL);
+	} else {
+		ret = huff_encoder_write_huffman(reader, writer, block_start,
+			block_end, is_estimate, NULL);
+	}
+	huff_token_free();
+
+	return ret ? -1 : 0;
+}
+
+/* Encode the block of up to huffman_block_size characters at the reader's
+ * position, from a sample of the file if huffman_sample is set, followed by
+ * its crc.
+ * Return 1 if there are no more characters, 0 if a block was encoded and -1
+ * on failure.
+ */
+static int huff_encoder_block(huff_reader_t *reader, huff_writer_t *writer,
+	int is_estimate)
+{
+	int ret = huffman_sample || huffman_codebook ?
+		huff_encoder_code_single_pass(reader, writer) :
+		huff_encoder_code(reader, writer, is_estimate);
+
+	if (ret)
+		return ret;
+
+	ASSERT(huff_encoder_write_block_crc(writer));
+
+	file_crc = huff_crc32c_combine(file_crc, block_crc, block_length);
+	huff_block_account();
+	huff_block_release();
 
 	return 0;
 }
 
-/* Write the compressed file.
+/* Write a reference to the block at offset, which holds the characters of
+ * chunk.
  * Return 0 if successful, otherwise -1.
  */
-static int huff_encoder_compress(huff_reader_t *reader, huff_writer_t *writer)
+static int huff_encoder_write_reference(huff_writer_t *writer, u64 offset,
+	huff_chunk_t *chunk)
 {
-	if (!uncompressed_file_length)
+	u64 distance = huff_writer_tell(writer) - offset;
+
+	block_length = chunk->length;
+	block_crc = chunk->crc;
+
+	/* statistics */
+	file_stats.compressed_length +=
+		(1 + huff_varint_length(distance)) * BYTE;
+
+	return (huff_write_u8(writer, HUFFMAN_BLOCK_REF) ||
+		huff_write_varint(writer, distance));
+}
+
+/* Encode the next content defined chunk at the reader's position as a block,
+ * or as a reference to the block of an identical chunk written earlier to
+ * the same file.
+ * Return 1 if there are no more characters, 0 if a block was encoded and -1
+ * on failure.
+ */
+static int huff_encoder_dedup_block(huff_reader_t *reader,
+	huff_writer_t *writer)
+{
+	u64 chunk_start = huff_reader_tell(reader), offset, block_size;
+	huff_chunk_t chunk;
+	int ret;
+
+	huff_block_reset();
+
+	huff_stage_begin(HUFF_STAGE_PARSE);
+	ret = huff_dedup_chunk(reader, &chunk);
+	huff_stage_end(HUFF_STAGE_PARSE, chunk.length);
+	if (ret)
+		return ret;
+
+	if ((offset = huff_dedup_find(&chunk))) {
+		ASSERT(huff_encoder_write_reference(writer, offset, &chunk));
+
+		file_crc = huff_crc32c_combine(file_crc, block_crc,
+			block_length);
+		huff_block_account();
 		return 0;
+	}
+
+	/* a block of the chunk's length, coded as any other */
+	offset = huff_writer_tell(writer);
+	block_size = huffman_block_size;
+	huffman_block_size = chunk.length;
+	ret = huff_reader_seek(reader, chunk_start) ||
+		huff_encoder_block(reader, writer, 0);
+	huffman_block_size = block_size;
 
-	return (huff_encoder_write_header(writer) ||
-		huff_encoder_write_data(reader, writer));
+	return ret ? -1 : huff_dedup_insert(&chunk, offset);
+}
+
+/* Write a block for every huffman_block_size characters of the uncompressed
+ * file, or for every content defined chunk if huffman_dedup is set, adding
+ * them to the block index, with offsets from base, if huffman_index is set.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_encoder_blocks(huff_reader_t *reader, huff_writer_t *writer,
+	u64 base, int is_estimate)
+{
+	u64 offset;
+	int ret;
+
+	if (huffman_sample)
+		ASSERT(huff_encoder_sample(reader));
+	if (huffman_codebook && (huff_encoder_read_codebook() ||
+		huff_reader_length(reader, &sample_file_length))) {
+		huff_encoder_free_codebook();
+		return -1;
+	}
+
+	do {
+		offset = huff_writer_tell(writer);
+		ret = huffman_dedup ? huff_encoder_dedup_block(reader, writer) :
+			huff_encoder_block(reader, writer, is_estimate);
+
+		/* the block's characters are still counted in frequency */
+		if (!ret && huffman_index &&
+			huff_index_add(offset - base, block_length, frequency)) {
+			ret = -1;
+		}
+	} while (!ret);
+	if (!huffman_codebook_resident)
+		huff_encoder_free_codebook();
+
+	return ret < 0 ? -1 : 0;
+}
+
+static void huff_encoder_statistics(void)
+{
+	file_stats.header_length = file_stats.compressed_length -
+		file_stats.coded_length;
+	file_stats.compressed_length =
+		((file_stats.compressed_length % BYTE) ? 1 : 0) +
+		(file_stats.compressed_length / BYTE);
+}
+
+/* Write the container: the magic, the blocks, the trailer and the block index
+ * if huffman_index is set.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_encoder_compress(huff_reader_t *reader, huff_writer_t *writer,
+	int is_estimate)
+{
+	u64 base = huff_writer_tell(writer);
+
+	ASSERT(huff_encoder_write_container(writer));
+	ASSERT(huff_encoder_blocks(reader, writer, base, is_estimate));
+	ASSERT(huff_encoder_write_trailer(writer, uncompressed_file_length,
+		file_crc));
+	if (huffman_index)
+		ASSERT(huff_index_write(writer, base));
+
+	huff_encoder_statistics();
+	return 0;
+}
+
+/* Compute the length the compressed file would have without coding the data
+ * or creating the compressed file. The headers are written to a discarding
+ * writer so that their lengths are those of a real encoding, the coded data
+ * length is derived from the frequencies and the representation lengths.
+ * Return 0 if successful, otherwise -1.
+ */
+int huffman_estimate(void)
+{
+	huff_reader_t *reader = NULL;
+	huff_writer_t *writer = NULL;
+
+	huff_stage_begin(HUFF_STAGE_TOTAL);
+	if (!(reader = huff_reader_open(uncompressed_file_name)) ||
+		!(writer = huff_writer_discard())) {
+		return -1;
+	}
+
+	ASSERT(huff_encoder_compress(reader, writer, 1));
+
+	if (huff_reader_close(reader) || huff_writer_close(writer))
+		return -1;
+
+	if (!uncompressed_file_length) {
+		printf ("it is not possible to compress a file of zero " \
+			"length\n");
+		return -1;
+	}
+	huff_stage_end(HUFF_STAGE_TOTAL, uncompressed_file_length);
+
+	return 0;
 }
 
 /* Encode the file text_file_name. */
@@ -403,19 +1080,316 @@ int huffman_encode(void)
 {
 	huff_reader_t *reader = NULL;
 	huff_writer_t *writer = NULL;
+	int ret;
 
+	huff_stage_begin(HUFF_STAGE_TOTAL);
 	ASSERT(huff_encoder_prologue(&reader, &writer));
-	ASSERT(huff_encoder_parse(reader));
-	ASSERT(huff_encoder_create_tree());
-	ASSERT(huff_encoder_create_dictionary());
-	ASSERT(huff_encoder_compress(reader, writer));
+	ret = huff_encoder_compress(reader, writer, 0);
+	huff_dedup_free();
+	huff_index_free();
+	ASSERT(ret);
 	ASSERT(huff_encoder_epilogue(reader, writer));
+	huff_stage_end(HUFF_STAGE_TOTAL, uncompressed_file_length);
 
-	/* statistics */
-	compressed_file_length =
-		((compressed_file_length % BYTE) ? 1 : 0) +
-		(compressed_file_length / BYTE);
+	return 0;
+}
+
+/* Read the tail of the container compressed_file_name that the blocks
+ * appended to it replace: the trailer and the block index, if the file has
+ * one, which is kept for extending with the blocks appended and sets
+ * huffman_index. The blocks are not read. uncompressed_file_length and
+ * file_crc are set to those of the trailer.
+ * Return the tail, setting *offset to that of its 'E' and *length to its
+ * length, if successful, otherwise NULL.
+ */
+static u8 *huff_encoder_read_tail(u64 *offset, u64 *length)
+{
+	huff_reader_t *reader = NULL;
+	u64 end, count, i;
+	u8 *tail = NULL;
+
+	if (!(reader = huff_reader_open(compressed_file_name)))
+		return NULL;
+
+	/* the trailer ends where the index starts */
+	if (huff_reader_length(reader, length))
+		goto Exit;
+	end = *length;
+	if (huff_index_read(reader, &count, &end))
+		huffman_index = 1;
+
+	if (huff_reader_reset(reader) ||
+		huff_decoder_find_trailer(reader, end, offset) ||
+		huff_reader_seek(reader, *offset)) {
+		goto Exit;
+	}
+
+	*length -= *offset;
+	if (!(tail = huff_calloc(*length, sizeof(u8))))
+		goto Exit;
+	for (i = 0; i < *length; i++) {
+		if (huff_read_u8(reader, tail + i)) {
+			huff_free(tail);
+			tail = NULL;
+			break;
+		}
+	}
+
+Exit:
+	huff_reader_close(reader);
+	return tail;
+}
+
+/* Write the tail read by huff_encoder_read_tail() back at offset and cut the
+ * file after it, undoing an append that failed.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_encoder_restore_tail(u8 *tail, u64 offset, u64 length)
+{
+	huff_writer_t *writer;
+	u64 i;
+
+	if (!(writer = huff_writer_open_at(compressed_file_name, offset)))
+		return -1;
+
+	for (i = 0; i < length; i++) {
+		if (huff_write_u8(writer, tail[i])) {
+			huff_writer_close(writer);
+			return -1;
+		}
+	}
+
+	if (huff_writer_close(writer) ||
+		truncate(compressed_file_name, (off_t)(offset + length))) {
+		return -1;
+	}
 
 	return 0;
 }
 
+/* Append the file uncompressed_file_name to the container
+ * compressed_file_name. Its blocks are written over the trailer, followed by
+ * the trailer of the whole file and, if the container has a block index, the
+ * index extended with them. The blocks already there are neither read nor
+ * rewritten, so that appending costs what encoding the file appended does.
+ * If appending fails, as on a character outside the ANSI character set, the
+ * tail replaced is written back. The statistics are those of the file
+ * appended.
+ * Return 0 if successful, otherwise -1.
+ */
+int huffman_append(void)
+{
+	huff_reader_t *reader = NULL;
+	huff_writer_t *writer = NULL;
+	u64 offset, length, total;
+	u8 *tail;
+	u32 crc;
+	int ret = -1;
+
+	huff_stage_begin(HUFF_STAGE_TOTAL);
+	if (!(tail = huff_encoder_read_tail(&offset, &length)))
+		goto Exit;
+
+	total = uncompressed_file_length;
+	crc = file_crc;
+	huff_file_reset();
+
+	if (!(reader = huff_reader_open(uncompressed_file_name)))
+		goto Exit;
+	if (!(writer = huff_writer_open_at(compressed_file_name, offset))) {
+		huff_reader_close(reader);
+		goto Exit;
+	}
+
+	ret = huff_encoder_blocks(reader, writer, 0, 0) ||
+		huff_encoder_write_trailer(writer,
+			total + uncompressed_file_length,
+			huff_crc32c_combine(crc, file_crc,
+				uncompressed_file_length)) ||
+		(huffman_index && huff_index_write(writer, 0));
+	huff_encoder_statistics();
+	if (huff_reader_close(reader))
+		ret = -1;
+	if (huff_writer_close(writer))
+		ret = -1;
+
+	if (ret && huff_encoder_restore_tail(tail, offset, length)) {
+		printf("%s: the trailer could not be restored\n",
+			compressed_file_name);
+	}
+
+Exit:
+	huff_dedup_free();
+	huff_index_free();
+	huff_free(tail);
+	ASSERT(ret);
+
+	if (!huffman_keep_file)
+		remove(uncompressed_file_name);
+	huff_stage_end(HUFF_STAGE_TOTAL, uncompressed_file_length);
+
+	return 0;
+}
+
+/* An encoder pushed by its producer through huff_encoder_feed(). The
+ * characters fed are buffered up to huffman_block_size and every full block is
+ * coded as huff_encoder_compress() codes it, reading the buffer through a
+ * memory stream, into a memory writer whose u8s are then handed to emit. At
+ * most a block of characters and its coding are held, and nothing is seeked
+ * but the buffer.
+ */
+struct huff_encoder_ctx_t {
+	huff_encoder_emit_t emit;
+	void *arg;		/* passed to emit */
+	u8 *block;		/* the characters of the block being fed */
+	size_t length;		/* u8s of block fed */
+	huff_writer_t *writer;	/* the coding not yet emitted */
+	int is_failed;
+};
+
+/* set while a context is open */
+static int is_ctx_open;
+
+/* Hand the u8s held by ctx's writer to its emit callback.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_encoder_emit(huff_encoder_ctx_t *ctx)
+{
+	size_t length;
+	u8 *data = huff_writer_memory_data(ctx->writer, &length);
+
+	if (length && ctx->emit(ctx->arg, data, length))
+		return -1;
+
+	huff_writer_memory_clear(ctx->writer);
+	return 0;
+}
+
+/* Code the characters buffered in ctx as a block and emit it.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_encoder_push_block(huff_encoder_ctx_t *ctx)
+{
+	huff_reader_t *reader;
+	FILE *fd;
+	int ret;
+
+	if (!ctx->length)
+		return 0;
+
+	if (!(fd = fmemopen(ctx->block, ctx->length, "rb")))
+		return -1;
+	if (!(reader = huff_reader_attach(fd))) {
+		fclose(fd);
+		return -1;
+	}
+
+	/* the single pass of the codebook mode codes up to the file's end */
+	sample_file_length = ctx->length;
+	ret = huff_encoder_block(reader, ctx->writer, 0);
+	ret |= huff_reader_close(reader);
+	ctx->length = 0;
+
+	return ret || huff_encoder_emit(ctx) ? -1 : 0;
+}
+
+/* Start encoding the characters fed to the returned context into a
+ * compressed file, whose u8s are passed to emit(arg, buf, len) a block at a
+ * time; emit returns 0 if successful, otherwise -1. The fast mode samples the
+ * whole file and deduplication reads ahead of the blocks, so neither applies.
+ * The codec's state is global, so a single context is open at a time.
+ * Return the new context if successful, otherwise NULL, also while another
+ * context is open.
+ */
+huff_encoder_ctx_t *huff_encoder_begin(huff_encoder_emit_t emit, void *arg)
+{
+	huff_encoder_ctx_t *ctx;
+
+	if (is_ctx_open || huffman_sample || huffman_dedup ||
+		!(ctx = huff_calloc(1, sizeof(*ctx)))) {
+		return NULL;
+	}
+	is_ctx_open = 1;
+
+	ctx->emit = emit;
+	ctx->arg = arg;
+	huff_file_reset();
+
+	if (!(ctx->block = huff_calloc(1, huffman_block_size)) ||
+		!(ctx->writer = huff_writer_memory()) ||
+		(huffman_codebook && huff_encoder_read_codebook()) ||
+		huff_encoder_write_container(ctx->writer) ||
+		huff_encoder_emit(ctx)) {
+		ctx->is_failed = 1;
+		huff_encoder_end(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+/* Feed the len characters of buf to ctx, coding and emitting every block they
+ * complete.
+ * Return 0 if successful, otherwise -1, also if a character does not belong
+ * to the ANSI character set.
+ */
+int huff_encoder_feed(huff_encoder_ctx_t *ctx, const u8 *buf, size_t len)
+{
+	size_t chunk;
+
+	while (len && !ctx->is_failed) {
+		chunk = huffman_block_size - ctx->length;
+		if (chunk > len)
+			chunk = len;
+		memcpy(ctx->block + ctx->length, buf, chunk);
+		ctx->length += chunk;
+		buf += chunk;
+		len -= chunk;
+
+		if (ctx->length == huffman_block_size &&
+			huff_encoder_push_block(ctx)) {
+			ctx->is_failed = 1;
+		}
+	}
+
+	return ctx->is_failed ? -1 : 0;
+}
+
+/* Code and emit the characters fed to ctx so far as a block, even if it is
+ * short, so that everything fed can be decoded from what was emitted but the
+ * trailer.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_encoder_flush(huff_encoder_ctx_t *ctx)
+{
+	if (!ctx->is_failed && huff_encoder_push_block(ctx))
+		ctx->is_failed = 1;
+
+	return ctx->is_failed ? -1 : 0;
+}
+
+/* Flush ctx, emit the trailer and delete ctx.
+ * Return 0 if the compressed file was emitted whole, otherwise -1.
+ */
+int huff_encoder_end(huff_encoder_ctx_t *ctx)
+{
+	int ret;
+
+	ret = huff_encoder_flush(ctx) ||
+		huff_encoder_write_trailer(ctx->writer,
+			uncompressed_file_length, file_crc) ||
+		huff_encoder_emit(ctx);
+
+	if (!huffman_codebook_resident)
+		huff_encoder_free_codebook();
+	huff_block_release();
+
+	if (ctx->writer)
+		huff_writer_close(ctx->writer);
+	huff_free(ctx->block);
+	huff_free(ctx);
+	is_ctx_open = 0;
+
+	return ret ? -1 : 0;
+}
+
@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include "huffman.h"
+#include "huffman_io.h"
+#include "huffman_codec.h"
+
+#define GEN_OPTIONS "ho:n:"
+#define GEN_DEFAULT_NAME "huffman_codebook"
+#define GEN_ENTRIES_PER_LINE 2
+
+static char *gen_name = GEN_DEFAULT_NAME;
+static huff_tree_node_t *gen_states[ANSI_CHAR_SET_CARDINALITY];
+static int gen_num_states;
+static huff_fsm_entry_t *gen_table;
+
+/* Read the codebook of the first huffman block of file_name into dictionary
+ * and create its tree and the decoding finite state machine.
+ * Return 0 if successful, otherwise -1.
+ */
+static int gen_read_codebook(char *file_name)
+{
+	huff_reader_t *reader = NULL;
+	int ret;
+
+	if (!(reader = huff_reader_open(file_name)))
+		return -1;
+
+	ret = huff_decoder_find_header(reader) ||
+		huff_decoder_parse_header(reader, NULL) ||
+		huff_decoder_creat_tree();
+	huff_reader_close(reader);
+
+	if (ret) {
+		printf("%s: no huffman codebook found\n", file_name);
+		return -1;
+	}
+
+	if (character_set_cardinality == 1) {
+		printf("%s: a single character codebook has no code to " \
+			"decode\n", file_name);
+		return -1;
+	}
+
+	gen_num_states = huff_decoder_number_states(tree_root, gen_states, 0);
+	if (!(gen_table = calloc(gen_num_states * HUFF_FSM_INPUTS,
+		sizeof(huff_fsm_entry_t)))) {
+		return -1;
+	}
+	huff_decoder_fsm_build(gen_table, gen_states, gen_num_states);
+
+	return 0;
+}
+
+/* Return the state a bit leads to from node: the state number of an internal
+ * node, or -1 - the character of a leaf.
+ */
+static int gen_step(huff_tree_node_t *node)
+{
+	return HUFF_NODE_ISLEAF(node) ? -1 - (int)HUFF_NODE_CHAR(node) :
+		(int)HUFF_NODE_FREQ(node);
+}
+
+static void gen_write_codes(FILE *out)
+{
+	bit_t *stack;
+	int ch;
+
+	fprintf(out, "/* the representation of every character of the " \
+		"codebook */\n");
+	fprintf(out, "static const char *const %s_codes" \
+		"[ANSI_CHAR_SET_CARDINALITY] = {\n", gen_name);
+	for (ch = 0; ch < ANSI_CHAR_SET_CARDINALITY; ch++) {
+		if (!(stack = dictionary[ch])) {
+			fprintf(out, "\tNULL,\n");
+			continue;
+		}
+
+		fprintf(out, "\t\"");
+		for (; *stack != NO_BIT; stack++)
+			fprintf(out, "%c", *stack == ONE ? '1' : '0');
+		fprintf(out, "\", /* %i */\n", ch);
+	}
+	fprintf(out, "};\n\n");
+}
+
+static void gen_write_steps(FILE *out)
+{
+	int state;
+
+	fprintf(out, "/* the state each bit leads to, or -1 - the character " \
+		"it completes */\n");
+	fprintf(out, "static const short %s_step[%s_STATES][2] = {\n",
+		gen_name, gen_name);
+	for (state = 0; state < gen_num_states; state++) {
+		fprintf(out, "\t{%i, %i},\n",
+			gen_step(HUFF_NODE_LSON(gen_states[state])),
+			gen_step(HUFF_NODE_RSON(gen_states[state])));
+	}
+	fprintf(out, "};\n\n");
+}
+
+static void gen_write_fsm(FILE *out)
+{
+	huff_fsm_entry_t *entry = gen_table;
+	int state, input, i;
+
+	fprintf(out, "/* the characters each input u8 completes and the state " \
+		"it leads to */\n");
+	fprintf(out, "static const huff_fsm_entry_t " \
+		"%s_fsm[%s_STATES][HUFF_FSM_INPUTS] = {\n", gen_name, gen_name);
+	for (state = 0; state < gen_num_states; state++) {
+		fprintf(out, "\t{ /* state %i */\n", state);
+		for (input = 0; input < HUFF_FSM_INPUTS; input++, entry++) {
+			if (!(input % GEN_ENTRIES_PER_LINE))
+				fprintf(out, "\t\t");
+			fprintf(out, "{%u, %u, {", entry->next, entry->count);
+			for (i = 0; i < BYTE; i++) {
+				fprintf(out, "%u%s", entry->character[i],
+					i < BYTE - 1 ? ", " : "");
+			}
+			fprintf(out, "}},%s", (input + 1) %
+				GEN_ENTRIES_PER_LINE ? " " : "\n");
+		}
+		fprintf(out, "\t},\n");
+	}
+	fprintf(out, "};\n\n");
+}
+
+/* Write the functions of the generated decoder: the codebook check, the data
+ * decoder and the huffman_decode() like entry point.
+ */
+static void gen_write_functions(FILE *out)
+{
+	char *n = gen_name;
+
+	fprintf(out,
+"/* Return 0 if the dictionary of the block's header is the codebook, "
+"otherwise -1. */\n"
+"static int %s_match(void)\n"
+"{\n"
+"	const char *code;\n"
+"	bit_t *stack;\n"
+"	int ch;\n"
+"\n"
+"	for (ch = 0; ch < ANSI_CHAR_SET_CARDINALITY; ch++) {\n"
+"		code = %s_codes[ch];\n"
+"		if (!(stack = dictionary[ch]) || !code) {\n"
+"			if (stack || code)\n"
+"				return -1;\n"
+"			continue;\n"
+"		}\n"
+"\n"
+"		for (; *code && *stack != NO_BIT; code++, stack++) {\n"
+"			if (*stack != (*code == '1' ? ONE : ZERO))\n"
+"				return -1;\n"
+"		}\n"
+"		if (*code || *stack != NO_BIT)\n"
+"			return -1;\n"
+"	}\n"
+"\n"
+"	return 0;\n"
+"}\n\n", n, n);
+
+	fprintf(out,
+"/* Decode the data of a huffman block coded with the codebook: a bit at a "
+"time up\n"
+" * to the first u8 boundary, then a u8 at a time.\n"
+" * Return 0 if successful, otherwise -1.\n"
+" */\n"
+"static int %s_decompress(huff_reader_t *reader, huff_writer_t *writer)\n"
+"{\n"
+"	const huff_fsm_entry_t *entry;\n"
+"	huff_sink_t sink;\n"
+"	u64 decoded = 0;\n"
+"	int state = 0, i;\n"
+"	bit_t bit;\n"
+"	u8 input;\n"
+"\n"
+"	if (%s_match()) {\n"
+"		printf(\"%%s: codebook mismatch in block %%llu\\n\",\n"
+"			compressed_file_name, block_count);\n"
+"		return -1;\n"
+"	}\n"
+"\n"
+"	if (huff_sink_begin(&sink, writer))\n"
+"		return -1;\n"
+"\n"
+"	while (reader->minor_offset && decoded < block_length) {\n"
+"		if (huff_read_bit(reader, &bit))\n"
+"			return -1;\n"
+"\n"
+"		if ((state = %s_step[state][bit]) >= 0)\n"
+"			continue;\n"
+"\n"
+"		if (HUFF_SINK_PUT(&sink, (u8)(-1 - state)))\n"
+"			return -1;\n"
+"		decoded++;\n"
+"		state = 0;\n"
+"	}\n"
+"\n"
+"	while (decoded < block_length) {\n"
+"		if (huff_read_u8(reader, &input))\n"
+"			return -1;\n"
+"\n"
+"		entry = &%s_fsm[state][input];\n"
+"		for (i = 0; i < entry->count && decoded < block_length;\n"
+"			i++, decoded++) {\n"
+"			if (HUFF_SINK_PUT(&sink, entry->character[i]))\n"
+"				return -1;\n"
+"		}\n"
+"		state = entry->next;\n"
+"	}\n"
+"\n"
+"	return huff_sink_end(&sink);\n"
+"}\n\n", n, n, n, n);
+
+	fprintf(out,
+"/* Decode the file compressed_file_name into uncompressed_file_name, as\n"
+" * huffman_decode() does. Every huffman block must be coded with the "
+"codebook.\n"
+" * Return 0 if successful, otherwise -1.\n"
+" */\n"
+"int %s_decode(void)\n"
+"{\n"
+"	return huffman_decode_codebook(%s_decompress);\n"
+"}\n", n, n);
+}
+
+static int gen_write(FILE *out, char *file_name)
+{
+	fprintf(out, "/* A huffman decoder specialized for the codebook of %s,\n",
+		file_name);
+	fprintf(out, " * generated by huffman_gen. Do not edit.\n");
+	fprintf(out, " *\n * int %s_decode(void);\n */\n", gen_name);
+	fprintf(out, "#include <stdio.h>\n");
+	fprintf(out, "#include \"huffman.h\"\n");
+	fprintf(out, "#include \"huffman_io.h\"\n");
+	fprintf(out, "#include \"huffman_codec.h\"\n\n");
+	fprintf(out, "#define %s_STATES %i\n\n", gen_name, gen_num_states);
+
+	gen_write_codes(out);
+	gen_write_steps(out);
+	gen_write_fsm(out);
+	gen_write_functions(out);
+
+	return ferror(out) ? -1 : 0;
+}
+
+/* Return 1 if name is a valid C identifier, otherwise 0. */
+static int gen_valid_name(char *name)
+{
+	if (!isalpha((u8)*name) && *name != '_')
+		return 0;
+
+	for (name++; *name; name++) {
+		if (!isalnum((u8)*name) && *name != '_')
+			return 0;
+	}
+
+	return 1;
+}
+
+static void gen_usage(char *argv[])
+{
+	printf("Usage: %s [-o file_name.c] [-n name] file_name.huf\n",
+		argv[0]);
+	printf("       %s [-h]\n\n", argv[0]);
+	printf("  Where -o   write the decoder to 'file_name.c' (default " \
+		"stdout)\n");
+	printf("        -n   prefix of the generated identifiers, " \
+		"name_decode() decodes\n");
+	printf("             (default %s)\n", GEN_DEFAULT_NAME);
+	printf("        -h   print this message and exit\n\n");
+	printf("Generates the C source of a decoder specialized for the " \
+		"codebook of the first\n");
+	printf("huffman block of 'file_name.huf'. It is linked against the " \
+		"huffman objects and\n");
+	printf("decodes files whose huffman blocks are all coded with that " \
+		"codebook.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	char *out_name = NULL;
+	FILE *out = stdout;
+	int option, ret;
+
+	while ((option = getopt(argc, argv, GEN_OPTIONS)) != -1) {
+		switch (option) {
+		case 'o':
+			out_name = optarg;
+			break;
+		case 'n':
+			if (!gen_valid_name(optarg))
+				goto Error;
+			gen_name = optarg;
+			break;
+		case 'h':
+			gen_usage(argv);
+			return 0;
+		default:
+			goto Error;
+		}
+	}
+
+	if (optind != argc - 1)
+		goto Error;
+
+	if (gen_read_codebook(argv[optind]))
+		return -1;
+
+	if (out_name && !(out = fopen(out_name, "w"))) {
+		printf("the file %s can not be created\n", out_name);
+		return -1;
+	}
+
+	ret = gen_write(out, argv[optind]);
+	if (out != stdout && fclose(out) == EOF)
+		ret = -1;
+
+	free(gen_table);
+	return ret;
+
+Error:
+	printf("try `%s -h' for more information\n", argv[0]);
+	return -1;
+}
@@ -0,0 +1,551 @@
+#define _GNU_SOURCE /* memrchr() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "huffman.h"
+#include "huffman_io.h"
+#include "huffman_codec.h"
+#include "huffman_stats.h"
+#include "huffman_index.h"
+#include "huffman_grep.h"
+
+#define HUFF_GREP_WINDOW (64 * 1024) /* u8s decoded at a time, no index */
+#define HUFF_GREP_LINE 256 /* initial size of the line carried */
+#define HUFF_GREP_NEWLINE '\n'
+
+/* The search of a part of the file, fed a buffer of decoded u8s at a time.
+ * A line is printed once its newline has been fed; the line not yet ended is
+ * carried from one buffer to the next.
+ */
+typedef struct huff_grep_t {
+	u8 *line;		/* the line carried */
+	size_t line_length;
+	size_t line_size;
+	int is_match;		/* the line carried holds the pattern */
+	size_t rare;		/* the pattern's character located first */
+	FILE *out;
+} huff_grep_t;
+
+/* the blocks that a job searches, [start, end) of the index */
+typedef struct huff_grep_piece_t {
+	u64 start;
+	u64 end;
+	int job;
+} huff_grep_piece_t;
+
+static const u8 *pattern;
+static size_t pattern_length;
+/* the characters of the pattern, as in a block's bitmap */
+static u8 pattern_bitmap[HUFFMAN_INDEX_BITMAP];
+
+/* Locate the pattern's character that is the least frequent in the block
+ * decoded last, so that memchr() stops as seldom as possible.
+ */
+static void huff_grep_rare(huff_grep_t *grep)
+{
+	size_t i;
+
+	grep->rare = 0;
+	for (i = 1; i < pattern_length; i++) {
+		if (frequency[pattern[i]] < frequency[pattern[grep->rare]])
+			grep->rare = i;
+	}
+}
+
+/* Return the first occurrence of the pattern in the len u8s of buf, or NULL.
+ * Its rare character is located with memchr(), which compares a vector of
+ * u8s at a time, and the whole pattern is compared where it is found.
+ */
+static const u8 *huff_grep_find(huff_grep_t *grep, const u8 *buf,
+	size_t len)
+{
+	size_t k = grep->rare;
+	const u8 *p, *end;
+
+	if (len < pattern_length)
+		return NULL;
+
+	p = buf + k;
+	end = buf + len - (pattern_length - 1 - k);
+	while (p < end && (p = memchr(p, pattern[k], end - p))) {
+		if (!memcmp(p - k, pattern, pattern_length))
+			return p - k;
+		p++;
+	}
+
+	return NULL;
+}
+
+/* Append the len u8s of buf to the line carried, growing it as needed.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_grep_carry(huff_grep_t *grep, const u8 *buf, size_t len)
+{
+	size_t size = grep->line_size ? grep->line_size : HUFF_GREP_LINE;
+	u8 *grown;
+
+	/* the line is not allocated before the first u8 carried */
+	if (!len)
+		return 0;
+
+	if (grep->line_length + len > grep->line_size) {
+		while (size < grep->line_length + len)
+			size *= 2;
+		if (!(grown = huff_calloc(1, size)))
+			return -1;
+
+		if (grep->line_length)
+			memcpy(grown, grep->line, grep->line_length);
+		huff_free(grep->line);
+		grep->line = grown;
+		grep->line_size = size;
+	}
+
+	memcpy(grep->line + grep->line_length, buf, len);
+	grep->line_length += len;
+
+	return 0;
+}
+
+/* Drop the line carried. */
+static void huff_grep_drop(huff_grep_t *grep)
+{
+	grep->line_length = 0;
+	grep->is_match = 0;
+}
+
+/* Print the len u8s of line and a newline.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_grep_print(huff_grep_t *grep, const u8 *line, size_t len)
+{
+	if (fwrite(line, sizeof(u8), len, grep->out) != len ||
+		putc(HUFF_GREP_NEWLINE, grep->out) == EOF) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Search the len decoded u8s of buf, which follow those fed before: print
+ * the lines ending in buf that hold the pattern and carry the line that does
+ * not end in it.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_grep_feed(huff_grep_t *grep, const u8 *buf, size_t len)
+{
+	const u8 *end = buf + len, *match, *start, *newline;
+
+	/* the line carried ends at the first newline, if any */
+	if (grep->line_length) {
+		newline = memchr(buf, HUFF_GREP_NEWLINE, len);
+		ASSERT(huff_grep_carry(grep, buf, newline ? newline - buf : len));
+		if (!newline)
+			return 0;
+
+		if ((grep->is_match || huff_grep_find(grep, grep->line,
+			grep->line_length)) && huff_grep_print(grep, grep->line,
+			grep->line_length)) {
+			return -1;
+		}
+		huff_grep_drop(grep);
+		buf = newline + 1;
+	}
+
+	/* the pattern is looked for across lines, and its line is found
+	 * around it */
+	while ((match = huff_grep_find(grep, buf, end - buf))) {
+		start = memrchr(buf, HUFF_GREP_NEWLINE, match - buf);
+		start = start ? start + 1 : buf;
+		newline = memchr(match + pattern_length, HUFF_GREP_NEWLINE,
+			end - match - pattern_length);
+		if (!newline) {
+			grep->is_match = 1;
+			return huff_grep_carry(grep, start, end - start);
+		}
+
+		ASSERT(huff_grep_print(grep, start, newline - start));
+		buf = newline + 1;
+	}
+
+	/* the pattern may continue in the next buffer */
+	start = memrchr(buf, HUFF_GREP_NEWLINE, end - buf);
+	start = start ? start + 1 : buf;
+	return huff_grep_carry(grep, start, end - start);
+}
+
+/* Carry the line that the len u8s of buf end with, where a part of the file
+ * starts: the lines ending in buf are those of the part before.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_grep_begin(huff_grep_t *grep, const u8 *buf, size_t len)
+{
+	const u8 *start = memrchr(buf, HUFF_GREP_NEWLINE, len);
+
+	start = start ? start + 1 : buf;
+	huff_grep_drop(grep);
+
+	return huff_grep_carry(grep, start, buf + len - start);
+}
+
+/* Print the line carried at the end of the file, which has no newline, if it
+ * holds the pattern.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_grep_end(huff_grep_t *grep)
+{
+	if (grep->line_length && (grep->is_match || huff_grep_find(grep,
+		grep->line, grep->line_length)) &&
+		huff_grep_print(grep, grep->line, grep->line_length)) {
+		return -1;
+	}
+
+	huff_grep_drop(grep);
+	return 0;
+}
+
+/* Search the whole file, decoded a window at a time through
+ * huff_decoder_read().
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_grep_stream(huff_grep_t *grep)
+{
+	char name[MAX_FILE_NAME_SIZE];
+	huff_decoder_ctx_t *ctx;
+	ssize_t len;
+	u8 *window;
+	int ret;
+
+	if (!(window = huff_calloc(1, HUFF_GREP_WINDOW)))
+		return -1;
+	/* huff_decoder_open() sets compressed_file_name itself */
+	strcpy(name, compressed_file_name);
+	if (!(ctx = huff_decoder_open(name))) {
+		huff_free(window);
+		return -1;
+	}
+
+	while ((len = huff_decoder_read(ctx, window, HUFF_GREP_WINDOW)) > 0) {
+		huff_grep_rare(grep);
+		if (huff_grep_feed(grep, window, (size_t)len))
+			break;
+	}
+
+	ret = len || huff_grep_end(grep);
+	ret |= huff_decoder_close(ctx);
+	huff_free(window);
+
+	return ret ? -1 : 0;
+}
+
+/* Return 1 if bitmap holds every character of the pattern, otherwise 0. */
+static int huff_grep_holds(const u8 *bitmap)
+{
+	int j;
+
+	for (j = 0; j < HUFFMAN_INDEX_BITMAP; j++) {
+		if (pattern_bitmap[j] & ~bitmap[j])
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Return 1 if bitmap holds a character of the pattern, otherwise 0. */
+static int huff_grep_touches(const u8 *bitmap)
+{
+	int j;
+
+	for (j = 0; j < HUFFMAN_INDEX_BITMAP; j++) {
+		if (pattern_bitmap[j] & bitmap[j])
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Mark the blocks that may hold a part of an occurrence of the pattern in
+ * needed: those holding all its characters, and the runs of blocks that hold
+ * them together, an occurrence crossing from the first to the last, those in
+ * between being shorter than the pattern.
+ */
+static void huff_grep_needed(huff_index_entry_t *entries, u64 count,
+	u8 *needed)
+{
+	u8 seen[HUFFMAN_INDEX_BITMAP];
+	u64 a, b, inside;
+	int j;
+
+	for (a = 0; a < count; a++) {
+		if (!huff_grep_touches(entries[a].bitmap))
+			continue;
+
+		memcpy(seen, entries[a].bitmap, sizeof(seen));
+		for (b = a, inside = 0; !huff_grep_holds(seen); b++) {
+			if (b > a)
+				inside += entries[b].length;
+			if (b + 1 == count || inside + 2 > pattern_length ||
+				!huff_grep_touches(entries[b + 1].bitmap)) {
+				break;
+			}
+
+			for (j = 0; j < HUFFMAN_INDEX_BITMAP; j++)
+				seen[j] |= entries[b + 1].bitmap[j];
+		}
+
+		if (huff_grep_holds(seen))
+			memset(needed + a, 1, b - a + 1);
+	}
+}
+
+/* Cut the blocks to search into pieces, each searched by one of jobs jobs in
+ * the order of the file: every run of needed blocks up to the first block
+ * after it with a newline, where the last line holding the pattern ends at
+ * the latest, cut where the characters searched before reach the next job's
+ * share.
+ * Return the number of pieces.
+ */
+static u64 huff_grep_pieces(huff_index_entry_t *entries, u64 count,
+	u8 *needed, int jobs, huff_grep_piece_t *pieces)
+{
+	u64 total = 0, searched = 0, end = 0, n = 0, i;
+	int job;
+
+	/* extend every run to its end, which may join it to the next */
+	for (i = 0; i < count; i = end) {
+		if (!needed[i]) {
+			end = i + 1;
+			continue;
+		}
+
+		for (end = i + 1; end < count; end++) {
+			if (!needed[end] &&
+				HUFF_INDEX_HAS(entries + end, HUFF_GREP_NEWLINE)) {
+				end++;
+				break;
+			}
+		}
+		memset(needed + i, 1, end - i);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (needed[i])
+			total += entries[i].length;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!needed[i])
+			continue;
+
+		job = total ? (int)(searched * jobs / total) : 0;
+		if (!n || pieces[n - 1].end != i || pieces[n - 1].job != job) {
+			pieces[n].start = i;
+			pieces[n].job = job;
+			n++;
+		}
+		pieces[n - 1].end = i + 1;
+		searched += entries[i].length;
+	}
+
+	return n;
+}
+
+/* Decode block i of the index into the memory writer and point data at it.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_grep_decode(huff_reader_t *reader, huff_writer_t *writer,
+	huff_index_entry_t *entry, u8 **data)
+{
+	size_t length;
+
+	huff_writer_memory_clear(writer);
+	ASSERT(huff_decoder_block_at(reader, writer, entry->offset));
+	*data = huff_writer_memory_data(writer, &length);
+	if (length != entry->length) {
+		printf("the block index does not match the blocks.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Search the blocks of piece. Its first line starts after the last newline
+ * before it, in the nearest block with a newline, and its last line, that of
+ * the next piece unless the file ends, is dropped.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_grep_piece(huff_grep_t *grep, huff_reader_t *reader,
+	huff_writer_t *writer, huff_index_entry_t *entries, u64 count,
+	huff_grep_piece_t *piece)
+{
+	u64 i = piece->start;
+	u8 *data;
+
+	while (i > 0 && !HUFF_INDEX_HAS(entries + i - 1, HUFF_GREP_NEWLINE))
+		i--;
+
+	huff_grep_drop(grep);
+	if (i > 0) {
+		ASSERT(huff_grep_decode(reader, writer, entries + i - 1, &data));
+		ASSERT(huff_grep_begin(grep, data, entries[i - 1].length));
+	}
+
+	for (; i < piece->end; i++) {
+		ASSERT(huff_grep_decode(reader, writer, entries + i, &data));
+		huff_grep_rare(grep);
+		ASSERT(huff_grep_feed(grep, data, entries[i].length));
+	}
+
+	if (piece->end == count)
+		return huff_grep_end(grep);
+
+	huff_grep_drop(grep);
+	return 0;
+}
+
+/* Search the pieces of job, with a reader of its own.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_grep_job(huff_grep_t *grep, huff_index_entry_t *entries,
+	u64 count, huff_grep_piece_t *pieces, u64 n, int job)
+{
+	huff_reader_t *reader = NULL;
+	huff_writer_t *writer = NULL;
+	int ret = -1;
+	u64 i;
+
+	if (!(reader = huff_reader_open(compressed_file_name)) ||
+		!(writer = huff_writer_memory())) {
+		goto Exit;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (pieces[i].job == job &&
+			huff_grep_piece(grep, reader, writer, entries, count,
+			pieces + i)) {
+			goto Exit;
+		}
+	}
+	ret = fflush(grep->out) ? -1 : 0;
+
+Exit:
+	if (writer)
+		huff_writer_close(writer);
+	if (reader)
+		huff_reader_close(reader);
+	return ret;
+}
+
+/* Search the pieces with jobs processes, each printing to a temporary file
+ * of its own, which are then copied to stdout in the order of the file.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_grep_fork(huff_grep_t *grep, huff_index_entry_t *entries,
+	u64 count, huff_grep_piece_t *pieces, u64 n, int jobs)
+{
+	FILE *out[HUFFMAN_GREP_MAX_JOBS] = { NULL };
+	pid_t pid[HUFFMAN_GREP_MAX_JOBS];
+	int ret = 0, status, job, started = 0;
+	char buf[BUFSIZ];
+	size_t len;
+
+	fflush(stdout);
+	for (job = 0; job < jobs; job++, started++) {
+		if (!(out[job] = tmpfile()) || (pid[job] = fork()) < 0) {
+			ret = -1;
+			break;
+		}
+
+		if (!pid[job]) {
+			grep->out = out[job];
+			_exit(huff_grep_job(grep, entries, count, pieces, n,
+				job) ? EXIT_FAILURE : EXIT_SUCCESS);
+		}
+	}
+
+	for (job = 0; job < started; job++) {
+		if (waitpid(pid[job], &status, 0) < 0 || !WIFEXITED(status) ||
+			WEXITSTATUS(status) != EXIT_SUCCESS) {
+			ret = -1;
+		}
+	}
+
+	for (job = 0; job < jobs && out[job]; job++) {
+		rewind(out[job]);
+		while (!ret && (len = fread(buf, 1, sizeof(buf), out[job])))
+			ret = fwrite(buf, 1, len, stdout) != len ? -1 : 0;
+		fclose(out[job]);
+	}
+
+	return ret;
+}
+
+/* Print the lines of the file holding pattern, as grep -F does on the file
+ * decoded. The blocks are searched by up to jobs processes if the file has
+ * a block index, and in order in this one otherwise.
+ * Return 0 if successful, otherwise -1.
+ */
+int huffman_grep(char *text, int jobs)
+{
+	huff_grep_piece_t *pieces = NULL;
+	huff_index_entry_t *entries;
+	huff_reader_t *reader;
+	huff_grep_t grep;
+	u8 *needed = NULL;
+	u64 count = 0, n, i;
+	int ret = -1;
+
+	pattern = (const u8 *)text;
+	pattern_length = strlen(text);
+	memset(pattern_bitmap, 0, sizeof(pattern_bitmap));
+	for (i = 0; i < pattern_length; i++) {
+		if (pattern[i] >= ANSI_CHAR_SET_CARDINALITY ||
+			pattern[i] == HUFF_GREP_NEWLINE) {
+			printf("%s: the pattern must be ANSI characters and no "
+				"newline.\n", text);
+			return -1;
+		}
+		pattern_bitmap[pattern[i] / BYTE] |= 1 << (pattern[i] % BYTE);
+	}
+	if (!pattern_length) {
+		printf("the pattern is empty.\n");
+		return -1;
+	}
+
+	memset(&grep, 0, sizeof(grep));
+	grep.out = stdout;
+
+	/* a file without a valid index is searched whole */
+	if (!(reader = huff_reader_open(compressed_file_name)))
+		return -1;
+	entries = huff_index_read(reader, &count, NULL);
+	huff_reader_close(reader);
+	if (!entries) {
+		ret = huff_grep_stream(&grep);
+		goto Exit;
+	}
+
+	if (!(needed = huff_calloc(count, sizeof(u8))) ||
+		!(pieces = huff_calloc(count, sizeof(huff_grep_piece_t)))) {
+		goto Exit;
+	}
+
+	huff_grep_needed(entries, count, needed);
+	n = huff_grep_pieces(entries, count, needed, jobs, pieces);
+	jobs = n ? pieces[n - 1].job + 1 : 1;
+
+	if (jobs > 1)
+		ret = huff_grep_fork(&grep, entries, count, pieces, n, jobs);
+	else
+		ret = huff_grep_job(&grep, entries, count, pieces, n, 0);
+
+Exit:
+	huff_free(pieces);
+	huff_free(needed);
+	huff_free(grep.line);
+	huff_index_free();
+	return ret;
+}
@@ -0,0 +1,16 @@
+#ifndef _HUFFMAN_GREP_H_
+#define _HUFFMAN_GREP_H_
+
+#include "huffman.h"
+
+/* Searching compressed_file_name for the lines holding a pattern, without
+ * writing the decoded data. With a block index only the blocks that can hold
+ * the pattern, and those holding the rest of their lines, are decoded, by up
+ * to jobs worker processes.
+ */
+#define HUFFMAN_GREP_MAX_JOBS 256
+
+int huffman_grep(char *pattern, int jobs);
+
+#endif
+
@@ -0,0 +1,159 @@
+#include <string.h>
+#include "huffman_index.h"
+#include "huffman_stats.h"
+
+#define HUFFMAN_INDEX_ENTRIES 64 /* initial size of the index */
+
+static huff_index_entry_t *entries;
+static u64 entry_count;
+static u64 entry_size;
+
+/* Append a block at offset, of length characters counted in freq, to the
+ * index, growing it as needed. Without freq the bitmap is left clear.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_index_add(u64 offset, u64 length, u64 *freq)
+{
+	huff_index_entry_t *grown, *entry;
+	u64 size;
+	int c;
+
+	if (entry_count == entry_size) {
+		size = entry_size ? 2 * entry_size : HUFFMAN_INDEX_ENTRIES;
+		if (!(grown = huff_calloc(size, sizeof(huff_index_entry_t))))
+			return -1;
+
+		if (entries) {
+			memcpy(grown, entries,
+				entry_count * sizeof(huff_index_entry_t));
+			huff_free(entries);
+		}
+		entries = grown;
+		entry_size = size;
+	}
+
+	entry = entries + entry_count++;
+	memset(entry, 0, sizeof(*entry));
+	entry->offset = offset;
+	entry->length = length;
+	for (c = 0; freq && c < ANSI_CHAR_SET_CARDINALITY; c++) {
+		if (freq[c])
+			entry->bitmap[c / BYTE] |= 1 << (c % BYTE);
+	}
+
+	return 0;
+}
+
+/* Write the index: its magic, the number of blocks, the offset (from that of
+ * the previous block), the length and the bitmap of every block and the crc
+ * of the index, followed by the footer: the offset of the index and the
+ * container magic. Offsets are from base, that of the container's magic.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_index_write(huff_writer_t *writer, u64 base)
+{
+	u64 start = huff_writer_tell(writer), previous = 0, i;
+	u32 crc;
+	int j;
+
+	huff_writer_crc_begin(writer);
+	ASSERT(huff_write_u8(writer, HUFFMAN_INDEX));
+	ASSERT(huff_write_varint(writer, entry_count));
+	for (i = 0; i < entry_count; i++) {
+		ASSERT(huff_write_varint(writer, entries[i].offset - previous));
+		ASSERT(huff_write_varint(writer, entries[i].length));
+		for (j = 0; j < HUFFMAN_INDEX_BITMAP; j++)
+			ASSERT(huff_write_u8(writer, entries[i].bitmap[j]));
+		previous = entries[i].offset;
+	}
+	crc = huff_writer_crc_end(writer);
+	ASSERT(huff_write_u32(writer, crc));
+
+	ASSERT(huff_write_u32(writer, (u32)((start - base) & 0xFFFFFFFF)));
+	ASSERT(huff_write_u32(writer, (u32)((start - base) >> 32)));
+	ASSERT(huff_write_u8(writer, HUFFMAN_CONTAINER));
+
+	/* statistics */
+	file_stats.compressed_length +=
+		(huff_writer_tell(writer) - start) * BYTE;
+
+	return 0;
+}
+
+/* Read the block index of the file read by reader, a container starting at
+ * offset 0, locating it through the footer.
+ * Return the blocks, and set *count to their number and *start, unless start
+ * is NULL, to the offset of the index, if the file has an intact index,
+ * otherwise NULL. The blocks are valid until huff_index_free().
+ */
+huff_index_entry_t *huff_index_read(huff_reader_t *reader, u64 *count,
+	u64 *start)
+{
+	huff_index_entry_t *entry;
+	u64 length, offset, number, delta, size, previous = 0, i;
+	u32 low, high, crc;
+	int j;
+	u8 ch;
+
+	huff_index_free();
+	if (huff_reader_length(reader, &length) ||
+		length < 1 + HUFFMAN_INDEX_FOOTER_LENGTH ||
+		huff_reader_seek(reader,
+			length - HUFFMAN_INDEX_FOOTER_LENGTH) ||
+		huff_read_u32(reader, &low) || huff_read_u32(reader, &high) ||
+		huff_read_u8(reader, &ch) || ch != HUFFMAN_CONTAINER) {
+		return NULL;
+	}
+
+	/* a file without an index ends with its crc, which may look like a
+	 * footer: the index is only taken if its magic and crc match */
+	offset = ((u64)high << 32) | low;
+	if (offset >= length - HUFFMAN_INDEX_FOOTER_LENGTH ||
+		huff_reader_seek(reader, offset)) {
+		return NULL;
+	}
+
+	huff_reader_crc_begin(reader);
+	if (huff_read_u8(reader, &ch) || ch != HUFFMAN_INDEX ||
+		huff_read_varint(reader, &number) || number > offset) {
+		goto Error;
+	}
+
+	for (i = 0; i < number; i++) {
+		if (huff_read_varint(reader, &delta) ||
+			huff_read_varint(reader, &size) ||
+			delta > offset - previous ||
+			huff_index_add(previous + delta, size, NULL)) {
+			goto Error;
+		}
+
+		entry = entries + i;
+		for (j = 0; j < HUFFMAN_INDEX_BITMAP; j++) {
+			if (huff_read_u8(reader, entry->bitmap + j))
+				goto Error;
+		}
+		previous = entry->offset;
+	}
+
+	crc = huff_reader_crc_end(reader);
+	if (huff_read_u32(reader, &low) || low != crc)
+		goto Error;
+
+	*count = entry_count;
+	if (start)
+		*start = offset;
+	return entries;
+
+Error:
+	huff_index_free();
+	return NULL;
+}
+
+void huff_index_free(void)
+{
+	huff_free(entries);
+
+	entries = NULL;
+	entry_count = 0;
+	entry_size = 0;
+}
@@ -0,0 +1,33 @@
+#ifndef _HUFFMAN_INDEX_H_
+#define _HUFFMAN_INDEX_H_
+
+#include "huffman.h"
+#include "huffman_io.h"
+
+/* The block index that --index writes after the trailer: the offset and
+ * length of every block and the characters it holds, so that a block is
+ * located without decoding those before it, and passed over if it can not
+ * hold what is looked for. A fixed length footer locates the index, as that
+ * of an archive does.
+ */
+#define HUFFMAN_INDEX_FOOTER_LENGTH 9 /* index offset (u64) and magic */
+#define HUFFMAN_INDEX_BITMAP (ANSI_CHAR_SET_CARDINALITY / BYTE)
+
+/* a block, as recorded in the index */
+typedef struct huff_index_entry_t {
+	u64 offset;	/* of the block's type, from the container's magic */
+	u64 length;	/* of the uncompressed block */
+	u8 bitmap[HUFFMAN_INDEX_BITMAP]; /* bit c set if c is in the block */
+} huff_index_entry_t;
+
+#define HUFF_INDEX_HAS(entry, c) \
+	((entry)->bitmap[(c) / BYTE] & (1 << ((c) % BYTE)))
+
+int huff_index_add(u64 offset, u64 length, u64 *freq);
+int huff_index_write(huff_writer_t *writer, u64 base);
+huff_index_entry_t *huff_index_read(huff_reader_t *reader, u64 *count,
+	u64 *start);
+void huff_index_free(void);
+
+#endif
+
@@ -1,7 +1,13 @@
+#define _GNU_SOURCE /* O_DIRECT */
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "huffman_io.h"
+#include "huffman_stats.h"
+#include "huffman_crc.h"
 
 #define BIT_ZERO_0 0x7F  /* 0111 1111 */
 #define BIT_ZERO_1 0xBF  /* 1011 1111 */
@@ -23,6 +29,13 @@
 
 #define RESET_CHAR 0x0   /* 0000 0000 */
 
+#define VARINT_MASK 0x7F /* 0111 1111 */
+#define VARINT_MORE 0x80 /* 1000 0000 */
+#define VARINT_SHIFT 7
+#define VARINT_MAX_SHIFT 63
+
+#define HUFFMAN_IO_FILE_MODE 0666
+
 #define CHAR_POW(x, y) ((u8)(pow((double)(x), (double)(y))))
 
 /* Not yet in use
@@ -33,12 +46,15 @@
 static u8 one_bit[8] = {BIT_ONE_0,BIT_ONE_1, BIT_ONE_2, BIT_ONE_3, BIT_ONE_4,
 	BIT_ONE_5, BIT_ONE_6, BIT_ONE_7};
 
+size_t huffman_io_buf_size = HUFFMAN_IO_BUF_SIZE;
+int huffman_io_direct;
+
 /* Generic functions for allocating a new struct huff_io_t.
  * Used by huff_writer_alloc() and huff_reader_alloc()
  */
 static void *huff_io_alloc(void)
 {
-	return (void*)calloc(1, sizeof(struct huff_io_t));
+	return huff_calloc(1, sizeof(struct huff_io_t));
 }
 
 /* Allocates a new huff_writer_t */
@@ -58,7 +74,70 @@ static huff_reader_t *huff_reader_alloc(void)
  */
 static void huff_io_free(struct huff_io_t *ptr)
 {
-	free(ptr);
+	if (ptr->stdio_buf)
+		huff_free(ptr->stdio_buf);
+	huff_free(ptr);
+}
+
+/* Open file_name with flags as a stream of mode. With huffman_io_direct set
+ * the file is opened with O_DIRECT where its file system supports it.
+ * Return the stream if successful, otherwise NULL.
+ */
+static FILE *huff_io_fopen(const char *file_name, int flags, const char *mode)
+{
+	int fildes = -1;
+	FILE *fd = NULL;
+
+	if (huffman_io_direct)
+		fildes = open(file_name, flags | O_DIRECT, HUFFMAN_IO_FILE_MODE);
+
+	if (fildes < 0 &&
+		(fildes = open(file_name, flags, HUFFMAN_IO_FILE_MODE)) < 0) {
+		return NULL;
+	}
+
+	if (!(fd = fdopen(fildes, mode)))
+		close(fildes);
+
+	return fd;
+}
+
+/* Set io up for reading (or writing, if is_write is set) its file with
+ * major buffers of huffman_io_buf_size u8s: asynchronously where possible,
+ * otherwise through stdio and a buffer of its own. The kernel is told that
+ * the file is accessed sequentially and not reused.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_io_setup(struct huff_io_t *io, int is_write)
+{
+	int fildes = io->file ? fileno(io->file) : -1;
+	int flags;
+
+	io->buf_size = huffman_io_buf_size;
+
+	if (fildes >= 0) {
+		if (!is_write)
+			posix_fadvise(fildes, 0, 0, POSIX_FADV_SEQUENTIAL);
+		posix_fadvise(fildes, 0, 0, POSIX_FADV_NOREUSE);
+
+		if ((io->aio = huff_aio_open(fildes, is_write,
+			io->buf_size))) {
+			return is_write && !(io->major_buf =
+				huff_aio_buffer(io->aio)) ? -1 : 0;
+		}
+
+		/* stdio does not align its transfers as O_DIRECT needs */
+		if ((flags = fcntl(fildes, F_GETFL)) >= 0 &&
+			(flags & O_DIRECT)) {
+			fcntl(fildes, F_SETFL, flags & ~O_DIRECT);
+		}
+	}
+
+	if (!(io->stdio_buf = huff_calloc(1, io->buf_size)))
+		return -1;
+
+	io->major_buf = io->stdio_buf;
+	return 0;
 }
 
 /* Free a huff_writer_t */
@@ -73,13 +152,54 @@ static void huff_reader_free(huff_reader_t *reader)
 	huff_io_free((struct huff_io_t*)reader);
 }
 
+/* Return the offset in io's major buffer following the last u8 read or
+ * written. When the major offset has wrapped around the whole buffer has been
+ * consumed.
+ */
+static size_t huff_io_consumed(struct huff_io_t *io)
+{
+	return io->major_offset ? io->major_offset : io->buf_length;
+}
+
+/* Fold the u8s of io's major buffer between crc_offset and end into io's
+ * crc.
+ */
+static void huff_io_crc_update(struct huff_io_t *io, size_t end)
+{
+	size_t i;
+
+	if (!io->is_crc || end <= io->crc_offset)
+		return;
+
+	io->crc = huff_crc32c(io->crc, io->major_buf + io->crc_offset,
+		end - io->crc_offset);
+	if (io->freq) {
+		for (i = io->crc_offset; i < end; i++)
+			io->freq[io->major_buf[i]]++;
+	}
+	io->crc_offset = end;
+}
+
 /* Read from a file into the reader's major buffer.
  * Return the number of u8s read.
  */
 static int huff_read_major_buf(huff_reader_t *reader)
 {
-	reader->buf_length = fread(reader->major_buf, sizeof(u8),
-		MAX_MAJOR_BUF_SIZE, reader->file);
+	huff_io_crc_update(reader, reader->buf_length);
+	reader->crc_offset = 0;
+	reader->buf_offset += reader->buf_length;
+
+	huff_stage_begin(HUFF_STAGE_IO);
+	if (reader->aio) {
+		if (huff_aio_read(reader->aio, &reader->major_buf,
+			&reader->buf_length)) {
+			reader->buf_length = 0;
+		}
+	} else {
+		reader->buf_length = fread(reader->major_buf, sizeof(u8),
+			reader->buf_size, reader->file);
+	}
+	huff_stage_end(HUFF_STAGE_IO, reader->buf_length);
 
 	return reader->buf_length;
 }
@@ -98,6 +218,31 @@ static int huff_read_minor_buf(huff_reader_t *reader)
 	return 0;
 }
 
+/* Create a new huff_reader_t for reading from the already open stream fd.
+ * Regular files are read asynchronously ahead of the reader where possible,
+ * see huff_aio_open().
+ * Return the new reader if successful, otherwise return NULL.
+ */
+huff_reader_t *huff_reader_attach(FILE *fd)
+{
+	huff_reader_t *reader = NULL;
+
+	if (!fd || !(reader = huff_reader_alloc()))
+		return NULL;
+
+	reader->file = fd;
+	reader->major_offset = 0;
+	reader->minor_offset = 0;
+	if (huff_io_setup(reader, 0)) {
+		if (reader->aio)
+			huff_aio_close(reader->aio);
+		huff_reader_free(reader);
+		return NULL;
+	}
+
+	return reader;
+}
+
 /* Create a new huff_reader_t for reading from rfile.
  * Return the new reader if successful in opening rfile and creating the
  * reader, otherwise return NULL.
@@ -107,15 +252,13 @@ huff_reader_t *huff_reader_open(const char *rfile)
 	FILE *fd = NULL;
 	huff_reader_t *reader = NULL;
 
-	if (!(fd = fopen(rfile, "rb")) || !(reader = huff_reader_alloc())) {
+	if (!(fd = huff_io_fopen(rfile, O_RDONLY, "rb")) ||
+		!(reader = huff_reader_attach(fd))) {
 		printf("the file %s does not exist or can not be read\n",
 			rfile);
 		return NULL;
 	}
 
-	reader->file = fd;
-	reader->major_offset = 0;
-	reader->minor_offset = 0;
 	return reader;
 }
 
@@ -124,6 +267,9 @@ huff_reader_t *huff_reader_open(const char *rfile)
  */
 int huff_reader_close(huff_reader_t *reader)
 {
+	if (reader->aio && huff_aio_close(reader->aio))
+		return -1;
+
 	if (fclose(reader->file) == EOF)
 		return -1;
 
@@ -133,9 +279,69 @@ int huff_reader_close(huff_reader_t *reader)
 
 u8 huff_reader_reset(huff_reader_t *reader)
 {
+	return huff_reader_seek(reader, 0) ? HUFFMAN_EOF : 0;
+}
+
+/* Position reader so that the next u8 read is the one at offset.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_reader_seek(huff_reader_t *reader, u64 offset)
+{
+	huff_io_crc_update(reader, huff_io_consumed(reader));
 	reader->major_offset = 0;
 	reader->minor_offset = 0;
-	return fseek(reader->file, 0, SEEK_SET) ? HUFFMAN_EOF : 0;
+	reader->buf_length = 0;
+	reader->buf_offset = offset;
+	reader->crc_offset = 0;
+
+	if (reader->aio)
+		return huff_aio_seek(reader->aio, offset);
+
+	return fseeko(reader->file, (off_t)offset, SEEK_SET) ? -1 : 0;
+}
+
+/* Return the file offset of the next u8 to be read by reader. */
+u64 huff_reader_tell(huff_reader_t *reader)
+{
+	return reader->buf_offset + huff_io_consumed(reader);
+}
+
+/* Set *length to the length of the file read by reader.
+ * Return 0 if successful, otherwise -1, also if the file is not a regular file.
+ */
+int huff_reader_length(huff_reader_t *reader, u64 *length)
+{
+	struct stat st;
+
+	if (fstat(fileno(reader->file), &st) || !S_ISREG(st.st_mode))
+		return -1;
+
+	*length = (u64)st.st_size;
+	return 0;
+}
+
+/* Skip the remaining bits of the u8 being read, so that the next read starts
+ * at a u8 boundary.
+ */
+void huff_reader_align(huff_reader_t *reader)
+{
+	reader->minor_offset = 0;
+}
+
+/* Start computing the crc of the u8s read by reader from now on. */
+void huff_reader_crc_begin(huff_reader_t *reader)
+{
+	reader->is_crc = 1;
+	reader->crc = 0;
+	reader->crc_offset = huff_io_consumed(reader);
+}
+
+/* Return the crc of the u8s read since huff_reader_crc_begin(). */
+u32 huff_reader_crc_end(huff_reader_t *reader)
+{
+	huff_io_crc_update(reader, huff_io_consumed(reader));
+	reader->is_crc = 0;
+	return reader->crc;
 }
 
 /* Read one bit from the file read by reader. *bit will contain the value of the
@@ -209,22 +415,88 @@ int huff_read_u32(huff_reader_t *reader, u32 *lng)
 	return 0;
 }
 
+/* Read one variable length integer from the file read by reader. *val will
+ * contain the value read. See huff_write_varint() for the encoding.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_read_varint(huff_reader_t *reader, u64 *val)
+{
+	int shift = 0;
+	u8 ch;
+
+	*val = 0;
+	do {
+		if (shift > VARINT_MAX_SHIFT || huff_read_u8(reader, &ch))
+			return -1;
+
+		*val |= (u64)(ch & VARINT_MASK) << shift;
+		shift += VARINT_SHIFT;
+	} while (ch & VARINT_MORE);
+
+	return 0;
+}
+
+/* Double the size of a memory writer's major buffer, keeping what it holds,
+ * and continue writing after it.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_writer_grow(huff_writer_t *writer)
+{
+	u8 *buf;
+
+	if (!(buf = huff_calloc(2, writer->buf_size)))
+		return -1;
+
+	memcpy(buf, writer->major_buf, writer->buf_length);
+	huff_free(writer->stdio_buf);
+	writer->major_buf = writer->stdio_buf = buf;
+	writer->major_offset = writer->buf_length;
+	writer->buf_size *= 2;
+
+	return 0;
+}
+
 /* Write writer's major buffer into the file it writes to.
  * Return 0 if successful, otherwise -1.
  */
 static int huff_write_major_buf(huff_writer_t *writer)
 {
-	int i, ret;
+	u8 *buf;
+	int ret = 0;
+
+	if (writer->is_memory)
+		return huff_writer_grow(writer);
 
 	if (writer->major_offset)
 		writer->major_offset = 0;
 
-	ret = !(fwrite(writer->major_buf, sizeof(u8), writer->buf_length,
-		writer->file) == writer->buf_length);
+	huff_io_crc_update(writer, writer->buf_length);
+	writer->crc_offset = 0;
+
+	/* the buffer is handed to aio and writing continues into the next one
+	 * while it is being written */
+	if (writer->aio) {
+		huff_stage_begin(HUFF_STAGE_IO);
+		if (huff_aio_write(writer->aio, writer->buf_length) ||
+			!(buf = huff_aio_buffer(writer->aio))) {
+			ret = -1;
+		} else {
+			writer->major_buf = buf;
+		}
+		huff_stage_end(HUFF_STAGE_IO, writer->buf_length);
+	} else if (writer->file) {
+		/* a writer without a file discards what it writes */
+		huff_stage_begin(HUFF_STAGE_IO);
+		ret = !(fwrite(writer->major_buf, sizeof(u8),
+			writer->buf_length, writer->file) ==
+			writer->buf_length);
+		huff_stage_end(HUFF_STAGE_IO, writer->buf_length);
+	}
 
+	/* huff_write_minor_buf() stores whole u8s, so the buffer is not
+	 * cleared */
+	writer->buf_offset += writer->buf_length;
 	writer->buf_length = 0;
-	for (i = 0; i < MAX_MAJOR_BUF_SIZE; i++)
-		writer->major_buf[i] = 0;
 
 	return ret;
 }
@@ -236,7 +508,7 @@ static int huff_write_minor_buf(huff_writer_t *writer)
 {
 	writer->major_buf[writer->major_offset] = writer->minor_buf;
 	writer->major_offset++;
-	writer->major_offset %= MAX_MAJOR_BUF_SIZE;
+	writer->major_offset %= writer->buf_size;
 	writer->buf_length++;
 	writer->minor_buf = RESET_CHAR;
 
@@ -255,33 +527,209 @@ huff_writer_t *huff_writer_open(const char *wfile)
 	FILE *fd = NULL;
 	huff_writer_t *writer = NULL;
 
-	if (!(fd = fopen(wfile, "wb")) || !(writer = huff_writer_alloc())) {
+	if (!(fd = huff_io_fopen(wfile, O_WRONLY | O_CREAT | O_TRUNC, "wb")) ||
+		!(writer = huff_writer_attach(fd))) {
 		printf("the file %s can not be created\n", wfile);
 		return NULL;
 	}
 
+	return writer;
+}
+
+/* Create a new huff_writer_t for writing over the existing file wfile from
+ * offset on, without truncating it. huff_writer_tell() counts from offset.
+ * O_DIRECT is dropped where offset is not aligned as it needs.
+ * Return the new writer if successful in opening wfile and creating the
+ * writer, otherwise return NULL.
+ */
+huff_writer_t *huff_writer_open_at(const char *wfile, u64 offset)
+{
+	FILE *fd = NULL;
+	huff_writer_t *writer = NULL;
+	int flags;
+
+	if (!(fd = huff_io_fopen(wfile, O_WRONLY, "wb")))
+		goto Error;
+
+	if (offset % HUFF_AIO_ALIGN &&
+		(flags = fcntl(fileno(fd), F_GETFL)) >= 0 &&
+		(flags & O_DIRECT)) {
+		fcntl(fileno(fd), F_SETFL, flags & ~O_DIRECT);
+	}
+
+	if (fseeko(fd, (off_t)offset, SEEK_SET) ||
+		!(writer = huff_writer_attach(fd))) {
+		fclose(fd);
+		goto Error;
+	}
+	writer->buf_offset = offset;
+
+	return writer;
+
+Error:
+	printf("the file %s can not be written\n", wfile);
+	return NULL;
+}
+
+/* Create a new huff_writer_t for writing to the already open stream fd.
+ * Regular files are written asynchronously where possible, see
+ * huff_aio_open().
+ * Return the new writer if successful, otherwise return NULL.
+ */
+huff_writer_t *huff_writer_attach(FILE *fd)
+{
+	huff_writer_t *writer = NULL;
+
+	if (!fd || !(writer = huff_writer_alloc()))
+		return NULL;
+
 	writer->file = fd;
+	if (huff_io_setup(writer, 1)) {
+		if (writer->aio)
+			huff_aio_close(writer->aio);
+		huff_writer_free(writer);
+		return NULL;
+	}
+
+	return writer;
+}
+
+/* Create a new huff_writer_t which discards everything written to it. Used
+ * for measuring and verifying without creating a file.
+ * Return the new writer if successful, otherwise return NULL.
+ */
+huff_writer_t *huff_writer_discard(void)
+{
+	huff_writer_t *writer = NULL;
+
+	if (!(writer = huff_writer_alloc()))
+		return NULL;
+
+	if (huff_io_setup(writer, 1)) {
+		huff_writer_free(writer);
+		return NULL;
+	}
+
 	return writer;
 }
 
+/* Create a new huff_writer_t which keeps everything written to it in its
+ * major buffer, grown as needed, until huff_writer_memory_clear(). Used for
+ * decoding into memory a block at a time.
+ * Return the new writer if successful, otherwise return NULL.
+ */
+huff_writer_t *huff_writer_memory(void)
+{
+	huff_writer_t *writer;
+
+	if (!(writer = huff_writer_discard()))
+		return NULL;
+
+	writer->is_memory = 1;
+	return writer;
+}
+
+/* Return the u8s held by the memory writer, setting *length to their number.
+ * A bit pending in its minor buffer is not included.
+ */
+u8 *huff_writer_memory_data(huff_writer_t *writer, size_t *length)
+{
+	*length = writer->buf_length;
+	return writer->major_buf;
+}
+
+/* Drop the u8s held by the memory writer, keeping its buffer for the next
+ * ones. huff_writer_tell() goes on counting from where it was.
+ */
+void huff_writer_memory_clear(huff_writer_t *writer)
+{
+	writer->buf_offset += writer->buf_length;
+	writer->buf_length = 0;
+	writer->major_offset = 0;
+	writer->crc_offset = 0;
+}
+
 /* Close the file writer writes to and delete writer.
  * Return 0 if successful in closing the file, otherwise -1.
  */
 int huff_writer_close(huff_writer_t *writer)
 {
+	int ret;
+
 	if (writer->minor_offset && huff_write_minor_buf(writer))
 		return -1;
 
-	if (writer->buf_length && huff_write_major_buf(writer))
+	if (writer->buf_length && !writer->is_memory &&
+		huff_write_major_buf(writer)) {
 		return -1;
+	}
 
-	if (fclose(writer->file) == EOF)
-		return -1;
+	/* waiting for the writes in flight and flushing the stream is
+	 * accounted as io wait */
+	if (writer->file) {
+		huff_stage_begin(HUFF_STAGE_IO);
+		ret = writer->aio ? huff_aio_close(writer->aio) : 0;
+		if (fclose(writer->file) == EOF)
+			ret = -1;
+		huff_stage_end(HUFF_STAGE_IO, 0);
+		if (ret)
+			return -1;
+	}
 
 	huff_writer_free(writer);
 	return 0;
 }
 
+/* Return the file offset of the next u8 to be written by writer, which is
+ * expected to be at a u8 boundary.
+ */
+u64 huff_writer_tell(huff_writer_t *writer)
+{
+	return writer->buf_offset + writer->buf_length;
+}
+
+/* Pad the u8 being written with ZERO bits, so that the next write starts at a
+ * u8 boundary.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_writer_align(huff_writer_t *writer)
+{
+	if (!writer->minor_offset)
+		return 0;
+
+	writer->minor_offset = 0;
+	return huff_write_minor_buf(writer);
+}
+
+/* Start computing the crc of the u8s written by writer from now on. The
+ * writer is expected to be at a u8 boundary.
+ */
+void huff_writer_crc_begin(huff_writer_t *writer)
+{
+	writer->is_crc = 1;
+	writer->crc = 0;
+	writer->crc_offset = writer->major_offset;
+}
+
+/* Return the crc of the u8s written since huff_writer_crc_begin(). */
+u32 huff_writer_crc_end(huff_writer_t *writer)
+{
+	huff_io_crc_update(writer, writer->major_offset);
+	writer->is_crc = 0;
+	writer->freq = NULL;
+	return writer->crc;
+}
+
+/* Count the occurences of the u8s written into freq, a major buffer at a
+ * time as their crc is computed, up to huff_writer_crc_end(). Used for the
+ * statistics of the decoded characters, which the decoders do not count, so
+ * every u8 written must be of the ANSI character set.
+ */
+void huff_writer_count(huff_writer_t *writer, u64 *freq)
+{
+	writer->freq = freq;
+}
+
 /* Write one bit into the file that writer writes to.
  * Return 0 if successful, otherwise -1.
  */
@@ -350,3 +798,236 @@ int huff_write_u32(huff_writer_t *writer, u32 lng)
 	return 0;
 }
 
+/* Write val into the file that writer writes to as a variable length integer:
+ * 7 bits per u8, least significant first, where all u8s but the last have
+ * their most significant bit set. Values below 128 take a single u8.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_write_varint(huff_writer_t *writer, u64 val)
+{
+	u8 ch;
+
+	do {
+		ch = val & VARINT_MASK;
+		val >>= VARINT_SHIFT;
+		if (val)
+			ch |= VARINT_MORE;
+
+		if (huff_write_u8(writer, ch))
+			return -1;
+	} while (val);
+
+	return 0;
+}
+
+/* Point *buf at the u8s following the reader's position in its major buffer,
+ * up to len of them, reading the next major buffer if this one is consumed,
+ * and advance the reader past them. *buf is valid until the reader reads
+ * again. The reader must be at a u8 boundary.
+ * Return the number of u8s, 0 at the end of the file.
+ */
+size_t huff_read_span(huff_reader_t *reader, const u8 **buf, size_t len)
+{
+	size_t chunk;
+
+	if (!reader->major_offset && !huff_read_major_buf(reader))
+		return 0;
+
+	chunk = reader->buf_length - reader->major_offset;
+	if (chunk > len)
+		chunk = len;
+
+	*buf = reader->major_buf + reader->major_offset;
+	reader->major_offset += chunk;
+	reader->major_offset %= reader->buf_length;
+
+	return chunk;
+}
+
+/* Write the count least significant bits of bits, the most significant
+ * first, count <= 64.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_write_bits(huff_writer_t *writer, u64 bits, int count)
+{
+	for (; count >= BYTE; count -= BYTE) {
+		if (huff_write_u8(writer, (u8)(bits >> (count - BYTE))))
+			return -1;
+	}
+
+	while (count--) {
+		if (huff_write_bit(writer, (bits >> count) & 1 ? ONE : ZERO))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Copy len u8s from reader to writer, a major buffer chunk at a time. Both are
+ * expected to be at a u8 boundary. If freq is not NULL, the occurences of
+ * every character copied are counted in it.
+ * Return 0 if successful, otherwise -1, also if a character counted does not
+ * belong to the ANSI character set.
+ */
+int huff_io_copy(huff_reader_t *reader, huff_writer_t *writer, u64 len,
+	u64 *freq)
+{
+	size_t chunk, i;
+	u8 *src;
+
+	while (len) {
+		if (!reader->major_offset && !huff_read_major_buf(reader))
+			return -1;
+
+		chunk = reader->buf_length - reader->major_offset;
+		if (chunk > writer->buf_size - writer->major_offset)
+			chunk = writer->buf_size - writer->major_offset;
+		if (chunk > len)
+			chunk = (size_t)len;
+
+		src = reader->major_buf + reader->major_offset;
+		memcpy(writer->major_buf + writer->major_offset, src, chunk);
+		if (freq) {
+			for (i = 0; i < chunk; i++) {
+				if (src[i] >= ANSI_CHAR_SET_CARDINALITY)
+					return -1;
+				freq[src[i]]++;
+			}
+		}
+
+		reader->major_offset += chunk;
+		reader->major_offset %= reader->buf_length;
+		writer->major_offset += chunk;
+		writer->major_offset %= writer->buf_size;
+		writer->buf_length += chunk;
+		len -= chunk;
+
+		if (!writer->major_offset && huff_write_major_buf(writer))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Point the sink at the room left in its writer's major buffer. */
+static void huff_sink_point(huff_sink_t *sink)
+{
+	huff_writer_t *writer = sink->writer;
+
+	sink->cur = writer->major_buf + writer->major_offset;
+	sink->end = writer->major_buf + writer->buf_size;
+}
+
+/* Account the u8s stored by the sink since it was last pointed to its
+ * writer, writing the writer's major buffer if they fill it, and point the
+ * sink at the room left.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_sink_commit(huff_sink_t *sink)
+{
+	huff_writer_t *writer = sink->writer;
+	size_t stored = sink->cur - (writer->major_buf + writer->major_offset);
+
+	writer->major_offset += stored;
+	writer->major_offset %= writer->buf_size;
+	writer->buf_length += stored;
+	if (stored && !writer->major_offset && huff_write_major_buf(writer))
+		return -1;
+
+	huff_sink_point(sink);
+	return 0;
+}
+
+/* Start storing u8s into writer through sink.
+ * Return 0 if successful, -1 if writer is not at a u8 boundary.
+ */
+int huff_sink_begin(huff_sink_t *sink, huff_writer_t *writer)
+{
+	if (writer->minor_offset)
+		return -1;
+
+	sink->writer = writer;
+	huff_sink_point(sink);
+
+	return 0;
+}
+
+/* Store character once the major buffer is full, the slow path of
+ * HUFF_SINK_PUT().
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_sink_put(huff_sink_t *sink, u8 character)
+{
+	if (huff_sink_commit(sink))
+		return -1;
+
+	*sink->cur++ = character;
+	return 0;
+}
+
+/* Store the len u8s of buf, a major buffer's room at a time.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_sink_write(huff_sink_t *sink, const u8 *buf, size_t len)
+{
+	size_t chunk;
+
+	while (len) {
+		if (sink->cur == sink->end && huff_sink_commit(sink))
+			return -1;
+
+		chunk = sink->end - sink->cur;
+		if (chunk > len)
+			chunk = len;
+
+		memcpy(sink->cur, buf, chunk);
+		sink->cur += chunk;
+		buf += chunk;
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+/* Store count copies of character, a major buffer's room at a time.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_sink_fill(huff_sink_t *sink, u8 character, u64 count)
+{
+	size_t chunk;
+
+	while (count) {
+		if (sink->cur == sink->end && huff_sink_commit(sink))
+			return -1;
+
+		chunk = sink->end - sink->cur;
+		if (chunk > count)
+			chunk = (size_t)count;
+
+		memset(sink->cur, character, chunk);
+		sink->cur += chunk;
+		count -= chunk;
+	}
+
+	return 0;
+}
+
+/* Bring the sink's writer up to date with the u8s stored. The sink is not
+ * used afterwards.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_sink_end(huff_sink_t *sink)
+{
+	return huff_sink_commit(sink);
+}
+
+/* Return the number of u8s huff_write_varint() writes for val. */
+int huff_varint_length(u64 val)
+{
+	int length = 1;
+
+	while (val >>= VARINT_SHIFT)
+		length++;
+
+	return length;
+}
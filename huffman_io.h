@@ -3,33 +3,97 @@
 
 #include <stdio.h>
 #include "huffman.h"
+#include "huffman_aio.h"
 
-#define MAX_MAJOR_BUF_SIZE 1024
+#define HUFFMAN_IO_BUF_SIZE (1024 * 1024) /* default size of major_buf */
+#define HUFFMAN_IO_BUF_MIN HUFF_AIO_ALIGN
+#define HUFFMAN_IO_BUF_MAX (1024 * 1024 * 1024)
 #define MAX_MINOR_BUF_SIZE 8
 
 typedef struct huff_io_t {
 	FILE *file;
-	u8 major_buf[MAX_MAJOR_BUF_SIZE];
+	huff_aio_t *aio;	/* NULL if the file is read/written with stdio */
+	u8 *major_buf;		/* stdio_buf, or a buffer of aio */
+	u8 *stdio_buf;		/* NULL if aio is used */
+	size_t buf_size;	/* size of major_buf */
 	u8 minor_buf;
-	u16 major_offset;
+	size_t major_offset;
 	u8 minor_offset;
 	size_t buf_length;
+	u64 buf_offset;		/* file offset of major_buf */
+	int is_crc;		/* set between huff_*_crc_begin() and _end() */
+	u32 crc;		/* crc of the u8s preceding crc_offset */
+	size_t crc_offset;	/* major_buf offset up to which crc is kept */
+	u64 *freq;		/* if set, the u8s of the crc are counted in it */
+	int is_memory;		/* major_buf grows instead of being written */
 } huff_writer_t, huff_reader_t;
 
+/* A byte sink stores whole u8s straight into the major buffer of an aligned
+ * writer. The room left in the buffer is kept between cur and end, so that a
+ * u8 is stored with a compare and a store, and the writer is brought up to
+ * date, and its buffer written, only when the buffer fills or the sink ends.
+ * Nothing else may write to the writer between huff_sink_begin() and
+ * huff_sink_end().
+ */
+typedef struct huff_sink_t {
+	huff_writer_t *writer;
+	u8 *cur;
+	u8 *end;
+} huff_sink_t;
+
+#define HUFF_SINK_PUT(sink, ch) ((sink)->cur < (sink)->end ? \
+	(*(sink)->cur++ = (ch), 0) : huff_sink_put((sink), (ch)))
+
+/* io configuration, applied to readers and writers created afterwards */
+extern size_t huffman_io_buf_size;
+extern int huffman_io_direct;
+
 huff_reader_t *huff_reader_open(const char *rfile);
+huff_reader_t *huff_reader_attach(FILE *fd);
 int huff_reader_close(huff_reader_t *reader);
 u8 huff_reader_reset(huff_reader_t *reader);
+int huff_reader_seek(huff_reader_t *reader, u64 offset);
+u64 huff_reader_tell(huff_reader_t *reader);
+int huff_reader_length(huff_reader_t *reader, u64 *length);
+void huff_reader_align(huff_reader_t *reader);
+void huff_reader_crc_begin(huff_reader_t *reader);
+u32 huff_reader_crc_end(huff_reader_t *reader);
 int huff_read_bit(huff_reader_t *reader, bit_t *bit);
 int huff_read_u8(huff_reader_t *reader, u8 *character);
 int huff_read_u16(huff_reader_t *reader, u16 *srt);
 int huff_read_u32(huff_reader_t *reader, u32 *lng);
+int huff_read_varint(huff_reader_t *reader, u64 *val);
+size_t huff_read_span(huff_reader_t *reader, const u8 **buf, size_t len);
 
 huff_writer_t *huff_writer_open(const char *wfile);
+huff_writer_t *huff_writer_open_at(const char *wfile, u64 offset);
+huff_writer_t *huff_writer_attach(FILE *fd);
+huff_writer_t *huff_writer_discard(void);
+huff_writer_t *huff_writer_memory(void);
+u8 *huff_writer_memory_data(huff_writer_t *writer, size_t *length);
+void huff_writer_memory_clear(huff_writer_t *writer);
 int huff_writer_close(huff_writer_t *writer);
+u64 huff_writer_tell(huff_writer_t *writer);
+int huff_writer_align(huff_writer_t *writer);
+void huff_writer_crc_begin(huff_writer_t *writer);
+u32 huff_writer_crc_end(huff_writer_t *writer);
+void huff_writer_count(huff_writer_t *writer, u64 *freq);
 int huff_write_bit(huff_writer_t *writer, bit_t bit);
 int huff_write_u8(huff_writer_t *writer, u8 character);
 int huff_write_u16(huff_writer_t *writer, u16 srt);
 int huff_write_u32(huff_writer_t *writer, u32 lng);
+int huff_write_varint(huff_writer_t *writer, u64 val);
+int huff_write_bits(huff_writer_t *writer, u64 bits, int count);
+int huff_varint_length(u64 val);
+
+int huff_io_copy(huff_reader_t *reader, huff_writer_t *writer, u64 len,
+	u64 *freq);
+
+int huff_sink_begin(huff_sink_t *sink, huff_writer_t *writer);
+int huff_sink_put(huff_sink_t *sink, u8 character);
+int huff_sink_write(huff_sink_t *sink, const u8 *buf, size_t len);
+int huff_sink_fill(huff_sink_t *sink, u8 character, u64 count);
+int huff_sink_end(huff_sink_t *sink);
 
 #endif
 
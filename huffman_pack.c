@@ -0,0 +1,213 @@
+#include <string.h>
+#include "huffman_pack.h"
+#include "huffman_cpu.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HUFF_PACK_AVX2
+#define HUFF_PACK_LANES 8 /* characters merged per AVX2 step */
+#define HUFF_PACK_LANES_512 16 /* characters merged per AVX-512 step */
+#endif
+
+/* Build the table of the codes of the characters from their bit stacks, the
+ * characters without a code having a length of 0.
+ * Return 0 if successful, -1 if a code is longer than HUFF_PACK_MAX_CODE bits,
+ * in which case the codes are written a bit at a time.
+ */
+int huff_pack_init(huff_pack_t *pack, bit_t **codes)
+{
+	bit_t *bit;
+	int i;
+
+	memset(pack, 0, sizeof(huff_pack_t));
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		if (!codes[i])
+			continue;
+
+		for (bit = codes[i]; *bit != NO_BIT; bit++) {
+			if (pack->length[i] == HUFF_PACK_MAX_CODE)
+				return -1;
+
+			pack->code[i] = (pack->code[i] << 1) | (*bit == ONE);
+			pack->length[i]++;
+		}
+
+		if ((int)pack->length[i] > pack->max_length)
+			pack->max_length = pack->length[i];
+	}
+
+	return 0;
+}
+
+/* Append the count least significant bits of bits, count <= 64, writing the
+ * word they complete.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_pack_append(huff_pack_t *pack, huff_writer_t *writer,
+	u64 bits, int count)
+{
+	int room = HUFF_PACK_WORD - pack->fill;
+	u64 word;
+
+	if (count < room) {
+		pack->acc = (pack->acc << count) | bits;
+		pack->fill += count;
+		return 0;
+	}
+
+	word = room == HUFF_PACK_WORD ? bits :
+		(pack->acc << room) | (bits >> (count - room));
+	pack->fill = count - room;
+	pack->acc = pack->fill ? bits & ((1ULL << pack->fill) - 1) : 0;
+
+	return huff_write_bits(writer, word, HUFF_PACK_WORD);
+}
+
+#ifdef HUFF_PACK_AVX2
+/* Pack the codes of 8 characters per step: their codes and lengths are
+ * gathered, merged in pairs in 32 bit lanes, then the pairs in 64 bit lanes,
+ * leaving two runs of up to 64 bits appended in order. No code is longer than
+ * HUFF_PACK_VECTOR_CODE bits, so that no merge overflows its lane.
+ * Return the number of characters packed, or -1 on failure.
+ */
+__attribute__((target("avx2")))
+static long huff_pack_avx2(huff_pack_t *pack, huff_writer_t *writer,
+	const u8 *buf, size_t len)
+{
+	__m256i index, code, length, next_code, next_length, low;
+	unsigned long long run[4], run_length[4];
+	size_t done;
+
+	low = _mm256_set1_epi64x(0xFFFFFFFFLL);
+	for (done = 0; len - done >= HUFF_PACK_LANES;
+		done += HUFF_PACK_LANES) {
+		index = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+			(const __m128i *)(buf + done)));
+		code = _mm256_i32gather_epi32((const int *)pack->code, index,
+			sizeof(int));
+		length = _mm256_i32gather_epi32((const int *)pack->length,
+			index, sizeof(int));
+
+		/* the odd lanes follow the even lanes before them */
+		next_code = _mm256_srli_epi64(code, 32);
+		next_length = _mm256_srli_epi64(length, 32);
+		code = _mm256_and_si256(_mm256_or_si256(
+			_mm256_sllv_epi32(code, next_length), next_code), low);
+		length = _mm256_and_si256(_mm256_add_epi32(length,
+			next_length), low);
+
+		/* the odd pairs follow the even pairs before them */
+		next_code = _mm256_srli_si256(code, 8);
+		next_length = _mm256_srli_si256(length, 8);
+		code = _mm256_or_si256(_mm256_sllv_epi64(code, next_length),
+			next_code);
+		length = _mm256_add_epi64(length, next_length);
+
+		_mm256_storeu_si256((__m256i *)run, code);
+		_mm256_storeu_si256((__m256i *)run_length, length);
+		if (huff_pack_append(pack, writer, run[0], (int)run_length[0]) ||
+			huff_pack_append(pack, writer, run[2],
+			(int)run_length[2])) {
+			return -1;
+		}
+	}
+
+	return (long)done;
+}
+
+/* Pack the codes of 16 characters per step, as huff_pack_avx2() does 8,
+ * leaving four runs of up to 64 bits.
+ * Return the number of characters packed, or -1 on failure.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static long huff_pack_avx512(huff_pack_t *pack, huff_writer_t *writer,
+	const u8 *buf, size_t len)
+{
+	__m512i index, code, length, next_code, next_length, low;
+	unsigned long long run[8], run_length[8];
+	size_t done;
+	int i;
+
+	low = _mm512_set1_epi64(0xFFFFFFFFLL);
+	for (done = 0; len - done >= HUFF_PACK_LANES_512;
+		done += HUFF_PACK_LANES_512) {
+		index = _mm512_cvtepu8_epi32(_mm_loadu_si128(
+			(const __m128i *)(buf + done)));
+		code = _mm512_i32gather_epi32(index, pack->code, sizeof(int));
+		length = _mm512_i32gather_epi32(index, pack->length,
+			sizeof(int));
+
+		/* the odd lanes follow the even lanes before them */
+		next_code = _mm512_srli_epi64(code, 32);
+		next_length = _mm512_srli_epi64(length, 32);
+		code = _mm512_and_si512(_mm512_or_si512(
+			_mm512_sllv_epi32(code, next_length), next_code), low);
+		length = _mm512_and_si512(_mm512_add_epi32(length,
+			next_length), low);
+
+		/* the odd pairs follow the even pairs before them */
+		next_code = _mm512_bsrli_epi128(code, 8);
+		next_length = _mm512_bsrli_epi128(length, 8);
+		code = _mm512_or_si512(_mm512_sllv_epi64(code, next_length),
+			next_code);
+		length = _mm512_add_epi64(length, next_length);
+
+		_mm512_storeu_si512(run, code);
+		_mm512_storeu_si512(run_length, length);
+		for (i = 0; i < 8; i += 2) {
+			if (huff_pack_append(pack, writer, run[i],
+				(int)run_length[i])) {
+				return -1;
+			}
+		}
+	}
+
+	return (long)done;
+}
+#endif
+
+/* Pack the codes of the len characters of buf, each of which has a code.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_pack_write(huff_pack_t *pack, huff_writer_t *writer, const u8 *buf,
+	size_t len)
+{
+	size_t i = 0;
+#ifdef HUFF_PACK_AVX2
+	long done = 0;
+
+	if (pack->max_length <= HUFF_PACK_VECTOR_CODE) {
+		if (huff_cpu_level() >= HUFF_CPU_AVX512)
+			done = huff_pack_avx512(pack, writer, buf, len);
+		else if (huff_cpu_level() >= HUFF_CPU_AVX2)
+			done = huff_pack_avx2(pack, writer, buf, len);
+	}
+
+	if (done < 0)
+		return -1;
+	i = (size_t)done;
+#endif
+
+	for (; i < len; i++) {
+		if (huff_pack_append(pack, writer, pack->code[buf[i]],
+			pack->length[buf[i]])) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Write the bits appended that do not make a whole word.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_pack_flush(huff_pack_t *pack, huff_writer_t *writer)
+{
+	u64 acc = pack->acc;
+	int fill = pack->fill;
+
+	pack->fill = 0;
+	pack->acc = 0;
+
+	return huff_write_bits(writer, acc, fill);
+}
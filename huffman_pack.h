@@ -0,0 +1,34 @@
+#ifndef _HUFFMAN_PACK_H_
+#define _HUFFMAN_PACK_H_
+
+#include <stddef.h>
+#include "huffman.h"
+#include "huffman_io.h"
+
+/* Packing the codes of a block's characters into the bits written: every
+ * character's code and length are kept in a table, looked up for a run of
+ * characters at a time and merged into 64 bit words, which are written a
+ * word at a time instead of a bit at a time. Where no code is longer than
+ * HUFF_PACK_VECTOR_CODE bits, 8 characters (AVX2) or 16 (AVX-512) are looked
+ * up and merged per step in vector registers, by the level of huffman_cpu.h.
+ */
+#define HUFF_PACK_MAX_CODE 32 /* bits of the longest code packed */
+#define HUFF_PACK_VECTOR_CODE 16 /* bits of the longest code merged in pairs */
+#define HUFF_PACK_WORD 64
+
+typedef struct huff_pack_t {
+	/* 32 bit lanes, as gathered */
+	unsigned int code[ANSI_CHAR_SET_CARDINALITY];
+	unsigned int length[ANSI_CHAR_SET_CARDINALITY];
+	int max_length;
+	u64 acc;	/* the fill bits not yet written */
+	int fill;
+} huff_pack_t;
+
+int huff_pack_init(huff_pack_t *pack, bit_t **codes);
+int huff_pack_write(huff_pack_t *pack, huff_writer_t *writer, const u8 *buf,
+	size_t len);
+int huff_pack_flush(huff_pack_t *pack, huff_writer_t *writer);
+
+#endif
+
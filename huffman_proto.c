@@ -0,0 +1,112 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "huffman_proto.h"
+
+#define HUFF_PROTO_FDS 2
+
+/* Send a request of opcode op on sock, along with in_fd and out_fd.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_proto_send_request(int sock, u8 op, int in_fd, int out_fd)
+{
+	char control[CMSG_SPACE(HUFF_PROTO_FDS * sizeof(int))];
+	int fds[HUFF_PROTO_FDS] = {in_fd, out_fd};
+	struct iovec iov = {&op, sizeof(op)};
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	while (sendmsg(sock, &msg, 0) != sizeof(op)) {
+		if (errno != EINTR)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Receive a request from sock into *op, *in_fd and *out_fd.
+ * Return 1 if the peer closed the connection, 0 if a request was received and
+ * -1 on failure.
+ */
+int huff_proto_recv_request(int sock, u8 *op, int *in_fd, int *out_fd)
+{
+	char control[CMSG_SPACE(HUFF_PROTO_FDS * sizeof(int))];
+	int fds[HUFF_PROTO_FDS];
+	struct iovec iov = {op, sizeof(*op)};
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	ssize_t len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	while ((len = recvmsg(sock, &msg, 0)) < 0) {
+		if (errno != EINTR)
+			return -1;
+	}
+
+	if (!len)
+		return 1;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+		cmsg->cmsg_type != SCM_RIGHTS ||
+		cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+		return -1;
+	}
+
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+	*in_fd = fds[0];
+	*out_fd = fds[1];
+
+	return 0;
+}
+
+/* Write or read the len u8s of buf to or from sock.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_proto_transfer(int sock, void *buf, size_t len, int is_write)
+{
+	ssize_t done;
+
+	while (len) {
+		done = is_write ? write(sock, buf, len) : read(sock, buf, len);
+		if (done < 0 && errno == EINTR)
+			continue;
+		if (done <= 0)
+			return -1;
+
+		buf = (u8*)buf + done;
+		len -= done;
+	}
+
+	return 0;
+}
+
+int huff_proto_send_reply(int sock, huff_reply_t *reply)
+{
+	return huff_proto_transfer(sock, reply, sizeof(*reply), 1);
+}
+
+int huff_proto_recv_reply(int sock, huff_reply_t *reply)
+{
+	return huff_proto_transfer(sock, reply, sizeof(*reply), 0);
+}
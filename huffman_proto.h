@@ -0,0 +1,30 @@
+#ifndef _HUFFMAN_PROTO_H_
+#define _HUFFMAN_PROTO_H_
+
+#include "huffman.h"
+
+/* The protocol between huffmand and its client over a Unix domain socket. A
+ * request is a u8 opcode sent along with two file descriptors (SCM_RIGHTS):
+ * the file to read and the file to write, so that the payload is not copied
+ * through the socket. The daemon codes the one into the other and replies
+ * with a huff_reply_t. A connection carries any number of requests.
+ */
+#define HUFFMAN_DAEMON_SOCKET "/tmp/huffmand.sock"
+#define HUFFMAN_REQUEST_ENCODE 'e'
+#define HUFFMAN_REQUEST_DECODE 'd'
+#define HUFFMAN_REPLY_OK 0
+#define HUFFMAN_REPLY_FAIL 1
+
+typedef struct huff_reply_t {
+	u64 status;
+	u64 in_length;	/* u8s read */
+	u64 out_length;	/* u8s written */
+} huff_reply_t;
+
+int huff_proto_send_request(int sock, u8 op, int in_fd, int out_fd);
+int huff_proto_recv_request(int sock, u8 *op, int *in_fd, int *out_fd);
+int huff_proto_send_reply(int sock, huff_reply_t *reply);
+int huff_proto_recv_reply(int sock, huff_reply_t *reply);
+
+#endif
+
@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "huffman_stats.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+#define KILO_BYTE 1024
+
+/* Every allocation is prefixed by its size so that huff_free() can account
+ * for it. The union keeps the returned memory suitably aligned.
+ */
+typedef union huff_alloc_header_t {
+	size_t size;
+	long double align;
+} huff_alloc_header_t;
+
+huff_stage_stat_t huff_stage_stats[HUFF_STAGE_COUNT] = {
+	[HUFF_STAGE_PARSE] = {"parse"},
+	[HUFF_STAGE_TREE] = {"tree"},
+	[HUFF_STAGE_DICTIONARY] = {"dictionary"},
+	[HUFF_STAGE_HEADER] = {"header"},
+	[HUFF_STAGE_DATA] = {"data"},
+	[HUFF_STAGE_IO] = {"io"},
+	[HUFF_STAGE_TOTAL] = {"total"},
+};
+
+huff_alloc_stat_t huff_alloc_stats;
+
+/* Return the current time of the monotonic clock in nanoseconds. */
+u64 huff_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* Mark the beginning of a run of stage. */
+void huff_stage_begin(huff_stage_t stage)
+{
+	huff_stage_stat_t *stat = &huff_stage_stats[stage];
+
+	stat->active = 1;
+	if (stat->alloc.peak < huff_alloc_stats.in_use)
+		stat->alloc.peak = huff_alloc_stats.in_use;
+	stat->start = huff_clock();
+}
+
+/* Mark the end of a run of stage which processed bytes bytes. */
+void huff_stage_end(huff_stage_t stage, u64 bytes)
+{
+	huff_stage_stat_t *stat = &huff_stage_stats[stage];
+
+	stat->elapsed += huff_clock() - stat->start;
+	stat->bytes += bytes;
+	stat->count++;
+	stat->active = 0;
+}
+
+/* Account an allocation of size bytes in alloc. */
+static void huff_alloc_account(huff_alloc_stat_t *alloc, size_t size)
+{
+	alloc->allocations++;
+	alloc->bytes += size;
+	alloc->in_use += size;
+	if (alloc->peak < alloc->in_use)
+		alloc->peak = alloc->in_use;
+}
+
+/* calloc() replacement which accounts the allocation globally and for every
+ * stage that is currently running. Per stage peaks are of the global usage.
+ * Return the allocated memory, or NULL on failure.
+ */
+void *huff_calloc(size_t nmemb, size_t size)
+{
+	huff_alloc_header_t *header = NULL;
+	int i;
+
+	/* calloc() fails rather than wrap around, as must its replacement */
+	if (nmemb && size > (SIZE_MAX - sizeof(huff_alloc_header_t)) / nmemb)
+		return NULL;
+
+	size *= nmemb;
+	if (!(header = calloc(1, sizeof(huff_alloc_header_t) + size)))
+		return NULL;
+
+	header->size = size;
+	huff_alloc_account(&huff_alloc_stats, size);
+	for (i = 0; i < HUFF_STAGE_COUNT; i++) {
+		huff_stage_stat_t *stat = &huff_stage_stats[i];
+
+		if (!stat->active)
+			continue;
+
+		stat->alloc.allocations++;
+		stat->alloc.bytes += size;
+		if (stat->alloc.peak < huff_alloc_stats.in_use)
+			stat->alloc.peak = huff_alloc_stats.in_use;
+	}
+
+	return header + 1;
+}
+
+/* free() replacement for memory allocated by huff_calloc(). */
+void huff_free(void *ptr)
+{
+	huff_alloc_header_t *header = NULL;
+
+	if (!ptr)
+		return;
+
+	header = (huff_alloc_header_t*)ptr - 1;
+	huff_alloc_stats.in_use -= header->size;
+	free(header);
+}
+
+/* Return the peak resident set size of the process in bytes. */
+u64 huff_peak_rss(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+
+	return (u64)usage.ru_maxrss * KILO_BYTE;
+}
+
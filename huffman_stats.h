@@ -0,0 +1,52 @@
+#ifndef _HUFFMAN_STATS_H_
+#define _HUFFMAN_STATS_H_
+
+#include <stddef.h>
+#include "huffman.h"
+
+/* Stages timed during encoding and decoding. HUFF_STAGE_IO accumulates the
+ * time spent waiting on reads and writes, which is also included in the wall
+ * time of the stage that issued them.
+ */
+typedef enum huff_stage_t {
+	HUFF_STAGE_PARSE = 0,
+	HUFF_STAGE_TREE = 1,
+	HUFF_STAGE_DICTIONARY = 2,
+	HUFF_STAGE_HEADER = 3,
+	HUFF_STAGE_DATA = 4,
+	HUFF_STAGE_IO = 5,
+	HUFF_STAGE_TOTAL = 6,
+	HUFF_STAGE_COUNT = 7,
+} huff_stage_t;
+
+/* heap accounting, kept by huff_calloc()/huff_free() */
+typedef struct huff_alloc_stat_t {
+	u64 allocations;	/* number of allocations */
+	u64 bytes;		/* bytes allocated */
+	u64 in_use;		/* bytes currently allocated */
+	u64 peak;		/* maximal value of in_use */
+} huff_alloc_stat_t;
+
+typedef struct huff_stage_stat_t {
+	char *name;
+	u64 start;	/* ns, monotonic clock */
+	u64 elapsed;	/* ns */
+	u64 bytes;	/* bytes processed by the stage */
+	u32 count;	/* number of times the stage was run */
+	int active;	/* between huff_stage_begin() and huff_stage_end() */
+	huff_alloc_stat_t alloc; /* allocations made while the stage ran */
+} huff_stage_stat_t;
+
+extern huff_stage_stat_t huff_stage_stats[HUFF_STAGE_COUNT];
+extern huff_alloc_stat_t huff_alloc_stats;
+
+u64 huff_clock(void);
+void huff_stage_begin(huff_stage_t stage);
+void huff_stage_end(huff_stage_t stage, u64 bytes);
+
+void *huff_calloc(size_t nmemb, size_t size);
+void huff_free(void *ptr);
+u64 huff_peak_rss(void);
+
+#endif
+
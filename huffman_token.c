@@ -0,0 +1,772 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "huffman_token.h"
+#include "huffman_stats.h"
+
+#define HUFF_TOKEN_HASH_SIZE (1UL << 17) /* slots, a power of 2 */
+#define HUFF_TOKEN_HASH_FULL (HUFF_TOKEN_HASH_SIZE >> 1) /* tokens kept */
+#define HUFF_TOKEN_FNV_BASIS 0xCBF29CE484222325ULL
+#define HUFF_TOKEN_FNV_PRIME 0x100000001B3ULL
+#define HUFF_TOKEN_NONE 0 /* the symbol of a token that is not a word */
+#define HUFF_TOKEN_SYMBOLS(words) (ANSI_CHAR_SET_CARDINALITY + (words))
+#define HUFF_TOKEN_ACC_BITS 64
+
+/* a distinct token of the block: its first occurrence and its count */
+typedef struct huff_token_slot_t {
+	u32 start;
+	u32 count;
+	u32 symbol;	/* of its word, HUFF_TOKEN_NONE if not a word */
+	u8 length;	/* 0 for an empty slot */
+} huff_token_slot_t;
+
+/* a token that may become a word and the bits it is expected to save */
+typedef struct huff_token_candidate_t {
+	double gain;
+	u32 slot;
+} huff_token_candidate_t;
+
+/* A decoding table entry: the symbol whose code the next HUFF_TOKEN_TABLE_LOG
+ * bits start with and the length of its code, 0 if it is longer.
+ */
+typedef struct huff_token_entry_t {
+	u16 symbol;
+	u8 length;
+} huff_token_entry_t;
+
+/* the block coded and its tokens, an open addressing hash table of them */
+static u8 *block;
+static huff_token_slot_t *slots;
+static u64 token_count;
+
+/* the words, the slots of the tokens chosen, and the code of every symbol:
+ * the ANSI characters, then the words */
+static u32 words[HUFF_TOKEN_MAX_WORDS];
+static u32 word_count;
+static u64 *symbol_frequency;
+static u8 *code_length;
+static u32 *code;
+static u64 data_length; /* bits of the coded block */
+
+/* the weights that huff_token_compare() sorts symbols by */
+static u64 *sort_weight;
+
+/* Return 1 if ch is a character of words, otherwise 0. */
+static int huff_token_is_word(u8 ch)
+{
+	return (ch >= '0' && ch <= '9') || (ch >= 'A' && ch <= 'Z') ||
+		(ch >= 'a' && ch <= 'z') || ch == '_';
+}
+
+/* Return the end of the token of buf starting at pos: the run of word
+ * characters, or of other characters, of up to HUFF_TOKEN_MAX_LENGTH u8s.
+ */
+static u64 huff_token_end(const u8 *buf, u64 pos, u64 end)
+{
+	int is_word = huff_token_is_word(buf[pos]);
+
+	if (end - pos > HUFF_TOKEN_MAX_LENGTH)
+		end = pos + HUFF_TOKEN_MAX_LENGTH;
+
+	pos++;
+	while (pos < end && huff_token_is_word(buf[pos]) == is_word)
+		pos++;
+
+	return pos;
+}
+
+/* Return the slot of the token of len u8s at buf, or the empty slot it would
+ * take.
+ */
+static huff_token_slot_t *huff_token_find(const u8 *buf, u64 len)
+{
+	u64 hash = HUFF_TOKEN_FNV_BASIS, i;
+
+	for (i = 0; i < len; i++)
+		hash = (hash ^ buf[i]) * HUFF_TOKEN_FNV_PRIME;
+
+	i = hash & (HUFF_TOKEN_HASH_SIZE - 1);
+	while (slots[i].length && (slots[i].length != len ||
+		memcmp(block + slots[i].start, buf, len))) {
+		i = (i + 1) & (HUFF_TOKEN_HASH_SIZE - 1);
+	}
+
+	return slots + i;
+}
+
+/* Count the tokens of the block. Once HUFF_TOKEN_HASH_FULL distinct tokens
+ * are kept, new tokens are not, and are coded as their characters.
+ */
+static void huff_token_count(void)
+{
+	huff_token_slot_t *slot;
+	u64 pos, end, kept = 0;
+
+	for (pos = 0, token_count = 0; pos < block_length; pos = end) {
+		end = huff_token_end(block, pos, block_length);
+		slot = huff_token_find(block + pos, end - pos);
+		token_count++;
+
+		if (slot->length) {
+			slot->count++;
+		} else if (kept < HUFF_TOKEN_HASH_FULL) {
+			slot->start = (u32)pos;
+			slot->length = (u8)(end - pos);
+			slot->count = 1;
+			kept++;
+		}
+	}
+}
+
+static int huff_token_gain_compare(const void *a, const void *b)
+{
+	const huff_token_candidate_t *x = a, *y = b;
+
+	if (x->gain != y->gain)
+		return x->gain < y->gain ? 1 : -1;
+
+	return x->slot < y->slot ? -1 : x->slot > y->slot;
+}
+
+/* Choose the words: the tokens whose characters, coded at about the entropy
+ * of the block's characters, take more bits than the token coded as one
+ * symbol, by more than its place in the header, up to HUFF_TOKEN_MAX_WORDS
+ * of those saving the most.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_token_select(void)
+{
+	huff_token_candidate_t *candidates;
+	double entropy = 0, p, gain;
+	huff_token_slot_t *slot;
+	u64 n = 0, i;
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++) {
+		if (frequency[i]) {
+			p = (double)frequency[i] / block_length;
+			entropy -= p * log2(p);
+		}
+	}
+
+	if (!(candidates = huff_calloc(HUFF_TOKEN_HASH_FULL,
+		sizeof(huff_token_candidate_t)))) {
+		return -1;
+	}
+
+	for (i = 0; i < HUFF_TOKEN_HASH_SIZE; i++) {
+		slot = slots + i;
+		if (slot->length < 2 || slot->count < 2)
+			continue;
+
+		gain = slot->count * (slot->length * entropy -
+			log2((double)token_count / slot->count)) -
+			(1 + slot->length + 1) * BYTE;
+		if (gain > 0) {
+			candidates[n].gain = gain;
+			candidates[n++].slot = (u32)i;
+		}
+	}
+	qsort(candidates, n, sizeof(huff_token_candidate_t),
+		huff_token_gain_compare);
+
+	word_count = (u32)(n < HUFF_TOKEN_MAX_WORDS ? n : HUFF_TOKEN_MAX_WORDS);
+	for (i = 0; i < word_count; i++) {
+		words[i] = candidates[i].slot;
+		slots[words[i]].symbol = HUFF_TOKEN_SYMBOLS(i);
+	}
+
+	huff_free(candidates);
+	return 0;
+}
+
+/* Count every symbol of the block in symbol_frequency: a word as its symbol
+ * and any other token as its characters.
+ */
+static void huff_token_frequencies(void)
+{
+	huff_token_slot_t *slot;
+	u64 pos, end;
+
+	for (pos = 0; pos < block_length; pos = end) {
+		end = huff_token_end(block, pos, block_length);
+		slot = huff_token_find(block + pos, end - pos);
+		if (slot->length && slot->symbol != HUFF_TOKEN_NONE) {
+			symbol_frequency[slot->symbol]++;
+			continue;
+		}
+
+		for (; pos < end; pos++)
+			symbol_frequency[block[pos]]++;
+	}
+}
+
+static int huff_token_compare(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	if (sort_weight[x] != sort_weight[y])
+		return sort_weight[x] < sort_weight[y] ? -1 : 1;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Compute the huffman code length of each of the n symbols from their
+ * weights, with the two queue method: the leaves sorted by weight and the
+ * internal nodes, which are created in order of weight. The weights are
+ * halved until no code is longer than HUFF_TOKEN_MAX_CODE.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_token_code_lengths(u64 *weight, u64 n, u8 *lengths)
+{
+	u64 *node_weight = NULL, m = 0, i, leaf, node, next, pick, max;
+	u32 *order = NULL, *parent = NULL, *depth = NULL;
+	int j, ret = -1;
+
+	if (!(order = huff_calloc(n, sizeof(u32))) ||
+		!(node_weight = huff_calloc(2 * n, sizeof(u64))) ||
+		!(parent = huff_calloc(2 * n, sizeof(u32))) ||
+		!(depth = huff_calloc(2 * n, sizeof(u32)))) {
+		goto Exit;
+	}
+
+	for (i = 0; i < n; i++) {
+		lengths[i] = 0;
+		if (weight[i])
+			order[m++] = (u32)i;
+	}
+	if (m < 2) {
+		if (m)
+			lengths[order[0]] = 1;
+		ret = 0;
+		goto Exit;
+	}
+
+	do {
+		sort_weight = weight;
+		qsort(order, m, sizeof(u32), huff_token_compare);
+		for (i = 0; i < m; i++)
+			node_weight[i] = weight[order[i]];
+
+		/* every internal node joins the two lightest nodes left */
+		for (leaf = 0, node = m, next = m; next < 2 * m - 1; next++) {
+			node_weight[next] = 0;
+			for (j = 0; j < 2; j++) {
+				if (leaf < m && (node == next ||
+					node_weight[leaf] <= node_weight[node])) {
+					pick = leaf++;
+				} else {
+					pick = node++;
+				}
+				parent[pick] = (u32)next;
+				node_weight[next] += node_weight[pick];
+			}
+		}
+
+		/* a node is one deeper than its parent, created after it */
+		depth[2 * m - 2] = 0;
+		for (i = 2 * m - 2, max = 0; i-- > 0;) {
+			depth[i] = depth[parent[i]] + 1;
+			if (i < m && depth[i] > max)
+				max = depth[i];
+		}
+
+		if (max > HUFF_TOKEN_MAX_CODE) {
+			for (i = 0; i < n; i++) {
+				if (weight[i])
+					weight[i] = (weight[i] >> 1) | 1;
+			}
+		}
+	} while (max > HUFF_TOKEN_MAX_CODE);
+
+	for (i = 0; i < m; i++)
+		lengths[order[i]] = (u8)depth[i];
+	ret = 0;
+
+Exit:
+	huff_free(depth);
+	huff_free(parent);
+	huff_free(node_weight);
+	huff_free(order);
+	return ret;
+}
+
+/* Assign the canonical code of the n symbols from their lengths: the codes
+ * of a length are consecutive, in the order of the symbols, and follow those
+ * of the shorter lengths. If first is not NULL, the first code of every
+ * length is kept in it.
+ */
+static void huff_token_canonical(u8 *lengths, u64 n, u32 *codes, u32 *first)
+{
+	u32 count[HUFF_TOKEN_MAX_CODE + 1], next[HUFF_TOKEN_MAX_CODE + 1];
+	u64 i;
+	int len;
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < n; i++)
+		count[lengths[i]]++;
+
+	count[0] = 0;
+	next[0] = 0;
+	for (len = 1; len <= HUFF_TOKEN_MAX_CODE; len++)
+		next[len] = (next[len - 1] + count[len - 1]) << 1;
+	if (first)
+		memcpy(first, next, sizeof(next));
+
+	for (i = 0; i < n; i++) {
+		if (lengths[i])
+			codes[i] = next[lengths[i]]++;
+	}
+}
+
+/* Return the number of bits of the token block header: the block type, the
+ * block length, the words, the code length of every symbol and the length of
+ * the coded data.
+ */
+static u64 huff_token_header_length(void)
+{
+	u64 bytes = 1 + huff_varint_length(block_length) +
+		huff_varint_length(word_count) +
+		HUFF_TOKEN_SYMBOLS(word_count) + huff_varint_length(data_length);
+	u32 i;
+
+	for (i = 0; i < word_count; i++)
+		bytes += 1 + slots[words[i]].length;
+
+	return bytes * BYTE;
+}
+
+/* Read the block into memory, choose its words and compute its code.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_token_prepare(huff_reader_t *reader, u64 block_start)
+{
+	u64 *weight, symbols, i;
+	int ret;
+
+	if (!(block = huff_calloc(block_length, sizeof(u8))) ||
+		!(slots = huff_calloc(HUFF_TOKEN_HASH_SIZE,
+		sizeof(huff_token_slot_t)))) {
+		return -1;
+	}
+
+	ASSERT(huff_reader_seek(reader, block_start));
+	for (i = 0; i < block_length; i++)
+		ASSERT(huff_read_u8(reader, block + i));
+
+	huff_token_count();
+	ASSERT(huff_token_select());
+
+	symbols = HUFF_TOKEN_SYMBOLS(word_count);
+	if (!(symbol_frequency = huff_calloc(symbols, sizeof(u64))) ||
+		!(code_length = huff_calloc(symbols, sizeof(u8))) ||
+		!(code = huff_calloc(symbols, sizeof(u32)))) {
+		return -1;
+	}
+
+	huff_token_frequencies();
+
+	/* the lengths are computed from a copy, which may be scaled */
+	if (!(weight = huff_calloc(symbols, sizeof(u64))))
+		return -1;
+	memcpy(weight, symbol_frequency, symbols * sizeof(u64));
+	ret = huff_token_code_lengths(weight, symbols, code_length);
+	huff_free(weight);
+	ASSERT(ret);
+
+	huff_token_canonical(code_length, symbols, code, NULL);
+	for (data_length = 0, i = 0; i < symbols; i++)
+		data_length += symbol_frequency[i] * code_length[i];
+
+	return 0;
+}
+
+/* Compute the number of bits the block of block_length characters at
+ * block_start would take as a token block, padded to a u8 boundary, into
+ * length. The reader is left at the end of the block, which is kept in
+ * memory for huff_token_encode() until huff_token_free() is called.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_token_length(huff_reader_t *reader, u64 block_start, u64 *length)
+{
+	u64 bits;
+
+	huff_token_free();
+	if (huff_token_prepare(reader, block_start)) {
+		huff_token_free();
+		return -1;
+	}
+
+	bits = huff_token_header_length() + data_length;
+	*length = bits + (BYTE - bits % BYTE) % BYTE;
+
+	return 0;
+}
+
+static int huff_token_write_header(huff_writer_t *writer)
+{
+	huff_token_slot_t *slot;
+	u64 i, j;
+
+	/* statistics */
+	file_stats.compressed_length += huff_token_header_length();
+
+	if (huff_write_u8(writer, HUFFMAN_BLOCK_TOKEN) ||
+		huff_write_varint(writer, block_length) ||
+		huff_write_varint(writer, word_count)) {
+		return -1;
+	}
+
+	for (i = 0; i < word_count; i++) {
+		slot = slots + words[i];
+		ASSERT(huff_write_u8(writer, slot->length));
+		for (j = 0; j < slot->length; j++)
+			ASSERT(huff_write_u8(writer, block[slot->start + j]));
+	}
+
+	for (i = 0; i < HUFF_TOKEN_SYMBOLS(word_count); i++)
+		ASSERT(huff_write_u8(writer, code_length[i]));
+
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++)
+		representation_length[i] = code_length[i];
+
+	return huff_write_varint(writer, data_length);
+}
+
+/* Append the code of symbol to the bits of acc, writing every u8 completed.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_token_put(huff_writer_t *writer, u64 *acc, int *cnt,
+	u32 symbol)
+{
+	*acc = (*acc << code_length[symbol]) | code[symbol];
+	*cnt += code_length[symbol];
+
+	for (; *cnt >= BYTE; *cnt -= BYTE) {
+		if (huff_write_u8(writer, (u8)(*acc >> (*cnt - BYTE))))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Code the tokens of the block, the bits of every code from the most
+ * significant, and pad the last u8 with zeros.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_token_write_data(huff_writer_t *writer)
+{
+	huff_token_slot_t *slot;
+	u64 acc = 0, pos, end;
+	int cnt = 0;
+
+	for (pos = 0; pos < block_length; pos = end) {
+		end = huff_token_end(block, pos, block_length);
+		slot = huff_token_find(block + pos, end - pos);
+		if (slot->length && slot->symbol != HUFF_TOKEN_NONE) {
+			ASSERT(huff_token_put(writer, &acc, &cnt, slot->symbol));
+			continue;
+		}
+
+		for (; pos < end; pos++)
+			ASSERT(huff_token_put(writer, &acc, &cnt, block[pos]));
+	}
+
+	if (cnt && huff_write_u8(writer, (u8)(acc << (BYTE - cnt))))
+		return -1;
+
+	/* statistics */
+	file_stats.compressed_length += data_length;
+	file_stats.coded_length += data_length;
+
+	return 0;
+}
+
+/* Write the block read by huff_token_length() as a token block. If
+ * is_estimate is set, the data is not written and its length is that
+ * computed by huff_token_length().
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_token_encode(huff_writer_t *writer, int is_estimate)
+{
+	u64 header_start = file_stats.compressed_length;
+
+	huff_stage_begin(HUFF_STAGE_HEADER);
+	ASSERT(huff_token_write_header(writer));
+	huff_stage_end(HUFF_STAGE_HEADER,
+		(file_stats.compressed_length - header_start) / BYTE);
+
+	if (is_estimate) {
+		file_stats.compressed_length += data_length;
+		file_stats.coded_length += data_length;
+		return 0;
+	}
+
+	huff_stage_begin(HUFF_STAGE_DATA);
+	ASSERT(huff_token_write_data(writer));
+	huff_stage_end(HUFF_STAGE_DATA, block_length);
+
+	return 0;
+}
+
+/* Release the block read by huff_token_length() and its code. */
+void huff_token_free(void)
+{
+	huff_free(code);
+	huff_free(code_length);
+	huff_free(symbol_frequency);
+	huff_free(slots);
+	huff_free(block);
+	code = NULL;
+	code_length = NULL;
+	symbol_frequency = NULL;
+	slots = NULL;
+	block = NULL;
+	word_count = 0;
+}
+
+/* The code of a token block, as read from its header. */
+typedef struct huff_token_code_t {
+	u64 word_count;
+	u8 *word;		/* the characters of the words, one after the other */
+	u32 *word_start;
+	u8 *lengths;		/* the code length of every symbol */
+	u32 count[HUFF_TOKEN_MAX_CODE + 1];	/* codes of every length */
+	u32 first[HUFF_TOKEN_MAX_CODE + 1];	/* first code of every length */
+	u32 offset[HUFF_TOKEN_MAX_CODE + 1];	/* of it in sorted */
+	u16 *sorted;		/* the symbols in the order of their codes */
+	huff_token_entry_t table[1 << HUFF_TOKEN_TABLE_LOG];
+	u64 data_length;
+} huff_token_code_t;
+
+/* Read the header of a token block, following its block type, into
+ * block_length and tc.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_token_read_header(huff_reader_t *reader,
+	huff_token_code_t *tc)
+{
+	u64 symbols, i, start = 0;
+	u8 length;
+
+	if (huff_read_varint(reader, &block_length) || !block_length ||
+		block_length > HUFFMAN_BLOCK_SIZE ||
+		huff_read_varint(reader, &tc->word_count) ||
+		tc->word_count > HUFF_TOKEN_MAX_WORDS) {
+		return -1;
+	}
+	symbols = HUFF_TOKEN_SYMBOLS(tc->word_count);
+
+	if (!(tc->word = huff_calloc(tc->word_count * HUFF_TOKEN_MAX_LENGTH + 1,
+		sizeof(u8))) ||
+		!(tc->word_start = huff_calloc(tc->word_count + 1,
+		sizeof(u32))) ||
+		!(tc->lengths = huff_calloc(symbols, sizeof(u8))) ||
+		!(tc->sorted = huff_calloc(symbols, sizeof(u16)))) {
+		return -1;
+	}
+
+	for (i = 0; i < tc->word_count; i++) {
+		if (huff_read_u8(reader, &length) || !length ||
+			length > HUFF_TOKEN_MAX_LENGTH) {
+			return -1;
+		}
+
+		tc->word_start[i] = (u32)start;
+		for (; length; length--, start++) {
+			if (huff_read_u8(reader, tc->word + start) ||
+				tc->word[start] >= ANSI_CHAR_SET_CARDINALITY) {
+				return -1;
+			}
+		}
+	}
+	tc->word_start[i] = (u32)start;
+
+	for (i = 0; i < symbols; i++) {
+		if (huff_read_u8(reader, tc->lengths + i) ||
+			tc->lengths[i] > HUFF_TOKEN_MAX_CODE) {
+			return -1;
+		}
+	}
+
+	return huff_read_varint(reader, &tc->data_length);
+}
+
+/* Create the decoding table and the symbols sorted by code from the code
+ * lengths. A code that is not a prefix code is refused.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_token_build_table(huff_token_code_t *tc)
+{
+	u64 symbols = HUFF_TOKEN_SYMBOLS(tc->word_count), i, k, fill;
+	u32 *codes, pos[HUFF_TOKEN_MAX_CODE + 1];
+	long left = 1;
+	int len;
+
+	memset(tc->count, 0, sizeof(tc->count));
+	for (i = 0; i < symbols; i++) {
+		if (tc->lengths[i])
+			tc->count[tc->lengths[i]]++;
+	}
+
+	for (len = 1; len <= HUFF_TOKEN_MAX_CODE; len++) {
+		left = (left << 1) - (long)tc->count[len];
+		if (left < 0)
+			return -1;
+	}
+	if (left == 1L << HUFF_TOKEN_MAX_CODE)
+		return -1;
+
+	if (!(codes = huff_calloc(symbols, sizeof(u32))))
+		return -1;
+	huff_token_canonical(tc->lengths, symbols, codes, tc->first);
+
+	for (len = 1, k = 0; len <= HUFF_TOKEN_MAX_CODE; len++) {
+		tc->offset[len] = (u32)k;
+		pos[len] = (u32)k;
+		k += tc->count[len];
+	}
+
+	memset(tc->table, 0, sizeof(tc->table));
+	for (i = 0; i < symbols; i++) {
+		len = tc->lengths[i];
+		if (!len)
+			continue;
+
+		tc->sorted[pos[len]++] = (u16)i;
+		if (len > HUFF_TOKEN_TABLE_LOG)
+			continue;
+
+		/* every entry whose bits start with the code */
+		fill = 1UL << (HUFF_TOKEN_TABLE_LOG - len);
+		for (k = codes[i] * fill; fill; fill--, k++) {
+			tc->table[k].symbol = (u16)i;
+			tc->table[k].length = (u8)len;
+		}
+	}
+
+	huff_free(codes);
+	return 0;
+}
+
+/* Decode the data of a token block: a table lookup on the next
+ * HUFF_TOKEN_TABLE_LOG bits decodes a symbol, a character or a whole word,
+ * longer codes being decoded a length at a time from the canonical code.
+ * Return 0 if successful, otherwise -1.
+ */
+static int huff_token_read_data(huff_reader_t *reader, huff_writer_t *writer,
+	huff_token_code_t *tc)
+{
+	u64 bytes = (tc->data_length + BYTE - 1) / BYTE, out = 0, bits = 0;
+	u64 acc = 0, c = 0;
+	huff_sink_t sink;
+	u32 symbol, start, end;
+	int cnt = 0, len;
+	u8 ch;
+
+	ASSERT(huff_sink_begin(&sink, writer));
+
+	while (out < block_length) {
+		/* keep at least HUFF_TOKEN_MAX_CODE bits, zeros past the data */
+		for (; cnt <= HUFF_TOKEN_ACC_BITS - BYTE; cnt += BYTE) {
+			ch = 0;
+			if (bytes) {
+				ASSERT(huff_read_u8(reader, &ch));
+				bytes--;
+			}
+			acc |= (u64)ch << (HUFF_TOKEN_ACC_BITS - BYTE - cnt);
+		}
+
+		len = tc->table[acc >> (HUFF_TOKEN_ACC_BITS -
+			HUFF_TOKEN_TABLE_LOG)].length;
+		if (len) {
+			symbol = tc->table[acc >> (HUFF_TOKEN_ACC_BITS -
+				HUFF_TOKEN_TABLE_LOG)].symbol;
+		} else {
+			for (len = HUFF_TOKEN_TABLE_LOG + 1;
+				len <= HUFF_TOKEN_MAX_CODE; len++) {
+				c = acc >> (HUFF_TOKEN_ACC_BITS - len);
+				if (c >= tc->first[len] &&
+					c - tc->first[len] < tc->count[len]) {
+					break;
+				}
+			}
+			if (len > HUFF_TOKEN_MAX_CODE)
+				return -1;
+			symbol = tc->sorted[tc->offset[len] + c -
+				tc->first[len]];
+		}
+		acc <<= len;
+		cnt -= len;
+		bits += len;
+
+		if (symbol < ANSI_CHAR_SET_CARDINALITY) {
+			ASSERT(HUFF_SINK_PUT(&sink, (u8)symbol));
+			out++;
+			continue;
+		}
+
+		symbol -= ANSI_CHAR_SET_CARDINALITY;
+		start = tc->word_start[symbol];
+		end = tc->word_start[symbol + 1];
+		if (out + end - start > block_length)
+			return -1;
+		ASSERT(huff_sink_write(&sink, tc->word + start, end - start));
+		out += end - start;
+	}
+	ASSERT(huff_sink_end(&sink));
+
+	/* statistics */
+	file_stats.compressed_length += bits;
+	file_stats.coded_length += bits;
+
+	return bits == tc->data_length ? 0 : -1;
+}
+
+/* Decode the token block at the reader's position, following its block
+ * type, keeping the crc of its characters in block_crc.
+ * Return 0 if successful, otherwise -1.
+ */
+int huff_token_decode(huff_reader_t *reader, huff_writer_t *writer)
+{
+	u64 header_start = huff_reader_tell(reader);
+	huff_token_code_t *tc;
+	int i, ret = -1;
+
+	huff_block_reset();
+	if (!(tc = huff_calloc(1, sizeof(huff_token_code_t))))
+		return -1;
+
+	huff_stage_begin(HUFF_STAGE_HEADER);
+	if (huff_token_read_header(reader, tc))
+		goto Exit;
+	huff_stage_end(HUFF_STAGE_HEADER,
+		huff_reader_tell(reader) - header_start);
+
+	/* statistics */
+	file_stats.compressed_length +=
+		(huff_reader_tell(reader) - header_start) * BYTE;
+	for (i = 0; i < ANSI_CHAR_SET_CARDINALITY; i++)
+		representation_length[i] = tc->lengths[i];
+
+	huff_stage_begin(HUFF_STAGE_TREE);
+	if (huff_token_build_table(tc))
+		goto Exit;
+	huff_stage_end(HUFF_STAGE_TREE, block_length);
+
+	huff_stage_begin(HUFF_STAGE_DATA);
+	huff_writer_crc_begin(writer);
+	huff_writer_count(writer, frequency);
+	if (huff_token_read_data(reader, writer, tc))
+		goto Exit;
+	block_crc = huff_writer_crc_end(writer);
+	huff_stage_end(HUFF_STAGE_DATA, block_length);
+	ret = 0;
+
+Exit:
+	huff_free(tc->sorted);
+	huff_free(tc->lengths);
+	huff_free(tc->word_start);
+	huff_free(tc->word);
+	huff_free(tc);
+	return ret;
+}
@@ -0,0 +1,27 @@
+#ifndef _HUFFMAN_TOKEN_H_
+#define _HUFFMAN_TOKEN_H_
+
+#include "huffman.h"
+#include "huffman_io.h"
+
+/* Token blocks, written with --tokens: the block is split into words and
+ * separators, the runs of alphanumeric characters and of the others, and the
+ * tokens that repeat enough to pay for their place in the header form a
+ * dictionary of up to HUFF_TOKEN_MAX_WORDS words. A canonical huffman code
+ * over the ANSI characters and the words codes every word as one symbol and
+ * every other token as its characters. A token block is written where it is
+ * at least HUFF_TOKEN_GAIN_PERCENT shorter than the block written otherwise.
+ */
+#define HUFF_TOKEN_MAX_LENGTH 32 /* u8s of a token, longer runs are split */
+#define HUFF_TOKEN_MAX_WORDS 8192
+#define HUFF_TOKEN_MAX_CODE 20 /* bits of the longest code */
+#define HUFF_TOKEN_TABLE_LOG 12 /* bits decoded by one table lookup */
+#define HUFF_TOKEN_GAIN_PERCENT 1
+
+int huff_token_length(huff_reader_t *reader, u64 block_start, u64 *length);
+int huff_token_encode(huff_writer_t *writer, int is_estimate);
+void huff_token_free(void);
+int huff_token_decode(huff_reader_t *reader, huff_writer_t *writer);
+
+#endif
+